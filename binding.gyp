@@ -8,7 +8,19 @@
         "src/GetDevices.cc",
         "src/GetHostAPIs.cc",
       	"src/AudioIO.cc",
-      	"src/PaContext.cc"
+      	"src/PaContext.cc",
+      	"src/PaRuntime.cc",
+      	"src/Tracer.cc",
+      	"src/SampleFormat.cc",
+      	"src/Resampler.cc",
+      	"src/ChannelRouter.cc",
+      	"src/Meter.cc",
+      	"src/Gate.cc",
+      	"src/Gain.cc",
+      	"src/ClockEstimator.cc",
+      	"src/RateControl.cc",
+      	"src/WavWriter.cc",
+      	"src/WavFile.cc"
       ],
       "include_dirs": [
         "portaudio/include"
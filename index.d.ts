@@ -32,6 +32,12 @@ export interface DeviceInfo {
 /** Get list of supported devices */
 export function getDevices(): DeviceInfo[]
 
+/**
+ * Re-enumerate devices and host APIs, for example after a device has been plugged in.
+ * Device ids may change. Throws an error if any streams are open.
+ */
+export function refresh(): void
+
 /** The details returned from getHostAPIs for a particular device */
 export interface HostInfo {
   readonly id: number
@@ -74,14 +80,38 @@ export function getHostAPIs(): {
 export interface AudioOptions {
   /** Use -1 or omit the deviceId to select the default device. */
   deviceId?: number
-  /** The required sampleRate. For full-duplex streams it must be the same sample rate for both input and output. */
+  /** The sample rate of the stream. The device runs at this rate unless deviceSampleRate is set. */
   sampleRate?: number
+  /**
+   * The rate to run the device at, when it differs from the sampleRate of the stream. Audio is resampled on the
+   * audio thread. A full-duplex device runs at a single rate - set by either side, defaulting to the input sampleRate.
+   */
+  deviceSampleRate?: number
+  /** The quality of the resampler when the stream and device rates differ: 'low', 'medium' (the default) or 'high'. */
+  resampleQuality?: 'low' | 'medium' | 'high'
   /** The number of channels of sound to be delivered to the stream callback
    * It can range from 1 to the value of maxInputChannels from
    * DeviceInfo for the device specified by the device parameter.
    */
   channelCount?: number
+  /**
+   * Route the stream channels to and from a subset of the device channels, so that only the selected audio
+   * crosses into JavaScript. There is an entry for each stream channel. For input, an entry is the device channel
+   * to take, or an array of device channels to average. For output, an entry is the device channel to play to, or an
+   * array of them - stream channels sent to the same device channel are summed and device channels without a
+   * stream channel are silent. The channelCount defaults to the length of the map.
+   */
+  channelMap?: Array<number | number[]>
+  /** The number of channels to open the device with when using a channelMap. Defaults to the highest mapped channel + 1. */
+  deviceChannelCount?: number
   sampleFormat?: 1 | 8 | 16 | 24 | 32
+  /**
+   * The format the device is opened with, defaulting to sampleFormat. When this differs from the
+   * streamFormat, samples are converted on the audio thread, with integers scaled to the full range.
+   */
+  deviceFormat?: 1 | 8 | 16 | 24 | 32
+  /** The format of the buffers read from or written to the stream, defaulting to sampleFormat. */
+  streamFormat?: 1 | 8 | 16 | 24 | 32
   /** The number of blocks to buffer for a blocking. */
   maxQueue?: number
   /**
@@ -102,6 +132,144 @@ export interface AudioOptions {
   highwaterMark?: number
   /** Close the stream if an audio error is detected, if set false then just log the error. */
   closeOnError?: boolean
+  /**
+   * Output only. How the output is filled when data has not been written in time: 'silence' (the default),
+   * 'repeat' the last buffer played, or 'fade' the last buffer out and fade back in when data arrives.
+   * The stream keeps running in every case and each underrun is counted.
+   */
+  underrunPolicy?: 'silence' | 'repeat' | 'fade'
+  /**
+   * Input only. What to do with captured audio when the reader has fallen behind and maxQueue blocks are waiting:
+   * 'dropNewest' (the default) or 'dropOldest' block, or 'grow' the queue up to maxQueueBytes.
+   * The callback never waits - the buffer read after any dropped audio has its discontinuity property set.
+   */
+  overflowPolicy?: 'dropNewest' | 'dropOldest' | 'grow'
+  /** Input only. The limit on queued bytes when the overflowPolicy is 'grow'. Defaults to 1MB. */
+  maxQueueBytes?: number
+  /**
+   * Output only. Written buffers are played directly from the memory of the JS Buffer, which is held until it
+   * has been played and must not be modified in the meantime. Set true to copy each buffer as it is written.
+   */
+  copyWrites?: boolean
+  /**
+   * Output only. A target in milliseconds for the audio queued natively for playback. When set, the output
+   * is resampled at a rate steered to hold the queue at the target, for audio written at the pace of a clock
+   * other than the device's. The queue must hold more than the target - set maxQueue to allow for it. Off by default.
+   */
+  adaptiveLatency?: number
+  /** Output only. The most the adaptive rate may differ from the nominal rate, in parts per million. Defaults to 1000, at most 10000. */
+  adaptiveMaxPpm?: number
+  /**
+   * Input only. Set true to have captured buffers pushed into the stream from a native delivery thread as they
+   * are recorded, rather than each read waiting on a libuv threadpool thread. Delivery pauses while the stream
+   * buffer is above its highwaterMark, when the overflowPolicy applies to any audio still being captured.
+   */
+  pushMode?: boolean
+  /**
+   * Input only. Set a level in dBFS, such as -40, to gate the stream on voice activity. Captured audio is only
+   * passed on while the gate is open, and the stream emits 'gate' events with open set true or false and the
+   * timestamp of the first sample passed on, or the first sample held back. Off by default.
+   */
+  gateThreshold?: number
+  /** Input only. How far in dB the level must fall below the gateThreshold before the gate starts to close. Defaults to 6. */
+  gateHysteresis?: number
+  /** Input only. How long in milliseconds the level must stay low before the gate closes. Defaults to 300. */
+  gateHold?: number
+  /** Input only. How much audio in milliseconds from before the gate opened to pass on. Defaults to 100. */
+  gatePreRoll?: number
+  /** Input only. Zero crossings per second above which audio is treated as noise and does not open the gate. Defaults to 5000. */
+  gateMaxZcr?: number
+}
+
+/** A buffer read from an input stream or reader */
+export interface CapturedBuffer extends Buffer {
+  /** Stream time in seconds of the first sample. */
+  timestamp: number
+  /** Index of the first frame since the stream started, counting frames that were dropped. */
+  frame: number
+  /** Set on the first buffer read after audio was dropped. */
+  discontinuity?: boolean
+}
+
+/** A change of the voice gate, at the time of the first sample passed on or held back. */
+export interface GateEvent {
+  open: boolean
+  timestamp: number
+}
+
+/** Depth of a stream queue, now and at its peak */
+export interface QueueStats {
+  bytes: number
+  chunks: number
+  peakBytes: number
+  peakChunks: number
+}
+
+/** The device clock as measured against the steady system clock */
+export interface ClockEstimate {
+  /** The device's sample rate in frames per second of system time. */
+  sampleRate: number
+  /** How far the measured rate is from the nominal rate, in parts per million. */
+  ppm: number
+  /** RMS difference between the callback times and the smoothed clock, in milliseconds. */
+  jitter: number
+  /** The stream time less the system time, in seconds. */
+  offset: number
+  /** False while the estimator is settling, after the stream starts or a jump in the callback times. */
+  locked: boolean
+  /** How many times the estimator has restarted after a jump in the callback times. */
+  resets: number
+}
+
+/** The state of an output resampled to hold its queue at the adaptiveLatency */
+export interface AdaptiveStats {
+  /** How much faster than nominal the written audio is being played, in parts per million. */
+  ppm: number
+  /** The smoothed depth of the output queue in milliseconds. */
+  latency: number
+  /** The latency less the target, in milliseconds. */
+  latencyError: number
+}
+
+/** Counters for a stream since it was created */
+export interface StreamStats {
+  /** The number of times the PortAudio callback has run. */
+  callbacks: number
+  framesProcessed: number
+  /** The number of callbacks reporting each PortAudio status flag. */
+  xruns: {
+    inputUnderflow: number
+    inputOverflow: number
+    outputUnderflow: number
+    outputOverflow: number
+    primingOutput: number
+  }
+  /** Input only. Captured blocks dropped by the overflowPolicy, and the frames they held. */
+  overflows?: number
+  droppedFrames?: number
+  /** Output only. Callbacks that ran out of data, and the frames filled by the underrunPolicy. */
+  underruns?: number
+  underrunFrames?: number
+  /** Output only. Frames trimmed from the start of scheduled writes that arrived after their time. */
+  lateFrames?: number
+  /** Output only, with adaptiveLatency set. */
+  adaptive?: AdaptiveStats
+  inQueue?: QueueStats
+  outQueue?: QueueStats
+  /** Input only. The queue and drop counters of each capture reader. */
+  readers?: ReaderStats[]
+  /** Time spent in the callback in microseconds. The p99 value is accurate to within 25%. */
+  callbackTime: { min: number, avg: number, max: number, p99: number }
+  /** The PortAudio estimate of the CPU load of the callback, from 0.0 to 1.0. */
+  cpuLoad: number
+}
+
+export interface ReaderStats {
+  id: number
+  bytes: number
+  chunks: number
+  overflows: number
+  droppedFrames: number
 }
 
 export interface IoStream {
@@ -120,18 +288,146 @@ export interface IoStream {
    * The optional callback will execute when the abort has completed.
    */
   abort(callback?: () => void): void
+  /**
+   * Set the gain of the output, or of the input of an input-only stream. The change starts with the next
+   * audio callback and ramps linearly to the new gain over rampMs milliseconds, 0 by default.
+   */
+  setGain(gain: number, rampMs?: number): void
+  /** Set the gain of the input of a stream with input, as for setGain. */
+  setInputGain?(gain: number, rampMs?: number): void
+  /** Get the counters for the stream, which may be called at any time. */
+  getStats(): StreamStats
+  /** Get the current time of the stream clock in seconds, as used by buffer timestamps and scheduled writes. */
+  getStreamTime(): number
+  /** Get the estimate of the device clock, which may be called at any time. */
+  getClock(): ClockEstimate
+  /** Convert a stream time to seconds on the steady system clock that process.hrtime() reads on Linux and Windows. */
+  toSystemTime(streamTime: number): number
+  /** Convert seconds on the steady system clock to a stream time. */
+  fromSystemTime(systemTime: number): number
+  /**
+   * Write the events recorded by a stream created with the trace option to a file in Chrome Trace Event
+   * format, which can be loaded into chrome://tracing or https://ui.perfetto.dev.
+   * @returns a promise that resolves when the file has been written.
+   */
+  dumpTrace(path: string): Promise<void>
+}
+
+/** A stream of audio mixed into an output alongside the data written to the output stream itself. */
+export interface MixSource extends NodeJS.WritableStream {
+  /** Change the gain applied to the source, which is ramped over one buffer. */
+  setGain(gain: number): void
+  /** Fade the source out and remove it from the mix without playing the rest of its data. */
+  remove(): void
+}
+
+export interface MixSourceOptions {
+  /** The gain applied to the source, 1.0 by default. */
+  gain?: number
+  /** The amount of data potentially buffered by the source stream in bytes. */
+  highwaterMark?: number
+}
+
+export interface PlayFileOptions {
+  /** The gain applied to the file, 1.0 by default. */
+  gain?: number
+}
+
+/** A WAV file playing as a mix source. */
+export interface FilePlayback {
+  /** The length of the file in frames. */
+  frames: number
+  /** Change the gain applied to the file, which is ramped over one buffer. */
+  setGain(gain: number): void
+  /** Fade the file out and remove it from the mix. */
+  stop(): void
+}
+
+export interface IoStreamMix {
+  /**
+   * Add a source to be mixed into the output, in the same format as the output stream. The source leaves the
+   * mix when it has been ended and its data played, or when it is removed.
+   */
+  addSource(options?: MixSourceOptions): MixSource
+  /**
+   * Play a WAV or RF64 file as a mix source, read from a memory mapping in the audio callback. The file must
+   * have the channel count and sample rate of the output stream, in 8, 16, 24 or 32 bit PCM or 32 bit float.
+   */
+  playFile(path: string, options?: PlayFileOptions): FilePlayback
+}
+
+export interface CaptureReaderOptions {
+  /** What to drop when the reader falls behind, 'dropNewest' (default) or 'dropOldest'. */
+  overflowPolicy?: 'dropNewest' | 'dropOldest'
+  /** The number of captured blocks queued for the reader, up to the maxQueue of the input (the default). */
+  maxQueue?: number
+  /** The amount of data potentially buffered by the reader stream in bytes. */
+  highwaterMark?: number
+}
+
+export interface RecordOptions {
+  /** Disk space reserved ahead of the writes in bytes, where the platform supports it - defaults to 64MB, 0 for none. */
+  preallocate?: number
+  /** Interval between header updates in milliseconds, so that an unfinished recording still opens - defaults to 1000, 0 for none. */
+  headerInterval?: number
+}
+
+export interface RecordStats {
+  /** Frames written to the file. */
+  frames: number
+  /** Frames of silence written in place of blocks dropped because the writer fell behind. */
+  silentFrames: number
+  /** Frames dropped because the writer fell behind. */
+  droppedFrames: number
+  /** Whether the data passed 4GB, so that the file was written as RF64. */
+  rf64: boolean
+}
+
+export interface Recording {
+  /** Write what has been captured, update the header and close the file. */
+  stop(): Promise<RecordStats>
+}
+
+export interface IoStreamFanout {
+  /**
+   * Add a further reader of the capture. Each reader receives every captured buffer, shared with the stream
+   * and the other readers without copying, and drops blocks by its own policy if it falls behind.
+   * Destroy the reader to close it.
+   */
+  addReader(options?: CaptureReaderOptions): NodeJS.ReadableStream
+  /**
+   * Write the capture to a WAV file from a native thread, alongside or instead of reading the stream.
+   * The file becomes RF64 if the data passes 4GB. Quitting the stream stops the recording.
+   */
+  recordTo(path: string, options?: RecordOptions): Recording
+}
+
+export interface WriteOptions {
+  /** The stream time in seconds at which the first frame of the buffer is to be played. */
+  at?: number
+}
+
+export interface IoStreamScheduled {
+  /**
+   * Write a buffer to be played from a given stream time. Silence fills the gap before a buffer that
+   * arrives early, and the part of a late buffer whose time has passed is skipped.
+   */
+  write(chunk: Buffer, options: WriteOptions, callback?: (error: Error | null | undefined) => void): boolean
 }
 
 /** Interface classes returned from AudioIO creation, dependant on which options are provided. */
-export interface IoStreamRead extends IoStream, NodeJS.ReadableStream {}
-export interface IoStreamWrite extends IoStream, NodeJS.WritableStream {}
-export interface IoStreamDuplex extends IoStream, NodeJS.ReadableStream, NodeJS.WritableStream {}
+export interface IoStreamRead extends IoStream, IoStreamFanout, NodeJS.ReadableStream {}
+export interface IoStreamWrite extends IoStream, IoStreamMix, IoStreamScheduled, NodeJS.WritableStream {}
+export interface IoStreamDuplex extends IoStream, IoStreamMix, IoStreamScheduled, IoStreamFanout, NodeJS.ReadableStream, NodeJS.WritableStream {}
 
 /**
  * Create an AudioIO object. If both inOptions and outOptions are provided, a duplex stream is created.
  * When just inOptions are provided, a readStream is created. When just outOptions, a writeStream is created.
  * @param options object containing inOptions for readStreams, outOptions for writeStreams or both for duplex streams.
+ * Set trace to true, or to the number of events to keep (65536 by default), to record a timeline for dumpTrace.
+ * Set meter to an interval in milliseconds to receive 'meter' events, each with a Float32Array holding the peak,
+ * RMS and clip count of every input device channel followed by every output device channel over the interval.
  */
-export function AudioIO(options: { inOptions: AudioOptions }): IoStreamRead
-export function AudioIO(options: { outOptions: AudioOptions }): IoStreamWrite
-export function AudioIO(options: { inOptions: AudioOptions, outOptions: AudioOptions }): IoStreamDuplex
+export function AudioIO(options: { inOptions: AudioOptions, trace?: boolean | number, meter?: number }): IoStreamRead
+export function AudioIO(options: { outOptions: AudioOptions, trace?: boolean | number, meter?: number }): IoStreamWrite
+export function AudioIO(options: { inOptions: AudioOptions, outOptions: AudioOptions, trace?: boolean | number, meter?: number }): IoStreamDuplex
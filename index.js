@@ -19,6 +19,9 @@ const portAudioBindings = require("bindings")("naudiodon.node");
 var SegfaultHandler = require('node-segfault-handler');
 SegfaultHandler.registerHandler("crash.log");
 
+// the stream time at which a written buffer is to be played
+const playAt = Symbol('playAt');
+
 exports.SampleFormatFloat32 = 1;
 exports.SampleFormat8Bit = 8;
 exports.SampleFormat16Bit = 16;
@@ -27,30 +30,58 @@ exports.SampleFormat32Bit = 32;
 
 exports.getDevices = portAudioBindings.getDevices;
 exports.getHostAPIs = portAudioBindings.getHostAPIs;
+exports.refresh = portAudioBindings.refresh;
 
 function AudioIO(options) {
   const audioIOAdon = portAudioBindings.create(options);
   let ioStream;
 
+  // a gate opens before the buffer it comes with and closes after it
+  const pushResult = result => {
+    if (result.gate && result.gate.open)
+      ioStream.emit('gate', result.gate);
+    const more = ioStream.push(result.finished ? null : result.buf);
+    if (result.gate && !result.gate.open)
+      ioStream.emit('gate', result.gate);
+    return more;
+  };
+
   const doRead = async size => {
     const result = await audioIOAdon.read(size);
     if (result.err)
       ioStream.destroy(result.err);
-    else {
-      if (result.finished)
-        ioStream.push(null);
-      else
-        ioStream.push(result.buf);
-    };
+    else
+      pushResult(result);
+  };
+
+  // in push mode captured buffers arrive from a native thread as they are recorded
+  let pushPaused = false;
+  const onPush = result => {
+    if (result.err)
+      ioStream.destroy(result.err);
+    else if (result.finished)
+      ioStream.push(null);
+    else if (!pushResult(result) && !pushPaused) {
+      pushPaused = true;
+      audioIOAdon.pausePush(true);
+    }
+  };
+
+  const doPushRead = size => {
+    if (pushPaused) {
+      pushPaused = false;
+      audioIOAdon.pausePush(false);
+    }
   };
 
   const doWrite = async (chunk, encoding, cb) => {
-    const err = await audioIOAdon.write(chunk);
+    const err = await audioIOAdon.write(chunk, chunk[playAt]);
     cb(err);
   }
 
   const readable = 'inOptions' in options;
   const writable = 'outOptions' in options;
+  const pushMode = readable && options.inOptions.pushMode === true;
   if (readable && writable) {
     ioStream = new Duplex({
       allowHalfOpen: false,
@@ -58,14 +89,14 @@ function AudioIO(options) {
       writableObjectMode: false,
       readableHighWaterMark: options.inOptions ? options.inOptions.highwaterMark || 16384 : 16384,
       writableHighWaterMark: options.outOptions ? options.outOptions.highwaterMark || 16384 : 16384,
-      read: doRead,
+      read: pushMode ? doPushRead : doRead,
       write: doWrite
     });
   } else if (readable) {
     ioStream = new Readable({
       highWaterMark: options.inOptions.highwaterMark || 16384,
       objectMode: false,
-      read: doRead
+      read: pushMode ? doPushRead : doRead
     });
   } else {
     ioStream = new Writable({
@@ -76,10 +107,126 @@ function AudioIO(options) {
     });
   }
 
-  ioStream.start = () => audioIOAdon.start();
+  ioStream.getStats = () => audioIOAdon.getStats();
+  ioStream.getStreamTime = () => audioIOAdon.getStreamTime();
+  ioStream.getClock = () => audioIOAdon.getClock();
+  ioStream.toSystemTime = streamTime => audioIOAdon.convertTime(streamTime, true);
+  ioStream.fromSystemTime = systemTime => audioIOAdon.convertTime(systemTime, false);
+
+  // write(buf, { at }) plays the first frame of buf at stream time at - the time is carried
+  // to doWrite on a view of the buffer, so the caller's buffer is left as it is
+  if (writable) {
+    const write = ioStream.write.bind(ioStream);
+    ioStream.write = (chunk, options, cb) => {
+      if (!options || (typeof options !== 'object'))
+        return write(chunk, options, cb);
+      if (typeof options.at === 'number' && Buffer.isBuffer(chunk)) {
+        chunk = Buffer.from(chunk.buffer, chunk.byteOffset, chunk.length);
+        chunk[playAt] = options.at;
+      }
+      return write(chunk, cb);
+    };
+  }
+
+  // gain changes are picked up by the next callback and ramped over rampMs
+  ioStream.setGain = (gain, rampMs = 0) => audioIOAdon.setGain(!writable, gain, rampMs);
+  if (readable)
+    ioStream.setInputGain = (gain, rampMs = 0) => audioIOAdon.setGain(true, gain, rampMs);
+  ioStream.dumpTrace = path => audioIOAdon.dumpTrace(path);
+
+  // a source is a writable stream of its own that is mixed into the output with the main stream
+  if (writable) {
+    ioStream.addSource = (sourceOptions = {}) => {
+      const id = audioIOAdon.addSource(typeof sourceOptions.gain === 'number' ? sourceOptions.gain : 1.0);
+      const source = new Writable({
+        highWaterMark: sourceOptions.highwaterMark || 16384,
+        decodeStrings: false,
+        objectMode: false,
+        write: async (chunk, encoding, cb) => {
+          try {
+            cb(await audioIOAdon.writeSource(id, chunk));
+          } catch (err) {
+            cb(err);
+          }
+        },
+        final: cb => {
+          audioIOAdon.endSource(id, false);
+          cb();
+        }
+      });
+      source.on('error', err => console.error('AudioIO source:', err));
+      source.setGain = gain => audioIOAdon.setSourceGain(id, gain);
+      source.remove = () => {
+        audioIOAdon.endSource(id, true);
+        source.destroy();
+      };
+      return source;
+    };
+
+    // a WAV file is played from a memory mapping as another mix source, without passing through JS
+    ioStream.playFile = (path, playOptions = {}) => {
+      const file = audioIOAdon.playFile(path, typeof playOptions.gain === 'number' ? playOptions.gain : 1.0);
+      return {
+        frames: file.frames,
+        setGain: gain => audioIOAdon.setSourceGain(file.id, gain),
+        stop: () => audioIOAdon.endSource(file.id, true)
+      };
+    };
+  }
+
+  // a reader is a readable stream of its own over the same capture, sharing its buffers
+  if (readable) {
+    ioStream.addReader = (readerOptions = {}) => {
+      const id = audioIOAdon.addReader(readerOptions.overflowPolicy || 'dropNewest', readerOptions.maxQueue || 0);
+      const reader = new Readable({
+        highWaterMark: readerOptions.highwaterMark || 16384,
+        objectMode: false,
+        read: async size => {
+          try {
+            const result = await audioIOAdon.readReader(id, size);
+            if (result.err)
+              reader.destroy(result.err);
+            else
+              reader.push(result.finished ? null : result.buf);
+          } catch (err) {
+            reader.destroy(err);
+          }
+        },
+        destroy: (err, cb) => {
+          audioIOAdon.closeReader(id);
+          cb(err);
+        }
+      });
+      reader.on('error', err => console.error('AudioIO reader:', err));
+      return reader;
+    };
+  }
+
+  // a recording is written to disk by a native thread, alongside or instead of reading the stream
+  let recording = null;
+  if (readable) {
+    ioStream.recordTo = (path, recordOptions = {}) => {
+      audioIOAdon.recordTo(path,
+        typeof recordOptions.preallocate === 'number' ? recordOptions.preallocate : 64 * 1024 * 1024,
+        typeof recordOptions.headerInterval === 'number' ? recordOptions.headerInterval : 1000);
+      let stopped = null;
+      recording = { stop: () => stopped || (stopped = audioIOAdon.stopRecord()) };
+      return recording;
+    };
+  }
+
+  ioStream.start = () => {
+    audioIOAdon.start();
+    if (pushMode)
+      audioIOAdon.startPush(onPush);
+    if (options.meter)
+      audioIOAdon.startMeter(levels => ioStream.emit('meter', levels));
+  };
 
   ioStream.quit = async cb => {
     await audioIOAdon.quit('WAIT');
+    if (recording)
+      await recording.stop().catch(err => console.error('AudioIO recording:', err));
     if (typeof cb === 'function')
       cb();
   }
@@ -0,0 +1,77 @@
+/* Copyright 2019 Streampunk Media Ltd.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+// Throughput of the sample format conversions at each vector level, checked
+// against the scalar result. Build from the repository root with:
+//   g++ -O2 -std=c++11 -Isrc scratch/convertBench.cc src/SampleFormat.cc -o convertBench
+
+#include "SampleFormat.h"
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+using namespace streampunk;
+
+static const uint32_t numSamples = 48000 * 2;
+static const uint32_t numRuns = 200;
+
+static void fill(std::vector<uint8_t> &buf, uint32_t format) {
+  uint32_t n = (uint32_t)buf.size() / sampleBytes(format);
+  std::vector<float> f(n);
+  for (uint32_t i = 0; i < n; ++i)
+    f[i] = -1.1f + 2.2f * (float)((i * 7919u) % n) / n; // includes out of range values
+  convertSamples((const uint8_t *)f.data(), 1, buf.data(), format, n);
+}
+
+int main() {
+  const uint32_t formats[] = { 1, 8, 16, 24, 32 };
+  const char *levelNames[] = { "scalar", "sse2", "avx2" };
+  eSimdLevel maxLevel = simdLevel();
+  printf("%-6s %-6s", "from", "to");
+  for (uint32_t l = 0; l <= (uint32_t)maxLevel; ++l)
+    printf(" %10s", levelNames[l]);
+  printf("   (Msamples/s)\n");
+
+  for (uint32_t src : formats) {
+    for (uint32_t dst : formats) {
+      if (src == dst)
+        continue;
+      std::vector<uint8_t> in(numSamples * sampleBytes(src));
+      std::vector<uint8_t> ref(numSamples * sampleBytes(dst));
+      std::vector<uint8_t> out(numSamples * sampleBytes(dst));
+      fill(in, src);
+
+      printf("%-6u %-6u", src, dst);
+      for (uint32_t l = 0; l <= (uint32_t)maxLevel; ++l) {
+        setSimdLevel((eSimdLevel)l);
+        convertSamples(in.data(), src, out.data(), dst, numSamples);
+        if (0 == l)
+          ref = out;
+        bool match = 0 == memcmp(ref.data(), out.data(), ref.size());
+
+        auto start = std::chrono::steady_clock::now();
+        for (uint32_t r = 0; r < numRuns; ++r)
+          convertSamples(in.data(), src, out.data(), dst, numSamples);
+        std::chrono::duration<double> secs = std::chrono::steady_clock::now() - start;
+        printf(" %9.0f%s", numSamples * (double)numRuns / secs.count() / 1e6, match ? " " : "!");
+      }
+      printf("\n");
+      setSimdLevel(maxLevel);
+    }
+  }
+  printf("! marks a result that differs from scalar\n");
+  return 0;
+}
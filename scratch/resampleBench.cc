@@ -0,0 +1,91 @@
+/* Copyright 2019 Streampunk Media Ltd.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+// Cost of the sample rate converter in CPU cycles per output sample at each
+// quality, with the signal to noise ratio of a resampled 1kHz tone. Build from
+// the repository root with:
+//   g++ -O2 -std=c++11 -Isrc scratch/resampleBench.cc src/Resampler.cc src/SampleFormat.cc -o resampleBench
+
+#include "Resampler.h"
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <vector>
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#include <x86intrin.h>
+#define HAVE_RDTSC 1
+#endif
+
+using namespace streampunk;
+
+static const uint32_t channels = 2;
+static const uint32_t blockFrames = 256;
+static const double seconds = 10.0;
+static const double toneHz = 1000.0;
+static const double pi = 3.14159265358979323846;
+
+static uint64_t ticks() {
+#if defined(HAVE_RDTSC)
+  return __rdtsc();
+#else
+  return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+static void run(double inRate, double outRate, eResampleQuality quality, const char *name) {
+  uint32_t inTotal = (uint32_t)(inRate * seconds);
+  std::vector<float> in(inTotal * channels);
+  for (uint32_t f = 0; f < inTotal; ++f)
+    for (uint32_t c = 0; c < channels; ++c)
+      in[f * channels + c] = 0.5f * (float)std::sin(2.0 * pi * toneHz * f / inRate);
+
+  Resampler resampler(channels, inRate, outRate, quality, blockFrames);
+  std::vector<float> out(resampler.maxOutputFrames(inTotal) * channels);
+  uint32_t outTotal = 0;
+  uint64_t start = ticks();
+  for (uint32_t f = 0; f < inTotal; f += blockFrames) {
+    uint32_t inFrames = std::min<uint32_t>(blockFrames, inTotal - f);
+    outTotal += resampler.process((const uint8_t *)(in.data() + f * channels), 1, inFrames,
+                                  (uint8_t *)(out.data() + outTotal * channels), 1, resampler.maxOutputFrames(inFrames));
+  }
+  uint64_t elapsed = ticks() - start;
+
+  // compare with the ideal tone, skipping the filter's start up
+  double signal = 0.0, noise = 0.0;
+  for (uint32_t f = resampler.taps(); f < outTotal - resampler.taps(); ++f) {
+    double ideal = 0.5 * std::sin(2.0 * pi * toneHz * f / outRate);
+    double err = out[f * channels] - ideal;
+    signal += ideal * ideal;
+    noise += err * err;
+  }
+  printf("%-6s %6.0f -> %6.0f %5u taps %8.1f %s/sample %7.1f dB SNR\n", name, inRate, outRate, resampler.taps(),
+         (double)elapsed / (outTotal * channels),
+#if defined(HAVE_RDTSC)
+         "cycles",
+#else
+         "ns",
+#endif
+         10.0 * std::log10(signal / noise));
+}
+
+int main() {
+  const char *names[] = { "low", "medium", "high" };
+  const double rates[][2] = { { 44100, 48000 }, { 48000, 44100 }, { 48000, 16000 } };
+  for (const auto &r : rates)
+    for (uint32_t q = 0; q < 3; ++q)
+      run(r[0], r[1], (eResampleQuality)q, names[q]);
+  return 0;
+}
@@ -16,6 +16,7 @@
 #include "AudioIO.h"
 #include "naudiodonUtil.h"
 #include "Memory.h"
+#include "Tracer.h"
 #include <map>
 
 namespace streampunk {
@@ -71,7 +72,28 @@ AudioIO::AudioIO(napi_env env, napi_callback_info info): mInstanceRef(nullptr) {
     return;
   }
 
+  // trace may be true, or the number of events to keep
+  bool hasTrace = false, trace = false;
+  uint32_t traceEvents = 0;
+  status = naud_get_bool(env, optionsObj, "trace", &hasTrace, &trace);
+  FLOATING_STATUS;
+  if (hasTrace)
+    traceEvents = trace ? 65536 : 0;
+  else {
+    status = naud_get_uint32(env, optionsObj, "trace", &traceEvents);
+    FLOATING_STATUS;
+  }
+
+  // meter is the interval between level readings in milliseconds
+  uint32_t meterInterval = 0;
+  status = naud_get_uint32(env, optionsObj, "meter", &meterInterval);
+  FLOATING_STATUS;
+
   mPaContext = std::make_shared<PaContext>(env, hasInOptions ? inOptions : undef, hasOutOptions ? outOptions: undef);
+  if (traceEvents)
+    mPaContext->setTracer(std::make_shared<Tracer>(traceEvents));
+  if (meterInterval)
+    mPaContext->setMeter(meterInterval);
 }
 
 napi_status AudioIO::Init(napi_env env) {
@@ -82,10 +104,29 @@ napi_status AudioIO::Init(napi_env env) {
     DECLARE_NAPI_METHOD("start", sStart),
     DECLARE_NAPI_METHOD("read", sRead),
     DECLARE_NAPI_METHOD("write", sWrite),
-    DECLARE_NAPI_METHOD("quit", sQuit)
+    DECLARE_NAPI_METHOD("quit", sQuit),
+    DECLARE_NAPI_METHOD("startPush", sStartPush),
+    DECLARE_NAPI_METHOD("pausePush", sPausePush),
+    DECLARE_NAPI_METHOD("getStats", sGetStats),
+    DECLARE_NAPI_METHOD("getStreamTime", sGetStreamTime),
+    DECLARE_NAPI_METHOD("getClock", sGetClock),
+    DECLARE_NAPI_METHOD("convertTime", sConvertTime),
+    DECLARE_NAPI_METHOD("dumpTrace", sDumpTrace),
+    DECLARE_NAPI_METHOD("addSource", sAddSource),
+    DECLARE_NAPI_METHOD("writeSource", sWriteSource),
+    DECLARE_NAPI_METHOD("setSourceGain", sSetSourceGain),
+    DECLARE_NAPI_METHOD("endSource", sEndSource),
+    DECLARE_NAPI_METHOD("playFile", sPlayFile),
+    DECLARE_NAPI_METHOD("addReader", sAddReader),
+    DECLARE_NAPI_METHOD("readReader", sReadReader),
+    DECLARE_NAPI_METHOD("closeReader", sCloseReader),
+    DECLARE_NAPI_METHOD("startMeter", sStartMeter),
+    DECLARE_NAPI_METHOD("setGain", sSetGain),
+    DECLARE_NAPI_METHOD("recordTo", sRecordTo),
+    DECLARE_NAPI_METHOD("stopRecord", sStopRecord)
   };
 
-  status = napi_define_class(env, "AudioIO", NAPI_AUTO_LENGTH, Construct, nullptr, 4, properties, &constructor);
+  status = napi_define_class(env, "AudioIO", NAPI_AUTO_LENGTH, Construct, nullptr, 23, properties, &constructor);
   PASS_STATUS;
 
   status = napi_create_reference(env, constructor, 1, &constructorRef);
@@ -153,51 +194,96 @@ napi_value AudioIO::Start(napi_env env, napi_callback_info info) {
   return result;
 }
 
+void finalizeChunk(napi_env env, void* data, void* hint) {
+  delete (std::shared_ptr<Chunk> *)hint;
+}
+
 void readExecute(napi_env env, void* data) {
   asyncCarrier* c = (asyncCarrier*) data;
+  TraceScope trace(c->mPaContext->tracer(), "readExecute", "libuv worker");
   c->mChunk = c->mPaContext->pullInChunk(c->mNumBytes, c->mFinished);
+  trace.setDepth(c->mPaContext->inQueuedBytes(), -1);
 }
 
-void readComplete(napi_env env, napi_status asyncStatus, void* data) {
-  asyncCarrier* c = (asyncCarrier*) data;
-  napi_value result, buffer, ts, finInt, finished, err;
+// Builds the result of a read - the next captured buffer, or an error. Only reads of the
+// main stream check the PortAudio status, as checking clears it for the stream.
+napi_status makeReadResult(napi_env env, std::shared_ptr<PaContext> paContext,
+                           std::shared_ptr<Chunk> chunk, bool isFinished, bool checkStatus, napi_value *result) {
+  napi_status status;
+  napi_value buffer, finInt, finished, err;
   std::string errStr;
   void* bufferData;
 
+  status = napi_create_object(env, result);
+  PASS_STATUS;
+  if (checkStatus && paContext->getErrStr(errStr, /*isInput*/true)) {
+    status = napi_create_string_utf8(env, errStr.c_str(), NAPI_AUTO_LENGTH, &err);
+    PASS_STATUS;
+    return napi_set_named_property(env, *result, "err", err);
+  }
+
+  if (chunk && chunk->numBytes()) {
+    // hand the captured memory to JS without copying, holding the chunk until the buffer is collected
+    status = napi_generic_failure;
+    if (chunk->lend()) {
+      std::shared_ptr<Chunk> *chunkRef = new std::shared_ptr<Chunk>(chunk);
+      status = napi_create_external_buffer(env, chunk->numBytes(), chunk->buf(),
+                                           finalizeChunk, chunkRef, &buffer);
+      if (status != napi_ok) // external buffers are not allowed by this runtime
+        delete chunkRef;
+    }
+    if (status != napi_ok)
+      status = napi_create_buffer_copy(env, chunk->numBytes(), chunk->buf(), &bufferData, &buffer);
+    PASS_STATUS;
+    status = naud_set_double(env, buffer, "timestamp", chunk->ts());
+    PASS_STATUS;
+    // exact as a number for 2^53 frames, far longer than any stream will run
+    status = naud_set_double(env, buffer, "frame", (double)chunk->frame());
+    PASS_STATUS;
+    if (chunk->discontinuity()) {
+      status = naud_set_bool(env, buffer, "discontinuity", true);
+      PASS_STATUS;
+    }
+    bool gateOpen;
+    double gateTs;
+    if (chunk->gateEdge(gateOpen, gateTs)) {
+      napi_value gate;
+      status = napi_create_object(env, &gate);
+      PASS_STATUS;
+      status = naud_set_bool(env, gate, "open", gateOpen);
+      PASS_STATUS;
+      status = naud_set_double(env, gate, "timestamp", gateTs);
+      PASS_STATUS;
+      status = napi_set_named_property(env, *result, "gate", gate);
+      PASS_STATUS;
+    }
+  } else {
+    status = napi_create_buffer_copy(env, 0, nullptr, &bufferData, &buffer);
+    PASS_STATUS;
+  }
+  status = napi_set_named_property(env, *result, "buf", buffer);
+  PASS_STATUS;
+  status = napi_create_uint32(env, isFinished, &finInt);
+  PASS_STATUS;
+  status = napi_coerce_to_bool(env, finInt, &finished);
+  PASS_STATUS;
+  status = napi_set_named_property(env, *result, "finished", finished);
+  return status;
+}
+
+void readComplete(napi_env env, napi_status asyncStatus, void* data) {
+  asyncCarrier* c = (asyncCarrier*) data;
+  napi_value result;
+  TraceScope trace(c->mPaContext->tracer(), "readComplete", "JS");
+
   if (asyncStatus != napi_ok) {
     c->status = asyncStatus;
     c->errorMsg = "Async read failed to complete";
   }
   REJECT_STATUS;
 
-  c->status = napi_create_object(env, &result);
+  c->status = makeReadResult(env, c->mPaContext, c->mChunk, c->mFinished, /*checkStatus*/!c->mReader, &result);
   REJECT_STATUS;
-  if (c->mPaContext->getErrStr(errStr, /*isInput*/true)) {
-    c->status = napi_create_string_utf8(env, errStr.c_str(), NAPI_AUTO_LENGTH, &err);
-    REJECT_STATUS;
-    c->status = napi_set_named_property(env, result, "err", err);
-    REJECT_STATUS;
-  } else {
-    if (c->mChunk && c->mChunk->numBytes()) {
-      c->status = napi_create_buffer_copy(env, c->mChunk->numBytes(), c->mChunk->buf(), &bufferData, &buffer);
-      REJECT_STATUS;
-      c->status = napi_create_uint32(env, c->mChunk->ts(), &ts);
-      REJECT_STATUS;
-      c->status = napi_set_named_property(env, buffer, "timestamp", ts);
-      REJECT_STATUS;
-    } else {
-      c->status = napi_create_buffer_copy(env, 0, nullptr, &bufferData, &buffer);
-      REJECT_STATUS;
-    }
-    c->status = napi_set_named_property(env, result, "buf", buffer);
-    REJECT_STATUS;
-    c->status = napi_create_uint32(env, c->mFinished, &finInt);
-    REJECT_STATUS;
-    c->status = napi_coerce_to_bool(env, finInt, &finished);
-    REJECT_STATUS;
-    c->status = napi_set_named_property(env, result, "finished", finished);
-    REJECT_STATUS;
-  }
 
   napi_status status;
   status = napi_resolve_deferred(env, c->_deferred, result);
@@ -243,13 +329,18 @@ napi_value AudioIO::Read(napi_env env, napi_callback_info info) {
 
 void writeExecute(napi_env env, void* data) {
   asyncCarrier* c = (asyncCarrier*) data;
+  TraceScope trace(c->mPaContext->tracer(), "writeExecute", "libuv worker");
   c->mPaContext->pushOutChunk(c->mChunk);
+  trace.setDepth(-1, c->mPaContext->outQueuedBytes());
 }
 
 void writeComplete(napi_env env, napi_status asyncStatus, void* data) {
   asyncCarrier* c = (asyncCarrier*) data;
   napi_value result;
   std::string errStr;
+  TraceScope trace(c->mPaContext->tracer(), "writeComplete", "JS");
+
+  c->mPaContext->releaseOutChunks(env, /*flush*/false);
 
   if (asyncStatus != napi_ok) {
     c->status = asyncStatus;
@@ -285,19 +376,31 @@ napi_value AudioIO::Write(napi_env env, napi_callback_info info) {
   c->status = napi_create_promise(env, &c->_deferred, &promise);
   REJECT_RETURN;
 
-  size_t argc = 1;
-  napi_value args[1];
+  size_t argc = 2;
+  napi_value args[2];
   c->status = napi_get_cb_info(env, info, &argc, args, nullptr, nullptr);
   REJECT_RETURN;
 
-  if (argc != 1)
-    NAPI_THROW_ERROR("AudioIO Write expects 1 argument");
+  if ((argc < 1) || (argc > 2))
+    NAPI_THROW_ERROR("AudioIO Write expects 1 or 2 arguments");
 
   c->status = napi_is_buffer(env, args[0], &isBuffer);
   REJECT_RETURN;
   if (!isBuffer)
     NAPI_THROW_ERROR("AudioIO Write expects a valid chunk buffer as the first parameter");
-  c->mChunk = std::make_shared<Chunk>(env, args[0]);
+  // an optional stream time at which the first frame is to be played
+  double at = 0.0;
+  napi_valuetype atType = napi_undefined;
+  if (argc > 1) {
+    c->status = napi_typeof(env, args[1], &atType);
+    REJECT_RETURN;
+  }
+  if ((napi_undefined != atType) && (napi_ok != napi_get_value_double(env, args[1], &at)))
+    NAPI_THROW_ERROR("AudioIO Write expects a stream time in seconds as the second parameter");
+  mPaContext->releaseOutChunks(env, /*flush*/false);
+  c->mChunk = std::make_shared<Chunk>(env, args[0], mPaContext->copyWrites());
+  if (napi_undefined != atType)
+    c->mChunk->schedule(at);
 
   c->status = napi_create_string_utf8(env, "Write", NAPI_AUTO_LENGTH, &resourceName);
   REJECT_RETURN;
@@ -320,6 +423,9 @@ void quitComplete(napi_env env, napi_status asyncStatus, void* data) {
   asyncCarrier* c = (asyncCarrier*) data;
   napi_value result;
 
+  // the stream has stopped so any chunks left unplayed can be released
+  c->mPaContext->releaseOutChunks(env, /*flush*/true);
+
   c->status = napi_get_undefined(env, &result);
   REJECT_STATUS;
 
@@ -359,6 +465,8 @@ napi_value AudioIO::Quit(napi_env env, napi_callback_info info) {
     NAPI_THROW_ERROR("AudioIO Quit expects \'WAIT\' or \'ABORT\' as the first argument");
   c->mStopFlag = (0 == stopFlagStr.compare("WAIT")) ? 
     PaContext::eStopFlag::WAIT : PaContext::eStopFlag::ABORT;
+  if (mPush)
+    mPush->quit();
 
   c->status = napi_create_string_utf8(env, "Quit", NAPI_AUTO_LENGTH, &resourceName);
   REJECT_RETURN;
@@ -371,6 +479,789 @@ napi_value AudioIO::Quit(napi_env env, napi_callback_info info) {
   return promise;
 }
 
+struct pushItem {
+  std::shared_ptr<Chunk> mChunk;
+  bool mFinished = false;
+};
+
+napi_status PushDelivery::start(napi_env env, napi_value callback) {
+  napi_status status;
+  napi_value resourceName;
+
+  status = napi_create_string_utf8(env, "Push", NAPI_AUTO_LENGTH, &resourceName);
+  PASS_STATUS;
+  // keep this object until the function is finalized, after the thread has finished with it
+  std::shared_ptr<PushDelivery> *self = new std::shared_ptr<PushDelivery>(shared_from_this());
+  status = napi_create_threadsafe_function(env, callback, nullptr, resourceName, 2, 1,
+    self, finalize, this, callJs, &mTsFn);
+  if (status != napi_ok) {
+    delete self;
+    return status;
+  }
+  mThread = std::thread(&PushDelivery::run, this);
+  return status;
+}
+
+void PushDelivery::setPaused(bool paused) {
+  std::lock_guard<std::mutex> lk(m);
+  mPaused = paused;
+  cv.notify_one();
+}
+
+void PushDelivery::quit() {
+  std::lock_guard<std::mutex> lk(m);
+  mQuitting = true;
+  cv.notify_one();
+}
+
+void PushDelivery::run() {
+  bool finished = false;
+  bool release = true;
+  while (!finished) {
+    {
+      std::unique_lock<std::mutex> lk(m);
+      cv.wait(lk, [this] { return !mPaused || mQuitting || !mActive; });
+    }
+    pushItem* item = new pushItem;
+    if (mActive)
+      item->mChunk = mPaContext->pullInChunk(0xffffffff, finished);
+    item->mFinished = finished;
+    // the queue holds two blocks at most, after which this thread waits for JS
+    if (!mActive || (napi_call_threadsafe_function(mTsFn, item, napi_tsfn_blocking) != napi_ok)) {
+      delete item; // the function is closing down with the environment
+      release = false;
+      break;
+    }
+  }
+  if (release)
+    napi_release_threadsafe_function(mTsFn, napi_tsfn_release);
+}
+
+void PushDelivery::callJs(napi_env env, napi_value jsCb, void* context, void* data) {
+  pushItem* item = (pushItem*) data;
+  if (env) {
+    PushDelivery* push = (PushDelivery*) context;
+    TraceScope trace(push->mPaContext->tracer(), "pushComplete", "JS");
+    napi_status status;
+    napi_value result, undef;
+    status = makeReadResult(env, push->mPaContext, item->mChunk, item->mFinished, /*checkStatus*/true, &result);
+    if (status == napi_ok)
+      status = napi_get_undefined(env, &undef);
+    if (status == napi_ok)
+      status = napi_call_function(env, undef, jsCb, 1, &result, nullptr);
+    FLOATING_STATUS;
+  }
+  delete item;
+}
+
+void PushDelivery::finalize(napi_env env, void* data, void* hint) {
+  std::shared_ptr<PushDelivery> *self = (std::shared_ptr<PushDelivery> *)data;
+  PushDelivery* push = self->get();
+  push->mActive = false;
+  push->setPaused(false);
+  if (push->mThread.joinable())
+    push->mThread.join();
+  delete self;
+}
+
+napi_value AudioIO::StartPush(napi_env env, napi_callback_info info) {
+  napi_status status;
+  napi_value result;
+  napi_valuetype t;
+
+  if (!mPaContext->hasInput())
+    NAPI_THROW_ERROR("AudioIO StartPush - cannot push from a output-only stream");
+  if (!mPaContext->pushMode())
+    NAPI_THROW_ERROR("AudioIO StartPush - the pushMode input option is not set");
+  if (mPush)
+    NAPI_THROW_ERROR("AudioIO StartPush - already started");
+
+  size_t argc = 1;
+  napi_value args[1];
+  status = napi_get_cb_info(env, info, &argc, args, nullptr, nullptr);
+  CHECK_STATUS;
+  if (argc != 1)
+    NAPI_THROW_ERROR("AudioIO StartPush expects 1 argument");
+  status = napi_typeof(env, args[0], &t);
+  CHECK_STATUS;
+  if (t != napi_function)
+    NAPI_THROW_ERROR("AudioIO StartPush expects a callback function as the first parameter");
+
+  mPush = std::make_shared<PushDelivery>(mPaContext);
+  status = mPush->start(env, args[0]);
+  CHECK_STATUS;
+
+  status = napi_get_undefined(env, &result);
+  CHECK_STATUS;
+  return result;
+}
+
+struct meterItem {
+  std::vector<float> mLevels;
+};
+
+napi_status MeterDelivery::start(napi_env env, napi_value callback) {
+  napi_status status;
+  napi_value resourceName;
+
+  status = napi_create_string_utf8(env, "Meter", NAPI_AUTO_LENGTH, &resourceName);
+  PASS_STATUS;
+  // keep this object until the function is finalized, after the thread has finished with it
+  std::shared_ptr<MeterDelivery> *self = new std::shared_ptr<MeterDelivery>(shared_from_this());
+  status = napi_create_threadsafe_function(env, callback, nullptr, resourceName, 2, 1,
+    self, finalize, this, callJs, &mTsFn);
+  if (status != napi_ok) {
+    delete self;
+    return status;
+  }
+  mThread = std::thread(&MeterDelivery::run, this);
+  return status;
+}
+
+void MeterDelivery::run() {
+  bool release = true;
+  while (mActive) {
+    meterItem* item = new meterItem;
+    if (!mPaContext->pullMeter(item->mLevels)) {
+      delete item;
+      break;
+    }
+    // readings wait here while two are queued for JS
+    if (!mActive || (napi_call_threadsafe_function(mTsFn, item, napi_tsfn_blocking) != napi_ok)) {
+      delete item; // the function is closing down with the environment
+      release = false;
+      break;
+    }
+  }
+  if (release)
+    napi_release_threadsafe_function(mTsFn, napi_tsfn_release);
+}
+
+void MeterDelivery::callJs(napi_env env, napi_value jsCb, void* context, void* data) {
+  meterItem* item = (meterItem*) data;
+  if (env) {
+    napi_status status;
+    napi_value arrayBuffer, levels, undef;
+    void* arrayData;
+    size_t numBytes = item->mLevels.size() * sizeof(float);
+    status = napi_create_arraybuffer(env, numBytes, &arrayData, &arrayBuffer);
+    if (status == napi_ok) {
+      memcpy(arrayData, item->mLevels.data(), numBytes);
+      status = napi_create_typedarray(env, napi_float32_array, item->mLevels.size(), arrayBuffer, 0, &levels);
+    }
+    if (status == napi_ok)
+      status = napi_get_undefined(env, &undef);
+    if (status == napi_ok)
+      status = napi_call_function(env, undef, jsCb, 1, &levels, nullptr);
+    FLOATING_STATUS;
+  }
+  delete item;
+}
+
+void MeterDelivery::finalize(napi_env env, void* data, void* hint) {
+  std::shared_ptr<MeterDelivery> *self = (std::shared_ptr<MeterDelivery> *)data;
+  MeterDelivery* meter = self->get();
+  meter->mActive = false;
+  if (meter->mThread.joinable())
+    meter->mThread.join();
+  delete self;
+}
+
+napi_value AudioIO::StartMeter(napi_env env, napi_callback_info info) {
+  napi_status status;
+  napi_value result;
+  napi_valuetype t;
+
+  if (!mPaContext->hasMeter())
+    NAPI_THROW_ERROR("AudioIO StartMeter - metering was not enabled with the meter option");
+  if (mMeter)
+    NAPI_THROW_ERROR("AudioIO StartMeter - already started");
+
+  size_t argc = 1;
+  napi_value args[1];
+  status = napi_get_cb_info(env, info, &argc, args, nullptr, nullptr);
+  CHECK_STATUS;
+  if (argc != 1)
+    NAPI_THROW_ERROR("AudioIO StartMeter expects 1 argument");
+  status = napi_typeof(env, args[0], &t);
+  CHECK_STATUS;
+  if (t != napi_function)
+    NAPI_THROW_ERROR("AudioIO StartMeter expects a callback function as the first parameter");
+
+  mMeter = std::make_shared<MeterDelivery>(mPaContext);
+  status = mMeter->start(env, args[0]);
+  CHECK_STATUS;
+
+  status = napi_get_undefined(env, &result);
+  CHECK_STATUS;
+  return result;
+}
+
+napi_value AudioIO::PausePush(napi_env env, napi_callback_info info) {
+  napi_status status;
+  napi_value result;
+  bool paused;
+
+  size_t argc = 1;
+  napi_value args[1];
+  status = napi_get_cb_info(env, info, &argc, args, nullptr, nullptr);
+  CHECK_STATUS;
+  if (argc != 1)
+    NAPI_THROW_ERROR("AudioIO PausePush expects 1 argument");
+  status = napi_get_value_bool(env, args[0], &paused);
+  if (status != napi_ok)
+    NAPI_THROW_ERROR("AudioIO PausePush expects a boolean as the first parameter");
+
+  if (mPush)
+    mPush->setPaused(paused);
+
+  status = napi_get_undefined(env, &result);
+  CHECK_STATUS;
+  return result;
+}
+
+napi_value AudioIO::GetStats(napi_env env, napi_callback_info info) {
+  napi_status status;
+  napi_value result;
+
+  status = mPaContext->getStats(env, &result);
+  CHECK_STATUS;
+  return result;
+}
+
+napi_value AudioIO::GetStreamTime(napi_env env, napi_callback_info info) {
+  napi_status status;
+  napi_value result;
+
+  status = napi_create_double(env, mPaContext->getStreamTime(), &result);
+  CHECK_STATUS;
+  return result;
+}
+
+napi_value AudioIO::GetClock(napi_env env, napi_callback_info info) {
+  napi_status status;
+  napi_value result;
+
+  status = mPaContext->getClock(env, &result);
+  CHECK_STATUS;
+  return result;
+}
+
+napi_value AudioIO::ConvertTime(napi_env env, napi_callback_info info) {
+  napi_status status;
+  napi_value result;
+  double time;
+  bool toSystem;
+
+  size_t argc = 2;
+  napi_value args[2];
+  status = napi_get_cb_info(env, info, &argc, args, nullptr, nullptr);
+  CHECK_STATUS;
+  if (argc != 2)
+    NAPI_THROW_ERROR("AudioIO ConvertTime expects 2 arguments");
+  status = napi_get_value_double(env, args[0], &time);
+  if (status != napi_ok)
+    NAPI_THROW_ERROR("AudioIO ConvertTime expects a time in seconds as the first parameter");
+  status = napi_get_value_bool(env, args[1], &toSystem);
+  if (status != napi_ok)
+    NAPI_THROW_ERROR("AudioIO ConvertTime expects a boolean as the second parameter");
+
+  status = napi_create_double(env, toSystem ? mPaContext->toSystemTime(time) : mPaContext->fromSystemTime(time), &result);
+  CHECK_STATUS;
+  return result;
+}
+
+void dumpTraceExecute(napi_env env, void* data) {
+  asyncCarrier* c = (asyncCarrier*) data;
+  if (!c->mPaContext->tracer()->dump(c->mPath, c->errorMsg))
+    c->status = NAUDIODON_ERROR_START;
+}
+
+void dumpTraceComplete(napi_env env, napi_status asyncStatus, void* data) {
+  asyncCarrier* c = (asyncCarrier*) data;
+  napi_value result;
+
+  if (asyncStatus != napi_ok) {
+    c->status = asyncStatus;
+    c->errorMsg = "Async trace dump failed to complete";
+  }
+  REJECT_STATUS;
+
+  c->status = napi_get_undefined(env, &result);
+  REJECT_STATUS;
+
+  napi_status status;
+  status = napi_resolve_deferred(env, c->_deferred, result);
+  FLOATING_STATUS;
+
+  tidyCarrier(env, c);
+}
+
+napi_value AudioIO::DumpTrace(napi_env env, napi_callback_info info) {
+  napi_value resourceName, promise;
+  size_t strLen;
+
+  if (!mPaContext->tracer())
+    NAPI_THROW_ERROR("AudioIO DumpTrace - tracing was not enabled with the trace option");
+
+  asyncCarrier* c = new asyncCarrier;
+  c->mPaContext = mPaContext;
+
+  c->status = napi_create_promise(env, &c->_deferred, &promise);
+  REJECT_RETURN;
+
+  size_t argc = 1;
+  napi_value args[1];
+  c->status = napi_get_cb_info(env, info, &argc, args, nullptr, nullptr);
+  REJECT_RETURN;
+
+  if (argc != 1)
+    NAPI_THROW_ERROR("AudioIO DumpTrace expects 1 argument");
+
+  c->status = napi_get_value_string_utf8(env, args[0], nullptr, 0, &strLen);
+  if (c->status != napi_ok)
+    NAPI_THROW_ERROR("AudioIO DumpTrace expects a file path as the first parameter");
+  c->mPath.resize(strLen + 1);
+  c->status = napi_get_value_string_utf8(env, args[0], &c->mPath[0], strLen + 1, &strLen);
+  REJECT_RETURN;
+  c->mPath.resize(strLen);
+
+  c->status = napi_create_string_utf8(env, "DumpTrace", NAPI_AUTO_LENGTH, &resourceName);
+  REJECT_RETURN;
+  c->status = napi_create_async_work(env, nullptr, resourceName, dumpTraceExecute, dumpTraceComplete,
+    c, &c->_request);
+  REJECT_RETURN;
+  c->status = napi_queue_async_work(env, c->_request);
+  REJECT_RETURN;
+
+  return promise;
+}
+
+napi_value AudioIO::AddSource(napi_env env, napi_callback_info info) {
+  napi_status status;
+  napi_value result;
+  double gain;
+
+  if (!mPaContext->hasOutput())
+    NAPI_THROW_ERROR("AudioIO AddSource - cannot mix into an input-only stream");
+
+  size_t argc = 1;
+  napi_value args[1];
+  status = napi_get_cb_info(env, info, &argc, args, nullptr, nullptr);
+  CHECK_STATUS;
+  if (argc != 1)
+    NAPI_THROW_ERROR("AudioIO AddSource expects 1 argument");
+  status = napi_get_value_double(env, args[0], &gain);
+  if (status != napi_ok)
+    NAPI_THROW_ERROR("AudioIO AddSource expects a gain as the first parameter");
+
+  std::shared_ptr<MixSource> source = mPaContext->addSource((float)gain);
+  if (!source)
+    NAPI_THROW_ERROR("AudioIO AddSource - the maximum number of mix sources are in use");
+
+  status = napi_create_uint32(env, source->id(), &result);
+  CHECK_STATUS;
+  return result;
+}
+
+// finds the source given by the first argument
+std::shared_ptr<MixSource> AudioIO::FindSource(napi_env env, size_t argc, napi_value *args) {
+  uint32_t id = 0;
+  if ((argc < 1) || (napi_ok != napi_get_value_uint32(env, args[0], &id)))
+    return std::shared_ptr<MixSource>();
+  return mPaContext->findSource(id);
+}
+
+void writeSourceExecute(napi_env env, void* data) {
+  asyncCarrier* c = (asyncCarrier*) data;
+  TraceScope trace(c->mPaContext->tracer(), "writeSourceExecute", "libuv worker");
+  c->mSource->chunks()->push(c->mChunk);
+}
+
+napi_value AudioIO::WriteSource(napi_env env, napi_callback_info info) {
+  napi_value resourceName, promise;
+  bool isBuffer;
+
+  asyncCarrier* c = new asyncCarrier;
+  c->mPaContext = mPaContext;
+
+  c->status = napi_create_promise(env, &c->_deferred, &promise);
+  REJECT_RETURN;
+
+  size_t argc = 2;
+  napi_value args[2];
+  c->status = napi_get_cb_info(env, info, &argc, args, nullptr, nullptr);
+  REJECT_RETURN;
+
+  if (argc != 2)
+    NAPI_THROW_ERROR("AudioIO WriteSource expects 2 arguments");
+
+  c->mSource = FindSource(env, argc, args);
+  if (!c->mSource)
+    NAPI_THROW_ERROR("AudioIO WriteSource - the mix source has ended or been removed");
+
+  c->status = napi_is_buffer(env, args[1], &isBuffer);
+  REJECT_RETURN;
+  if (!isBuffer)
+    NAPI_THROW_ERROR("AudioIO WriteSource expects a valid chunk buffer as the second parameter");
+  mPaContext->releaseOutChunks(env, /*flush*/false);
+  c->mChunk = std::make_shared<Chunk>(env, args[1], mPaContext->copyWrites());
+
+  c->status = napi_create_string_utf8(env, "WriteSource", NAPI_AUTO_LENGTH, &resourceName);
+  REJECT_RETURN;
+  c->status = napi_create_async_work(env, nullptr, resourceName, writeSourceExecute, writeComplete,
+    c, &c->_request);
+  REJECT_RETURN;
+  c->status = napi_queue_async_work(env, c->_request);
+  REJECT_RETURN;
+
+  return promise;
+}
+
+napi_value AudioIO::SetSourceGain(napi_env env, napi_callback_info info) {
+  napi_status status;
+  napi_value result;
+  double gain;
+
+  size_t argc = 2;
+  napi_value args[2];
+  status = napi_get_cb_info(env, info, &argc, args, nullptr, nullptr);
+  CHECK_STATUS;
+  if (argc != 2)
+    NAPI_THROW_ERROR("AudioIO SetSourceGain expects 2 arguments");
+  status = napi_get_value_double(env, args[1], &gain);
+  if (status != napi_ok)
+    NAPI_THROW_ERROR("AudioIO SetSourceGain expects a gain as the second parameter");
+
+  std::shared_ptr<MixSource> source = FindSource(env, argc, args);
+  if (source)
+    source->setGain((float)gain);
+
+  status = napi_get_undefined(env, &result);
+  CHECK_STATUS;
+  return result;
+}
+
+napi_value AudioIO::EndSource(napi_env env, napi_callback_info info) {
+  napi_status status;
+  napi_value result;
+  bool remove;
+
+  size_t argc = 2;
+  napi_value args[2];
+  status = napi_get_cb_info(env, info, &argc, args, nullptr, nullptr);
+  CHECK_STATUS;
+  if (argc != 2)
+    NAPI_THROW_ERROR("AudioIO EndSource expects 2 arguments");
+  status = napi_get_value_bool(env, args[1], &remove);
+  if (status != napi_ok)
+    NAPI_THROW_ERROR("AudioIO EndSource expects a boolean as the second parameter");
+
+  // an ended source plays out what was written first, a removed source fades out straight away
+  std::shared_ptr<MixSource> source = FindSource(env, argc, args);
+  if (source && remove)
+    source->remove();
+  else if (source)
+    source->end();
+  mPaContext->releaseOutChunks(env, /*flush*/false);
+
+  status = napi_get_undefined(env, &result);
+  CHECK_STATUS;
+  return result;
+}
+
+napi_value AudioIO::PlayFile(napi_env env, napi_callback_info info) {
+  napi_status status;
+  napi_value result;
+  double gain;
+
+  if (!mPaContext->hasOutput())
+    NAPI_THROW_ERROR("AudioIO PlayFile - cannot play into an input-only stream");
+
+  size_t argc = 2;
+  napi_value args[2];
+  status = napi_get_cb_info(env, info, &argc, args, nullptr, nullptr);
+  CHECK_STATUS;
+  if (argc != 2)
+    NAPI_THROW_ERROR("AudioIO PlayFile expects 2 arguments");
+
+  size_t strLen;
+  status = napi_get_value_string_utf8(env, args[0], nullptr, 0, &strLen);
+  if (status != napi_ok)
+    NAPI_THROW_ERROR("AudioIO PlayFile expects a file path as the first parameter");
+  std::string path;
+  path.resize(strLen + 1);
+  status = napi_get_value_string_utf8(env, args[0], &path[0], strLen + 1, nullptr);
+  CHECK_STATUS;
+  path.resize(strLen);
+  status = napi_get_value_double(env, args[1], &gain);
+  if (status != napi_ok)
+    NAPI_THROW_ERROR("AudioIO PlayFile expects a gain as the second parameter");
+
+  // sources that have finished playing are released first, closing their files
+  mPaContext->releaseOutChunks(env, /*flush*/false);
+  std::string errStr;
+  std::shared_ptr<MixSource> source = mPaContext->playFile(path, (float)gain, errStr);
+  if (!source) {
+    std::string errMsg = std::string("AudioIO PlayFile - " + errStr).substr(0, 255); // fits the throw buffer
+    NAPI_THROW_ERROR(errMsg.c_str());
+  }
+
+  status = napi_create_object(env, &result);
+  CHECK_STATUS;
+  status = naud_set_uint32(env, result, "id", source->id());
+  CHECK_STATUS;
+  status = naud_set_int64(env, result, "frames", source->file()->frames());
+  CHECK_STATUS;
+  return result;
+}
+
+napi_value AudioIO::AddReader(napi_env env, napi_callback_info info) {
+  napi_status status;
+  napi_value result;
+  uint32_t maxQueue;
+
+  if (!mPaContext->hasInput())
+    NAPI_THROW_ERROR("AudioIO AddReader - cannot read from an output-only stream");
+
+  size_t argc = 2;
+  napi_value args[2];
+  status = napi_get_cb_info(env, info, &argc, args, nullptr, nullptr);
+  CHECK_STATUS;
+  if (argc != 2)
+    NAPI_THROW_ERROR("AudioIO AddReader expects 2 arguments");
+
+  size_t strLen;
+  status = napi_get_value_string_utf8(env, args[0], nullptr, 0, &strLen);
+  if (status != napi_ok)
+    NAPI_THROW_ERROR("AudioIO AddReader expects an overflow policy as the first parameter");
+  std::string overflowPolicy;
+  overflowPolicy.resize(strLen + 1);
+  status = napi_get_value_string_utf8(env, args[0], &overflowPolicy[0], strLen + 1, nullptr);
+  CHECK_STATUS;
+  overflowPolicy.resize(strLen);
+  bool dropOldest = 0 == overflowPolicy.compare("dropOldest");
+  if (!dropOldest && overflowPolicy.compare("dropNewest"))
+    NAPI_THROW_ERROR("Invalid reader overflowPolicy - expected 'dropNewest' or 'dropOldest'");
+
+  status = napi_get_value_uint32(env, args[1], &maxQueue);
+  if (status != napi_ok)
+    NAPI_THROW_ERROR("AudioIO AddReader expects a maximum queue length as the second parameter");
+
+  std::shared_ptr<CaptureReader> reader = mPaContext->addReader(maxQueue, dropOldest);
+  if (!reader)
+    NAPI_THROW_ERROR("AudioIO AddReader - the maximum number of readers are in use");
+
+  status = napi_create_uint32(env, reader->id(), &result);
+  CHECK_STATUS;
+  return result;
+}
+
+void readReaderExecute(napi_env env, void* data) {
+  asyncCarrier* c = (asyncCarrier*) data;
+  TraceScope trace(c->mPaContext->tracer(), "readReaderExecute", "libuv worker");
+  c->mChunk = c->mPaContext->pullReaderChunk(c->mReader, c->mNumBytes, c->mFinished);
+}
+
+napi_value AudioIO::ReadReader(napi_env env, napi_callback_info info) {
+  napi_value resourceName, promise;
+  uint32_t id;
+
+  asyncCarrier* c = new asyncCarrier;
+  c->mPaContext = mPaContext;
+
+  c->status = napi_create_promise(env, &c->_deferred, &promise);
+  REJECT_RETURN;
+
+  size_t argc = 2;
+  napi_value args[2];
+  c->status = napi_get_cb_info(env, info, &argc, args, nullptr, nullptr);
+  REJECT_RETURN;
+
+  if (argc != 2)
+    NAPI_THROW_ERROR("AudioIO ReadReader expects 2 arguments");
+
+  c->status = napi_get_value_uint32(env, args[0], &id);
+  if (c->status == napi_ok)
+    c->mReader = mPaContext->findReader(id);
+  if (!c->mReader)
+    NAPI_THROW_ERROR("AudioIO ReadReader - the reader has been closed");
+
+  c->status = napi_get_value_uint32(env, args[1], &c->mNumBytes);
+  if ((c->status != napi_number_expected) && (c->status != napi_ok))
+    NAPI_THROW_ERROR("AudioIO ReadReader expects a valid number of bytes as the second parameter");
+
+  c->status = napi_create_string_utf8(env, "ReadReader", NAPI_AUTO_LENGTH, &resourceName);
+  REJECT_RETURN;
+  c->status = napi_create_async_work(env, nullptr, resourceName, readReaderExecute, readComplete,
+    c, &c->_request);
+  REJECT_RETURN;
+  c->status = napi_queue_async_work(env, c->_request);
+  REJECT_RETURN;
+
+  return promise;
+}
+
+napi_value AudioIO::CloseReader(napi_env env, napi_callback_info info) {
+  napi_status status;
+  napi_value result;
+  uint32_t id;
+
+  size_t argc = 1;
+  napi_value args[1];
+  status = napi_get_cb_info(env, info, &argc, args, nullptr, nullptr);
+  CHECK_STATUS;
+  if (argc != 1)
+    NAPI_THROW_ERROR("AudioIO CloseReader expects 1 argument");
+  status = napi_get_value_uint32(env, args[0], &id);
+  if (status != napi_ok)
+    NAPI_THROW_ERROR("AudioIO CloseReader expects a reader id as the first parameter");
+
+  mPaContext->closeReader(id);
+
+  status = napi_get_undefined(env, &result);
+  CHECK_STATUS;
+  return result;
+}
+
+napi_value AudioIO::SetGain(napi_env env, napi_callback_info info) {
+  napi_status status;
+  napi_value result;
+  bool isInput;
+  double gain;
+  uint32_t rampMs;
+
+  size_t argc = 3;
+  napi_value args[3];
+  status = napi_get_cb_info(env, info, &argc, args, nullptr, nullptr);
+  CHECK_STATUS;
+  if (argc != 3)
+    NAPI_THROW_ERROR("AudioIO SetGain expects 3 arguments");
+  status = napi_get_value_bool(env, args[0], &isInput);
+  if (status != napi_ok)
+    NAPI_THROW_ERROR("AudioIO SetGain expects a boolean as the first parameter");
+  if (isInput ? !mPaContext->hasInput() : !mPaContext->hasOutput())
+    NAPI_THROW_ERROR(isInput ? "AudioIO SetGain - the stream has no input" : "AudioIO SetGain - the stream has no output");
+  status = napi_get_value_double(env, args[1], &gain);
+  if ((status != napi_ok) || (gain < 0.0))
+    NAPI_THROW_ERROR("AudioIO SetGain expects a gain of 0 or more as the second parameter");
+  status = napi_get_value_uint32(env, args[2], &rampMs);
+  if (status != napi_ok)
+    NAPI_THROW_ERROR("AudioIO SetGain expects a ramp time in milliseconds as the third parameter");
+
+  mPaContext->setGain(isInput, (float)gain, rampMs);
+
+  status = napi_get_undefined(env, &result);
+  CHECK_STATUS;
+  return result;
+}
+
+napi_value AudioIO::RecordTo(napi_env env, napi_callback_info info) {
+  napi_status status;
+  napi_value result;
+  int64_t preallocBytes;
+  uint32_t headerMs;
+
+  if (!mPaContext->hasInput())
+    NAPI_THROW_ERROR("AudioIO RecordTo - cannot record from an output-only stream");
+  if (mRecorder)
+    NAPI_THROW_ERROR("AudioIO RecordTo - the stream is already recording");
+
+  size_t argc = 3;
+  napi_value args[3];
+  status = napi_get_cb_info(env, info, &argc, args, nullptr, nullptr);
+  CHECK_STATUS;
+  if (argc != 3)
+    NAPI_THROW_ERROR("AudioIO RecordTo expects 3 arguments");
+
+  size_t strLen;
+  status = napi_get_value_string_utf8(env, args[0], nullptr, 0, &strLen);
+  if (status != napi_ok)
+    NAPI_THROW_ERROR("AudioIO RecordTo expects a file path as the first parameter");
+  std::string path;
+  path.resize(strLen + 1);
+  status = napi_get_value_string_utf8(env, args[0], &path[0], strLen + 1, nullptr);
+  CHECK_STATUS;
+  path.resize(strLen);
+
+  status = napi_get_value_int64(env, args[1], &preallocBytes);
+  if ((status != napi_ok) || (preallocBytes < 0))
+    NAPI_THROW_ERROR("AudioIO RecordTo expects a preallocation size in bytes as the second parameter");
+  status = napi_get_value_uint32(env, args[2], &headerMs);
+  if (status != napi_ok)
+    NAPI_THROW_ERROR("AudioIO RecordTo expects a header update interval in milliseconds as the third parameter");
+
+  std::string errStr;
+  mRecorder = mPaContext->recordTo(path, (uint64_t)preallocBytes, headerMs, errStr);
+  if (!mRecorder) {
+    std::string errMsg = std::string("AudioIO RecordTo - " + errStr).substr(0, 255); // fits the throw buffer
+    NAPI_THROW_ERROR(errMsg.c_str());
+  }
+
+  status = napi_get_undefined(env, &result);
+  CHECK_STATUS;
+  return result;
+}
+
+void stopRecordExecute(napi_env env, void* data) {
+  asyncCarrier* c = (asyncCarrier*) data;
+  if (!c->mWriter->finish(c->errorMsg))
+    c->status = NAUDIODON_ERROR_START;
+}
+
+void stopRecordComplete(napi_env env, napi_status asyncStatus, void* data) {
+  asyncCarrier* c = (asyncCarrier*) data;
+  napi_value result;
+
+  if (asyncStatus != napi_ok) {
+    c->status = asyncStatus;
+    c->errorMsg = "Async recording stop failed to complete";
+  }
+  REJECT_STATUS;
+
+  c->status = napi_create_object(env, &result);
+  REJECT_STATUS;
+  c->status = naud_set_int64(env, result, "frames", c->mWriter->frames());
+  REJECT_STATUS;
+  c->status = naud_set_int64(env, result, "silentFrames", c->mWriter->silentFrames());
+  REJECT_STATUS;
+  c->status = naud_set_int64(env, result, "droppedFrames", c->mWriter->droppedFrames());
+  REJECT_STATUS;
+  c->status = naud_set_bool(env, result, "rf64", c->mWriter->rf64());
+  REJECT_STATUS;
+
+  napi_status status;
+  status = napi_resolve_deferred(env, c->_deferred, result);
+  FLOATING_STATUS;
+
+  tidyCarrier(env, c);
+}
+
+napi_value AudioIO::StopRecord(napi_env env, napi_callback_info info) {
+  napi_value resourceName, promise;
+
+  if (!mRecorder)
+    NAPI_THROW_ERROR("AudioIO StopRecord - the stream is not recording");
+
+  asyncCarrier* c = new asyncCarrier;
+  c->mPaContext = mPaContext;
+  c->mWriter = mRecorder;
+  mRecorder.reset();
+
+  c->status = napi_create_promise(env, &c->_deferred, &promise);
+  REJECT_RETURN;
+
+  c->status = napi_create_string_utf8(env, "StopRecord", NAPI_AUTO_LENGTH, &resourceName);
+  REJECT_RETURN;
+  c->status = napi_create_async_work(env, nullptr, resourceName, stopRecordExecute, stopRecordComplete,
+    c, &c->_request);
+  REJECT_RETURN;
+  c->status = napi_queue_async_work(env, c->_request);
+  REJECT_RETURN;
+
+  return promise;
+}
+
 AudioIO* AudioIO::GetInstance(napi_env env, napi_callback_info info) {
   napi_status status;
   napi_value thisVal;
@@ -403,4 +1294,80 @@ napi_value AudioIO::sQuit(napi_env env, napi_callback_info info) {
   return GetInstance(env, info)->Quit(env, info);
 }
 
-} // namespace streampunk
\ No newline at end of file
+napi_value AudioIO::sStartPush(napi_env env, napi_callback_info info) {
+  return GetInstance(env, info)->StartPush(env, info);
+}
+
+napi_value AudioIO::sPausePush(napi_env env, napi_callback_info info) {
+  return GetInstance(env, info)->PausePush(env, info);
+}
+
+napi_value AudioIO::sGetStats(napi_env env, napi_callback_info info) {
+  return GetInstance(env, info)->GetStats(env, info);
+}
+
+napi_value AudioIO::sGetStreamTime(napi_env env, napi_callback_info info) {
+  return GetInstance(env, info)->GetStreamTime(env, info);
+}
+
+napi_value AudioIO::sGetClock(napi_env env, napi_callback_info info) {
+  return GetInstance(env, info)->GetClock(env, info);
+}
+
+napi_value AudioIO::sConvertTime(napi_env env, napi_callback_info info) {
+  return GetInstance(env, info)->ConvertTime(env, info);
+}
+
+napi_value AudioIO::sDumpTrace(napi_env env, napi_callback_info info) {
+  return GetInstance(env, info)->DumpTrace(env, info);
+}
+
+napi_value AudioIO::sAddSource(napi_env env, napi_callback_info info) {
+  return GetInstance(env, info)->AddSource(env, info);
+}
+
+napi_value AudioIO::sWriteSource(napi_env env, napi_callback_info info) {
+  return GetInstance(env, info)->WriteSource(env, info);
+}
+
+napi_value AudioIO::sSetSourceGain(napi_env env, napi_callback_info info) {
+  return GetInstance(env, info)->SetSourceGain(env, info);
+}
+
+napi_value AudioIO::sEndSource(napi_env env, napi_callback_info info) {
+  return GetInstance(env, info)->EndSource(env, info);
+}
+
+napi_value AudioIO::sPlayFile(napi_env env, napi_callback_info info) {
+  return GetInstance(env, info)->PlayFile(env, info);
+}
+
+napi_value AudioIO::sAddReader(napi_env env, napi_callback_info info) {
+  return GetInstance(env, info)->AddReader(env, info);
+}
+
+napi_value AudioIO::sReadReader(napi_env env, napi_callback_info info) {
+  return GetInstance(env, info)->ReadReader(env, info);
+}
+
+napi_value AudioIO::sCloseReader(napi_env env, napi_callback_info info) {
+  return GetInstance(env, info)->CloseReader(env, info);
+}
+
+napi_value AudioIO::sStartMeter(napi_env env, napi_callback_info info) {
+  return GetInstance(env, info)->StartMeter(env, info);
+}
+
+napi_value AudioIO::sSetGain(napi_env env, napi_callback_info info) {
+  return GetInstance(env, info)->SetGain(env, info);
+}
+
+napi_value AudioIO::sRecordTo(napi_env env, napi_callback_info info) {
+  return GetInstance(env, info)->RecordTo(env, info);
+}
+
+napi_value AudioIO::sStopRecord(napi_env env, napi_callback_info info) {
+  return GetInstance(env, info)->StopRecord(env, info);
+}
+
+} // namespace streampunk
@@ -20,6 +20,13 @@
 #include "Memory.h"
 #include "Chunks.h"
 #include "PaContext.h"
+#include "Mixer.h"
+#include "Fanout.h"
+#include "WavWriter.h"
+#include "WavFile.h"
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 
 namespace streampunk {
 
@@ -29,9 +36,62 @@ struct asyncCarrier : carrier {
   ~asyncCarrier() {}
   std::shared_ptr<PaContext> mPaContext = 0;
   std::shared_ptr<Chunk> mChunk = 0;
+  std::shared_ptr<MixSource> mSource = 0;
+  std::shared_ptr<CaptureReader> mReader = 0;
+  std::shared_ptr<WavWriter> mWriter = 0;
   uint32_t mNumBytes = 0;
   bool mFinished = false;
   PaContext::eStopFlag mStopFlag = PaContext::eStopFlag(0);
+  std::string mPath;
+};
+
+// Forwards captured blocks to a JS callback from a thread of its own, so that no
+// libuv threadpool thread is held waiting for audio. While paused the thread stops
+// taking blocks and the capture queue applies its overflow policy.
+class PushDelivery : public std::enable_shared_from_this<PushDelivery> {
+public:
+  PushDelivery(std::shared_ptr<PaContext> paContext)
+    : mPaContext(paContext), mTsFn(nullptr), mActive(true), mPaused(false), mQuitting(false) {}
+  ~PushDelivery() {}
+
+  napi_status start(napi_env env, napi_value callback);
+  void setPaused(bool paused);
+  // deliver the rest of the capture, even if paused, so that the thread can finish
+  void quit();
+
+private:
+  std::shared_ptr<PaContext> mPaContext;
+  napi_threadsafe_function mTsFn;
+  std::thread mThread;
+  std::atomic<bool> mActive;
+  bool mPaused;
+  bool mQuitting;
+  std::mutex m;
+  std::condition_variable cv;
+
+  void run();
+  static void callJs(napi_env env, napi_value jsCb, void* context, void* data);
+  static void finalize(napi_env env, void* data, void* hint);
+};
+
+// Calls a JS callback with each meter reading from a thread of its own, until the stream finishes
+class MeterDelivery : public std::enable_shared_from_this<MeterDelivery> {
+public:
+  MeterDelivery(std::shared_ptr<PaContext> paContext)
+    : mPaContext(paContext), mTsFn(nullptr), mActive(true) {}
+  ~MeterDelivery() {}
+
+  napi_status start(napi_env env, napi_value callback);
+
+private:
+  std::shared_ptr<PaContext> mPaContext;
+  napi_threadsafe_function mTsFn;
+  std::thread mThread;
+  std::atomic<bool> mActive;
+
+  void run();
+  static void callJs(napi_env env, napi_value jsCb, void* context, void* data);
+  static void finalize(napi_env env, void* data, void* hint);
 };
 
 class AudioIO {
@@ -47,18 +107,60 @@ public:
 
 private:
   std::shared_ptr<PaContext> mPaContext;
+  std::shared_ptr<PushDelivery> mPush;
+  std::shared_ptr<MeterDelivery> mMeter;
+  std::shared_ptr<WavWriter> mRecorder;
   napi_ref mInstanceRef;
 
   napi_value Start(napi_env env, napi_callback_info info);
   napi_value Read(napi_env env, napi_callback_info info);
   napi_value Write(napi_env env, napi_callback_info info);
   napi_value Quit(napi_env env, napi_callback_info info);
+  napi_value StartPush(napi_env env, napi_callback_info info);
+  napi_value PausePush(napi_env env, napi_callback_info info);
+  napi_value GetStats(napi_env env, napi_callback_info info);
+  napi_value GetStreamTime(napi_env env, napi_callback_info info);
+  napi_value GetClock(napi_env env, napi_callback_info info);
+  napi_value ConvertTime(napi_env env, napi_callback_info info);
+  napi_value DumpTrace(napi_env env, napi_callback_info info);
+  napi_value AddSource(napi_env env, napi_callback_info info);
+  napi_value WriteSource(napi_env env, napi_callback_info info);
+  napi_value SetSourceGain(napi_env env, napi_callback_info info);
+  napi_value EndSource(napi_env env, napi_callback_info info);
+  napi_value PlayFile(napi_env env, napi_callback_info info);
+  std::shared_ptr<MixSource> FindSource(napi_env env, size_t argc, napi_value *args);
+  napi_value AddReader(napi_env env, napi_callback_info info);
+  napi_value ReadReader(napi_env env, napi_callback_info info);
+  napi_value CloseReader(napi_env env, napi_callback_info info);
+  napi_value StartMeter(napi_env env, napi_callback_info info);
+  napi_value SetGain(napi_env env, napi_callback_info info);
+  napi_value RecordTo(napi_env env, napi_callback_info info);
+  napi_value StopRecord(napi_env env, napi_callback_info info);
 
   static AudioIO* GetInstance(napi_env env, napi_callback_info info);
   static napi_value sStart(napi_env env, napi_callback_info info);
   static napi_value sRead(napi_env env, napi_callback_info info);
   static napi_value sWrite(napi_env env, napi_callback_info info);
   static napi_value sQuit(napi_env env, napi_callback_info info);
+  static napi_value sStartPush(napi_env env, napi_callback_info info);
+  static napi_value sPausePush(napi_env env, napi_callback_info info);
+  static napi_value sGetStats(napi_env env, napi_callback_info info);
+  static napi_value sGetStreamTime(napi_env env, napi_callback_info info);
+  static napi_value sGetClock(napi_env env, napi_callback_info info);
+  static napi_value sConvertTime(napi_env env, napi_callback_info info);
+  static napi_value sDumpTrace(napi_env env, napi_callback_info info);
+  static napi_value sAddSource(napi_env env, napi_callback_info info);
+  static napi_value sWriteSource(napi_env env, napi_callback_info info);
+  static napi_value sSetSourceGain(napi_env env, napi_callback_info info);
+  static napi_value sEndSource(napi_env env, napi_callback_info info);
+  static napi_value sPlayFile(napi_env env, napi_callback_info info);
+  static napi_value sAddReader(napi_env env, napi_callback_info info);
+  static napi_value sReadReader(napi_env env, napi_callback_info info);
+  static napi_value sCloseReader(napi_env env, napi_callback_info info);
+  static napi_value sStartMeter(napi_env env, napi_callback_info info);
+  static napi_value sSetGain(napi_env env, napi_callback_info info);
+  static napi_value sRecordTo(napi_env env, napi_callback_info info);
+  static napi_value sStopRecord(napi_env env, napi_callback_info info);
 };
 
 } // namespace streampunk
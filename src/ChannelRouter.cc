@@ -0,0 +1,98 @@
+/* Copyright 2019 Streampunk Media Ltd.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#include "ChannelRouter.h"
+#include "SampleFormat.h"
+#include <cstring>
+#include <algorithm>
+
+namespace streampunk {
+
+ChannelRouter::ChannelRouter(uint32_t srcChannels, uint32_t dstChannels, const std::vector<float> &gains,
+                             uint32_t format, uint32_t blockFrames)
+  : mSrcChannels(srcChannels), mDstChannels(dstChannels), mFormat(format),
+    mBlockFrames(blockFrames ? blockFrames : 1), mCopy(true), mPick(dstChannels, -1), mTaps(dstChannels) {
+  for (uint32_t d = 0; d < mDstChannels; ++d) {
+    for (uint32_t s = 0; s < mSrcChannels; ++s) {
+      float gain = gains[d * mSrcChannels + s];
+      if (0.0f != gain)
+        mTaps[d].push_back({ s, gain });
+    }
+    if (1 == mTaps[d].size() && (1.0f == mTaps[d][0].gain))
+      mPick[d] = (int32_t)mTaps[d][0].src;
+    else if (mTaps[d].size())
+      mCopy = false;
+  }
+
+  if (!mCopy) {
+    mSrcFloat.resize(mBlockFrames * mSrcChannels);
+    mDstFloat.resize(mBlockFrames * mDstChannels);
+  }
+}
+
+std::vector<float> ChannelRouter::captureGains(const ChannelMap &map, uint32_t deviceChannels) {
+  std::vector<float> gains(map.size() * deviceChannels, 0.0f);
+  for (uint32_t s = 0; s < map.size(); ++s)
+    for (uint32_t d : map[s])
+      gains[s * deviceChannels + d] += 1.0f / map[s].size();
+  return gains;
+}
+
+std::vector<float> ChannelRouter::playbackGains(const ChannelMap &map, uint32_t deviceChannels) {
+  uint32_t streamChannels = (uint32_t)map.size();
+  std::vector<float> gains(deviceChannels * streamChannels, 0.0f);
+  for (uint32_t s = 0; s < streamChannels; ++s)
+    for (uint32_t d : map[s])
+      gains[d * streamChannels + s] = 1.0f;
+  return gains;
+}
+
+void ChannelRouter::route(const uint8_t *src, uint8_t *dst, uint32_t numFrames) {
+  uint32_t bytes = sampleBytes(mFormat);
+  if (mCopy) {
+    for (uint32_t f = 0; f < numFrames; ++f) {
+      for (uint32_t d = 0; d < mDstChannels; ++d) {
+        if (mPick[d] >= 0)
+          memcpy(dst, src + mPick[d] * bytes, bytes);
+        else
+          memset(dst, 0, bytes);
+        dst += bytes;
+      }
+      src += mSrcChannels * bytes;
+    }
+    return;
+  }
+
+  for (uint32_t done = 0; done < numFrames; ) {
+    uint32_t block = std::min<uint32_t>(numFrames - done, mBlockFrames);
+    convertSamples(src, mFormat, (uint8_t *)mSrcFloat.data(), 1, block * mSrcChannels);
+    for (uint32_t f = 0; f < block; ++f) {
+      const float *s = mSrcFloat.data() + f * mSrcChannels;
+      float *d = mDstFloat.data() + f * mDstChannels;
+      for (uint32_t c = 0; c < mDstChannels; ++c) {
+        float sum = 0.0f;
+        for (const Tap &tap : mTaps[c])
+          sum += s[tap.src] * tap.gain;
+        d[c] = sum;
+      }
+    }
+    convertSamples((const uint8_t *)mDstFloat.data(), 1, dst, mFormat, block * mDstChannels);
+    src += block * mSrcChannels * bytes;
+    dst += block * mDstChannels * bytes;
+    done += block;
+  }
+}
+
+} // namespace streampunk
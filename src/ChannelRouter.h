@@ -0,0 +1,64 @@
+/* Copyright 2019 Streampunk Media Ltd.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#ifndef CHANNELROUTER_H
+#define CHANNELROUTER_H
+
+#include <cstdint>
+#include <vector>
+
+namespace streampunk {
+
+// For each stream channel, the device channels it is taken from or played to
+typedef std::vector<std::vector<uint32_t>> ChannelMap;
+
+// Routes interleaved frames from one set of channels to another in a single
+// sample format. Each destination channel is a weighted sum of source
+// channels - when every destination takes at most one source at unity gain
+// the samples are copied as they are, otherwise they are mixed as float and
+// converted back with saturation. Nothing allocates after construction.
+class ChannelRouter {
+public:
+  // gains holds dstChannels rows of srcChannels gains
+  ChannelRouter(uint32_t srcChannels, uint32_t dstChannels, const std::vector<float> &gains,
+                uint32_t format, uint32_t blockFrames);
+  ~ChannelRouter() {}
+
+  // capture picks each stream channel from a device channel, or averages several
+  static std::vector<float> captureGains(const ChannelMap &map, uint32_t deviceChannels);
+  // playback sends each stream channel to any number of device channels, summing where they meet
+  static std::vector<float> playbackGains(const ChannelMap &map, uint32_t deviceChannels);
+
+  void route(const uint8_t *src, uint8_t *dst, uint32_t numFrames);
+
+private:
+  struct Tap {
+    uint32_t src;
+    float gain;
+  };
+  const uint32_t mSrcChannels;
+  const uint32_t mDstChannels;
+  const uint32_t mFormat;
+  const uint32_t mBlockFrames;
+  bool mCopy;
+  std::vector<int32_t> mPick; // source of each destination channel when copying, -1 for silence
+  std::vector<std::vector<Tap>> mTaps;
+  std::vector<float> mSrcFloat;
+  std::vector<float> mDstFloat;
+};
+
+} // namespace streampunk
+
+#endif
@@ -16,61 +16,135 @@
 #ifndef CHUNKQUEUE_H
 #define CHUNKQUEUE_H
 
-#include <queue>
+#include <atomic>
+#include <vector>
 #include <mutex>
+#include <chrono>
 #include <condition_variable>
 
 namespace streampunk {
 
+// Single producer, single consumer ring. The try* methods never lock or block
+// and are safe to call from the PortAudio callback. The blocking enqueue and
+// dequeue are for the non-realtime side only - they park on a condition
+// variable with a short timeout, so a wakeup missed because the realtime side
+// signals without taking the mutex costs at most one timeout period.
+// The producer may also discard the oldest entry to make room - the consumer
+// claims each entry with a compare-and-swap on the head so that the two sides
+// never both take the same entry.
 template <class T>
 class ChunkQueue {
 public:
-  ChunkQueue(uint32_t maxQueue) : mActive(true), mMaxQueue(maxQueue), qu(), m(), cv() {}
+  ChunkQueue(uint32_t maxQueue)
+    : mActive(true), mMaxQueue(maxQueue ? maxQueue : 1), mMask(slotMask(mMaxQueue)), mSlots(mMask + 1),
+      mHead(0), mTail(0), mReading(idleOffset), mWaiting(false), m(), cv() {}
   ~ChunkQueue() {}
-  
-  void enqueue(T t) {
-    std::unique_lock<std::mutex> lk(m);
-    while(mActive && (qu.size() >= mMaxQueue)) {
-      cv.wait(lk);
+
+  bool tryEnqueue(T &&t) {
+    uint32_t tail = mTail.load(std::memory_order_relaxed);
+    if (tail - mHead.load() >= mMaxQueue)
+      return false;
+    if (isBeingRead(tail))
+      return false;
+    mSlots[tail & mMask] = std::move(t);
+    mTail.store(tail + 1, std::memory_order_release);
+    signal();
+    return true;
+  }
+
+  // enqueue, discarding the oldest entry into dropped if the queue is full
+  bool tryEnqueueOverwrite(T &&t, T &dropped) {
+    uint32_t tail = mTail.load(std::memory_order_relaxed);
+    uint32_t head = tail - mMaxQueue;
+    if ((mHead.load() != head) || isBeingRead(tail) || !mHead.compare_exchange_strong(head, head + 1))
+      return tryEnqueue(std::move(t)); // not full, or the consumer has just taken the oldest
+    dropped = std::move(mSlots[head & mMask]);
+    mSlots[tail & mMask] = std::move(t);
+    mTail.store(tail + 1, std::memory_order_release);
+    signal();
+    return true;
+  }
+
+  bool tryDequeue(T &t) {
+    uint32_t head = mHead.load();
+    do {
+      if (mTail.load(std::memory_order_acquire) == head)
+        return false;
+      mReading.store(head);
+    } while (!mHead.compare_exchange_weak(head, head + 1));
+    t = std::move(mSlots[head & mMask]);
+    mReading.store(head + idleOffset);
+    signal();
+    return true;
+  }
+
+  bool enqueue(T t) {
+    while (!tryEnqueue(std::move(t))) {
+      if (!mActive)
+        return false;
+      wait();
     }
-    qu.push(t);
-    cv.notify_one();
+    return true;
   }
-  
+
   T dequeue() {
-    std::unique_lock<std::mutex> lk(m);
-    while(mActive && qu.empty()) {
-      cv.wait(lk);
-    }
-    T val = 0;
-    if (!qu.empty()) {
-      val = qu.front();
-      qu.pop();
-      cv.notify_one();
-    }
+    T val = T();
+    while (!tryDequeue(val) && mActive)
+      wait();
     return val;
   }
 
   size_t size() const {
-    std::lock_guard<std::mutex> lk(m);
-    return qu.size();
+    return mTail.load(std::memory_order_acquire) - mHead.load(std::memory_order_acquire);
   }
 
+  bool isActive() const { return mActive; }
+
   void quit() {
     std::lock_guard<std::mutex> lk(m);
     mActive = false;
-    if ((0 == qu.size()) || (qu.size() >= mMaxQueue)) {
-      // ensure release of any blocked thread
-      cv.notify_all();
-    }
+    // ensure release of any blocked thread
+    cv.notify_all();
   }
 
 private:
-  bool mActive;
-  uint32_t mMaxQueue;
-  std::queue<T> qu;
-  mutable std::mutex m;
+  // marks the consumer as idle - half the index range away from any slot the producer can write
+  static const uint32_t idleOffset = 0x80000000;
+  std::atomic<bool> mActive;
+  const uint32_t mMaxQueue;
+  const uint32_t mMask;
+  std::vector<T> mSlots;
+  std::atomic<uint32_t> mHead;
+  std::atomic<uint32_t> mTail;
+  std::atomic<uint32_t> mReading;
+  std::atomic<bool> mWaiting;
+  std::mutex m;
   std::condition_variable cv;
+
+  // the slot count is a power of two so that the free-running indices wrap cleanly
+  static uint32_t slotMask(uint32_t maxQueue) {
+    uint32_t numSlots = 1;
+    while (numSlots < maxQueue)
+      numSlots <<= 1;
+    return numSlots - 1;
+  }
+
+  // the consumer may still be moving the previous occupant out of the slot for this index
+  bool isBeingRead(uint32_t index) const {
+    return mReading.load() == index - (mMask + 1);
+  }
+
+  void wait() {
+    std::unique_lock<std::mutex> lk(m);
+    mWaiting = true;
+    cv.wait_for(lk, std::chrono::milliseconds(2));
+    mWaiting = false;
+  }
+
+  void signal() {
+    if (mWaiting.load(std::memory_order_relaxed))
+      cv.notify_one();
+  }
 };
 
 } // namespace streampunk
@@ -20,12 +20,19 @@
 #include "naudiodonUtil.h"
 #include "Memory.h"
 #include "ChunkQueue.h"
+#include <atomic>
+#include <vector>
 
 namespace streampunk {
 
+class ChunkPool;
+
 class Chunk {
 public:
-  Chunk (napi_env env, napi_value chunk): mTs(0.0) {
+  // Wrap a JS buffer, either copying it or holding a reference to it so that the
+  // audio thread can read it directly. A reference must be released on the JS thread.
+  Chunk (napi_env env, napi_value chunk, bool copy = true)
+    : mTs(0.0), mSeq(0), mFrame(0), mDiscontinuity(false), mScheduled(false), mGateEdge(0), mGateTs(0.0), mRef(nullptr), mUsers(1), mLent(false) {
     napi_status status;
 
     uint8_t* data;
@@ -33,81 +40,379 @@ public:
     status = napi_get_buffer_info(env, chunk, (void**) &data, &dataLen);
     FLOATING_STATUS;
 
-    mChunk = Memory::makeNew(data, dataLen);
+    if (copy)
+      mChunk = Memory(data, dataLen);
+    else {
+      status = napi_create_reference(env, chunk, 1, &mRef);
+      FLOATING_STATUS;
+      mChunk = Memory(data, dataLen, /*owned*/false);
+    }
   }
-  Chunk(std::shared_ptr<Memory> memory, double ts)
-    : mChunk(memory), mTs(ts)
+  // An empty chunk, or one that owns numBytes of memory
+  Chunk(uint32_t numBytes, double ts)
+    : mChunk(numBytes), mTs(ts), mSeq(0), mFrame(0), mDiscontinuity(false), mScheduled(false), mGateEdge(0), mGateTs(0.0), mRef(nullptr), mUsers(1), mLent(false)
+  {}
+  Chunk()
+    : mChunk(), mTs(0.0), mSeq(0), mFrame(0), mDiscontinuity(false), mScheduled(false), mGateEdge(0), mGateTs(0.0), mRef(nullptr), mUsers(1), mLent(false)
   {}
-  ~Chunk() {}
+  // A view of part of another chunk that shares its memory, keeping it in use until
+  // the view is destroyed. Views must not be destroyed on the realtime thread.
+  Chunk(std::shared_ptr<Chunk> parent, uint32_t offset, uint32_t numBytes, double ts, uint64_t frame)
+    : mChunk(parent->buf() + offset, numBytes, /*owned*/false), mTs(ts), mSeq(parent->seq()), mFrame(frame),
+      mDiscontinuity(false), mScheduled(false), mGateEdge(0), mGateTs(0.0), mRef(nullptr), mUsers(1), mParent(parent), mLent(false) {
+    mParent->addUser();
+  }
+  ~Chunk();
 
-  uint32_t numBytes() const { return mChunk ? mChunk->numBytes() : 0; }
-  uint8_t *buf() const { return mChunk ? mChunk->buf() : nullptr; }
+  uint32_t numBytes() const { return mChunk.numBytes(); }
+  uint32_t capacity() const { return mChunk.capacity(); }
+  uint8_t *buf() const { return mChunk.buf(); }
   double ts() const { return mTs; }
 
+  // capture sequence number, counting from 1 - a gap shows that blocks were dropped
+  uint64_t seq() const { return mSeq; }
+  void setSeq(uint64_t seq) { mSeq = seq; }
+
+  // index of the first frame in the capture, counting every frame including those dropped
+  uint64_t frame() const { return mFrame; }
+  void setFrame(uint64_t frame) { mFrame = frame; }
+
+  bool discontinuity() const { return mDiscontinuity; }
+  void setDiscontinuity(bool discontinuity) { mDiscontinuity = discontinuity; }
+
+  // an output chunk to be played from a given stream time, held in place of the timestamp
+  bool scheduled() const { return mScheduled; }
+  void schedule(double at) { mTs = at; mScheduled = true; }
+
+  // a voice gate opening at the start of the chunk, or closing at its end
+  bool gateEdge(bool &open, double &ts) const { open = mGateEdge > 0; ts = mGateTs; return 0 != mGateEdge; }
+  void setGateEdge(bool open, double ts) { mGateEdge = open ? 1 : -1; mGateTs = ts; }
+
+  void reset(uint32_t numBytes, double ts) {
+    mChunk.setNumBytes(numBytes);
+    mTs = ts;
+    mFrame = 0;
+    mDiscontinuity = false;
+    mScheduled = false;
+    mGateEdge = 0;
+    mUsers = 1;
+  }
+
+  // a pooled chunk goes back to its pool when the last of its users has recycled it
+  void addUser() { mUsers.fetch_add(1); }
+  bool releaseUser() { return 1 == mUsers.fetch_sub(1); }
+
+  void release(napi_env env) {
+    if (mRef) {
+      napi_status status = napi_delete_reference(env, mRef);
+      FLOATING_STATUS;
+      mRef = nullptr;
+    }
+  }
+
+  std::weak_ptr<ChunkPool> pool() const { return mPool; }
+  void setPool(std::weak_ptr<ChunkPool> pool) { mPool = pool; }
+
+  // check whether a view may be handed on to JS without copying
+  bool lend();
+
 private:
-  std::shared_ptr<Memory> mChunk;
-  const double mTs;
+  Memory mChunk;
+  double mTs;
+  uint64_t mSeq;
+  uint64_t mFrame;
+  bool mDiscontinuity;
+  bool mScheduled;
+  int8_t mGateEdge;
+  double mGateTs;
+  napi_ref mRef;
+  std::atomic<uint32_t> mUsers;
+  std::shared_ptr<Chunk> mParent;
+  bool mLent;
+  std::weak_ptr<ChunkPool> mPool;
 };
 
-class Chunks {
+// Set of chunks allocated ahead of use so that the capture callback does not touch
+// the heap. Chunks lent to JS are held until their buffers are collected, so the
+// pool holds four times the chunks the capture queue needs, all allocated when it
+// is made. Lending stops while the initial number of chunks would not be left for
+// the capture queue - the reader copies instead until buffers have been collected.
+// Extra chunks are headroom for other queues sharing the same blocks. Chunks for
+// queues that come and go are reserved as each is made, up to maxReserved, and
+// handed back when it has gone.
+// The realtime thread is the only caller of acquire and putBack, recycle may be
+// called from any other thread.
+class ChunkPool {
 public:
-  Chunks(uint32_t maxQueue)
-    : mQueue(maxQueue), mOffset(0), m(), cv()
-  {}
-  ~Chunks() {}
+  static std::shared_ptr<ChunkPool> makeNew(uint32_t numChunks, uint32_t chunkBytes, uint32_t extraChunks = 0,
+                                            uint32_t maxReserved = 0) {
+    std::shared_ptr<ChunkPool> pool = std::make_shared<ChunkPool>(numChunks, chunkBytes, extraChunks, maxReserved);
+    pool->mSelf = pool;
+    for (uint32_t i = 0; i < numChunks * 4 + extraChunks; ++i)
+      pool->mFree.tryEnqueue(pool->makeChunk());
+    return pool;
+  }
 
-  uint8_t *curBuf() const {
-    std::unique_lock<std::mutex> lk(m);
-    return mCurChunk ? mCurChunk->buf() : nullptr;
+  ChunkPool(uint32_t numChunks, uint32_t chunkBytes, uint32_t extraChunks = 0, uint32_t maxReserved = 0)
+    : mChunkBytes(chunkBytes), mMaxChunks(numChunks * 4 + extraChunks + maxReserved), mMaxLent(numChunks * 3),
+      mFree(mMaxChunks), mLent(0), mRetiring(0), mRunning(false), m() {
+    mSpares.reserve(mMaxChunks);
   }
-  uint32_t curBytes() const {
-    std::unique_lock<std::mutex> lk(m);
-    return mCurChunk ? mCurChunk->numBytes() : 0;
+  ~ChunkPool() {}
+
+  uint32_t chunkBytes() const { return mChunkBytes; }
+
+  // Not for the realtime thread - add chunks for a queue that shares the pool,
+  // taking back chunks still waiting to be handed back before allocating any
+  void reserve(uint32_t numChunks) {
+    std::lock_guard<std::mutex> lk(m);
+    uint32_t kept = std::min<uint32_t>(numChunks, mRetiring);
+    mRetiring -= kept;
+    for (uint32_t i = kept; i < numChunks; ++i)
+      mFree.tryEnqueue(makeChunk());
   }
-  double curTs() const {
-    std::unique_lock<std::mutex> lk(m);
-    return mCurChunk ? mCurChunk->ts() : 0.0;
+
+  // Not for the realtime thread - hand back chunks reserved for a queue that has
+  // gone. Each is freed as it is recycled, or from the free list straight away
+  // while the realtime thread is not taking chunks.
+  void unreserve(uint32_t numChunks) {
+    std::lock_guard<std::mutex> lk(m);
+    mRetiring += numChunks;
+    std::shared_ptr<Chunk> chunk;
+    while (mRetiring && !mRunning && mFree.tryDequeue(chunk)) {
+      chunk.reset();
+      mRetiring--;
+    }
   }
 
-  uint32_t curOffset() const {
-    std::unique_lock<std::mutex> lk(m);
-    return mOffset;
+  // set while the realtime thread may acquire chunks
+  void setRunning(bool running) {
+    std::lock_guard<std::mutex> lk(m);
+    mRunning = running;
   }
-  void incOffset(uint32_t off) {
-    std::unique_lock<std::mutex> lk(m);
-    mOffset += off;
+
+  // returns an empty pointer if the pool is exhausted or the chunks are too small - never allocates
+  std::shared_ptr<Chunk> acquire(uint32_t numBytes, double ts) {
+    std::shared_ptr<Chunk> chunk;
+    if (numBytes > mChunkBytes)
+      return chunk;
+    if (!mSpares.empty()) {
+      chunk = std::move(mSpares.back());
+      mSpares.pop_back();
+    } else if (!mFree.tryDequeue(chunk))
+      return chunk;
+    chunk->reset(numBytes, ts);
+    return chunk;
+  }
+
+  // Release the realtime thread's use of a chunk that it acquired but could not use,
+  // or dropped from a queue. It is kept as a spare if no other queue still holds it.
+  void putBack(std::shared_ptr<Chunk> chunk) {
+    if (chunk && isOwner(chunk) && chunk->releaseUser() && (mSpares.size() < mSpares.capacity()))
+      mSpares.push_back(std::move(chunk));
+  }
+
+  // release a user of a chunk and return it to its pool, if it came from one, once unused
+  static void recycle(std::shared_ptr<Chunk> chunk) {
+    if (!chunk)
+      return;
+    std::shared_ptr<ChunkPool> pool = chunk->pool().lock();
+    if (pool && chunk->releaseUser()) {
+      std::lock_guard<std::mutex> lk(pool->m);
+      if (pool->mRetiring)
+        pool->mRetiring--; // handed back, so freed here rather than returned
+      else
+        pool->mFree.tryEnqueue(std::move(chunk));
+    }
+  }
+
+  bool tryLend() {
+    if (mLent.fetch_add(1) < mMaxLent)
+      return true;
+    mLent--;
+    return false;
   }
+  void unlend() { mLent--; }
 
+private:
+  const uint32_t mChunkBytes;
+  const uint32_t mMaxChunks;
+  const uint32_t mMaxLent;
+  ChunkQueue<std::shared_ptr<Chunk> > mFree;
+  std::atomic<uint32_t> mLent;
+  uint32_t mRetiring;
+  bool mRunning;
+  std::vector<std::shared_ptr<Chunk> > mSpares;
+  std::weak_ptr<ChunkPool> mSelf;
+  std::mutex m;
+
+  std::shared_ptr<Chunk> makeChunk() {
+    std::shared_ptr<Chunk> chunk = std::make_shared<Chunk>(mChunkBytes, 0.0);
+    chunk->setPool(mSelf);
+    return chunk;
+  }
+
+  bool isOwner(const std::shared_ptr<Chunk> &chunk) const {
+    std::shared_ptr<ChunkPool> pool = chunk->pool().lock();
+    return pool.get() == this;
+  }
+};
+
+inline Chunk::~Chunk() {
+  if (mParent) {
+    std::shared_ptr<ChunkPool> pool = mParent->pool().lock();
+    if (mLent && pool)
+      pool->unlend();
+    ChunkPool::recycle(std::move(mParent));
+  }
+}
+
+inline bool Chunk::lend() {
+  if (!mParent || mLent)
+    return true;
+  std::shared_ptr<ChunkPool> pool = mParent->pool().lock();
+  mLent = pool ? pool->tryLend() : true;
+  return mLent;
+}
+
+class Chunks {
+public:
+  // With maxDone set, consumed chunks are kept for the JS thread to release
+  // rather than being freed by the consumer. No more than maxDone chunks are
+  // pushed and not yet released, so the consumer always has room to keep one.
+  Chunks(uint32_t maxQueue, uint32_t maxDone = 0)
+    : mQueue(maxQueue), mDone(maxDone ? new ChunkQueue<std::shared_ptr<Chunk> >(maxDone) : nullptr), mMaxDone(maxDone),
+      mUnreleased(0), mOffset(0), mLastSeq(0), mCurDiscontinuity(false), mQueuedBytes(0), mHasCur(false), m(), cv()
+  {}
+  ~Chunks() {}
+
+  // The current chunk and offset belong to the consumer thread only
+  std::shared_ptr<Chunk> curChunk() const { return mCurChunk; }
+  uint8_t *curBuf() const { return mCurChunk ? mCurChunk->buf() : nullptr; }
+  uint32_t curBytes() const { return mCurChunk ? mCurChunk->numBytes() : 0; }
+  double curTs() const { return mCurChunk ? mCurChunk->ts() : 0.0; }
+  uint64_t curFrame() const { return mCurChunk ? mCurChunk->frame() : 0; }
+  bool curScheduled() const { return mCurChunk ? mCurChunk->scheduled() : false; }
+
+  uint32_t curOffset() const { return mOffset; }
+  void incOffset(uint32_t off) { mOffset += off; }
+
+  // set when sequenced chunks were dropped between the previous chunk and the current one
+  bool curDiscontinuity() const { return mCurDiscontinuity; }
+  void clearDiscontinuity() { mCurDiscontinuity = false; }
+
+  // blocking - not for use on the realtime thread
   void waitNext() {
-    auto curChunk = mQueue.dequeue();
+    setCur(mQueue.dequeue());
+  }
 
-    std::unique_lock<std::mutex> lk(m);
-    mCurChunk = curChunk;
-    mOffset = 0;
-    cv.notify_one();
+  // non-blocking - returns false if no chunk is ready
+  bool tryNext() {
+    std::shared_ptr<Chunk> chunk;
+    bool ready = mQueue.tryDequeue(chunk);
+    setCur(std::move(chunk));
+    return ready;
   }
 
   void waitDone() {
     std::unique_lock<std::mutex> lk(m);
-    while(mCurChunk) {
-      cv.wait(lk);
+    while(mHasCur || mQueue.size()) {
+      cv.wait_for(lk, std::chrono::milliseconds(2));
     }
   }
 
+  // blocking - not for use on the realtime thread
   void push(std::shared_ptr<Chunk> chunk) {
-    mQueue.enqueue(chunk);
+    if (mDone) {
+      // wait for the JS thread to release consumed chunks until there is room to keep this one
+      std::unique_lock<std::mutex> lk(m);
+      while ((mUnreleased.load() >= mMaxDone) && mQueue.isActive())
+        cv.wait_for(lk, std::chrono::milliseconds(2));
+      mUnreleased++;
+    }
+    // bytes are counted once queued, not while waiting for space
+    uint32_t numBytes = chunk ? chunk->numBytes() : 0;
+    if (mQueue.enqueue(chunk))
+      mQueuedBytes += numBytes;
+    else if (mDone)
+      mUnreleased--;
+  }
+
+  // The non-blocking pushes are for queues that do not keep consumed chunks
+  // non-blocking - returns false and leaves the chunk in place if the queue is full
+  bool tryPush(std::shared_ptr<Chunk> &chunk) {
+    uint32_t numBytes = chunk->numBytes();
+    mQueuedBytes += numBytes;
+    if (mQueue.tryEnqueue(std::move(chunk)))
+      return true;
+    mQueuedBytes -= numBytes;
+    return false;
+  }
+
+  // non-blocking - if the queue is full the oldest chunk is moved out into dropped
+  bool tryPushOverwrite(std::shared_ptr<Chunk> &chunk, std::shared_ptr<Chunk> &dropped) {
+    uint32_t numBytes = chunk->numBytes();
+    mQueuedBytes += numBytes;
+    if (!mQueue.tryEnqueueOverwrite(std::move(chunk), dropped)) {
+      mQueuedBytes -= numBytes;
+      return false;
+    }
+    if (dropped)
+      mQueuedBytes -= dropped->numBytes();
+    return true;
+  }
+
+  int64_t queuedBytes() const { return mQueuedBytes; }
+  size_t queuedChunks() const { return mQueue.size(); }
+
+  bool isActive() const { return mQueue.isActive(); }
+
+  // take the next consumed chunk to be released, from the releasing thread only
+  bool popDone(std::shared_ptr<Chunk> &chunk) {
+    if (!mDone || !mDone->tryDequeue(chunk))
+      return false;
+    mUnreleased--;
+    cv.notify_one();
+    return true;
   }
 
   void quit() {
     mQueue.quit();
+    cv.notify_all();
   }
 
 private:
   ChunkQueue<std::shared_ptr<Chunk> > mQueue;
+  std::unique_ptr<ChunkQueue<std::shared_ptr<Chunk> > > mDone;
+  const uint32_t mMaxDone;
+  std::atomic<uint32_t> mUnreleased;
   std::shared_ptr<Chunk> mCurChunk;
   uint32_t mOffset;
-  mutable std::mutex m;
+  uint64_t mLastSeq;
+  bool mCurDiscontinuity;
+  std::atomic<int64_t> mQueuedBytes;
+  std::atomic<bool> mHasCur;
+  std::mutex m;
   std::condition_variable cv;
+
+  void setCur(std::shared_ptr<Chunk> chunk) {
+    // push keeps room for every unreleased chunk, so keeping the consumed chunk cannot fail
+    if (mDone && mCurChunk)
+      mDone->tryEnqueue(std::move(mCurChunk));
+    ChunkPool::recycle(std::move(mCurChunk));
+    mCurChunk = std::move(chunk);
+    mOffset = 0;
+    if (mCurChunk) {
+      mQueuedBytes -= mCurChunk->numBytes();
+      if (mCurChunk->seq()) {
+        mCurDiscontinuity = mLastSeq && (mCurChunk->seq() != mLastSeq + 1);
+        mLastSeq = mCurChunk->seq();
+      }
+    }
+    mHasCur = mCurChunk ? true : false;
+    if (!mHasCur)
+      cv.notify_one();
+  }
 };
 
 } // namespace streampunk
@@ -0,0 +1,135 @@
+/* Copyright 2019 Streampunk Media Ltd.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+
+#include "ClockEstimator.h"
+#include <algorithm>
+#include <cmath>
+
+namespace streampunk {
+
+// the loop acquires with a wider bandwidth for its first seconds, then settles
+static const double acquireSeconds = 2.0;
+static const double acquireBandwidthScale = 8.0;
+static const double settleSeconds = 2.0;
+// the sample rate is measured over between one and two windows, once the loop has settled
+static const double rateWindowSeconds = 30.0;
+static const double minRateSeconds = 1.0;
+// an error larger than this is a jump in one of the clocks rather than jitter
+static const double maxErrorSeconds = 0.05;
+// the period is held within this fraction of nominal, far wider than any real device drift
+static const double maxDeviation = 0.005;
+static const double pi = 3.14159265358979323846;
+
+ClockEstimator::ClockEstimator(double nominalRate, double bandwidthHz)
+  : mNominalRate(nominalRate), mBandwidth(bandwidthHz), mFrames(0), mStartFrame(0), mLoopFrame(0), mTime(0.0),
+    mPeriod(1.0 / nominalRate), mAnchorFrame(0), mAnchorTime(0.0), mMidFrame(0), mMidTime(0.0), mOffset(0.0), mErrSq(0.0), mResets(0), mStarted(false),
+    mSeq(0), mPubPeriod(1.0 / nominalRate), mPubOffset(0.0), mPubJitter(0.0), mPubLocked(false), mPubResets(0) {}
+
+double ClockEstimator::callback(uint32_t frameCount, double now, double streamTime) {
+  uint64_t frame = mFrames;
+  mFrames += frameCount;
+  if (!mStarted) {
+    mStarted = true;
+    mOffset = streamTime - now;
+    restart(frame, now);
+    publish(false);
+    return streamTime;
+  }
+  // the two clocks are read together, so their difference needs only light smoothing
+  mOffset += 0.05 * ((streamTime - now) - mOffset);
+
+  double frames = (double)(frame - mLoopFrame);
+  double predicted = mTime + frames * mPeriod;
+  double err = now - predicted;
+  if ((frames <= 0.0) || (std::fabs(err) > maxErrorSeconds)) {
+    mResets++;
+    restart(frame, now);
+    publish(false);
+    return streamTime;
+  }
+
+  // gains for a loop of the set bandwidth with a damping of 0.707, scaled to the time since the last update
+  bool acquiring = (double)(frame - mStartFrame) < acquireSeconds * mNominalRate;
+  double omega = 2.0 * pi * mBandwidth * (acquiring ? acquireBandwidthScale : 1.0) * frames / mNominalRate;
+  mTime = predicted + std::sqrt(2.0) * omega * err;
+  mPeriod += omega * omega * err / frames;
+  mPeriod = std::min(std::max(mPeriod, (1.0 - maxDeviation) / mNominalRate), (1.0 + maxDeviation) / mNominalRate);
+  mLoopFrame = frame;
+  mErrSq += 0.01 * (err * err - mErrSq);
+
+  bool settling = (double)(frame - mStartFrame) < (acquireSeconds + settleSeconds) * mNominalRate;
+  if (settling) {
+    mAnchorFrame = mMidFrame = frame;
+    mAnchorTime = mMidTime = mTime;
+  } else if ((double)(frame - mMidFrame) >= rateWindowSeconds * mNominalRate) {
+    mAnchorFrame = mMidFrame;
+    mAnchorTime = mMidTime;
+    mMidFrame = frame;
+    mMidTime = mTime;
+  }
+
+  publish(!settling);
+  return mTime + mOffset;
+}
+
+ClockEstimator::Estimate ClockEstimator::estimate() const {
+  Estimate e;
+  uint32_t seq;
+  do {
+    seq = mSeq.load(std::memory_order_acquire);
+    e.sampleRate = 1.0 / mPubPeriod.load(std::memory_order_relaxed);
+    e.offset = mPubOffset.load(std::memory_order_relaxed);
+    e.jitter = mPubJitter.load(std::memory_order_relaxed);
+    e.locked = mPubLocked.load(std::memory_order_relaxed);
+    e.resets = mPubResets.load(std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_acquire);
+  } while ((seq & 1) || (seq != mSeq.load(std::memory_order_relaxed)));
+  e.ppm = (e.sampleRate / mNominalRate - 1.0) * 1e6;
+  return e;
+}
+
+// private
+void ClockEstimator::restart(uint64_t frame, double now) {
+  mStartFrame = frame;
+  mLoopFrame = frame;
+  mAnchorFrame = mMidFrame = frame;
+  mAnchorTime = mMidTime = now;
+  mTime = now;
+  mErrSq = 0.0;
+}
+
+void ClockEstimator::publish(bool locked) {
+  uint32_t seq = mSeq.load(std::memory_order_relaxed);
+  mSeq.store(seq + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  mPubPeriod.store(measuredPeriod(), std::memory_order_relaxed);
+  mPubOffset.store(mOffset, std::memory_order_relaxed);
+  mPubJitter.store(std::sqrt(mErrSq), std::memory_order_relaxed);
+  mPubLocked.store(locked, std::memory_order_relaxed);
+  mPubResets.store(mResets, std::memory_order_relaxed);
+  mSeq.store(seq + 2, std::memory_order_release);
+}
+
+double ClockEstimator::measuredPeriod() const {
+  double frames = (double)(mLoopFrame - mAnchorFrame);
+  return frames >= minRateSeconds * mNominalRate ? (mTime - mAnchorTime) / frames : mPeriod;
+}
+
+double ClockEstimator::readOffset() const {
+  return mPubOffset.load(std::memory_order_relaxed);
+}
+
+} // namespace streampunk
@@ -0,0 +1,91 @@
+/* Copyright 2019 Streampunk Media Ltd.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+
+#ifndef CLOCKESTIMATOR_H
+#define CLOCKESTIMATOR_H
+
+#include <atomic>
+#include <cstdint>
+
+namespace streampunk {
+
+// Relates the device clock to the steady system clock. Each callback reports the
+// frames the device has processed so far and the system time, and a second order
+// delay-locked loop smooths the jitter of the callback times into an estimate of
+// when the current callback ought to have run. The loop's own period follows the
+// jitter too closely to measure drift, so the sample rate is measured between the
+// smoothed times of callbacks up to a minute apart once the loop has locked.
+// A jump too large to be jitter, such as after a stall, restarts the loop.
+// The loop runs on the realtime thread and publishes its estimate through a
+// sequence lock, so that other threads read it without blocking the callback.
+class ClockEstimator {
+public:
+  struct Estimate {
+    double sampleRate;  // measured frames per second of system time
+    double ppm;         // deviation of the measured rate from the nominal rate
+    double jitter;      // RMS difference of the callback times from the loop, in seconds
+    double offset;      // stream time less system time
+    bool locked;
+    uint64_t resets;
+  };
+
+  ClockEstimator(double nominalRate, double bandwidthHz = 0.5);
+  ~ClockEstimator() {}
+
+  // realtime thread only - called at the start of each callback with the system time and
+  // the stream time, returns the smoothed stream time of the callback
+  double callback(uint32_t frameCount, double now, double streamTime);
+
+  // any thread
+  Estimate estimate() const;
+  double toSystemTime(double streamTime) const { return streamTime - readOffset(); }
+  double toStreamTime(double systemTime) const { return systemTime + readOffset(); }
+
+private:
+  const double mNominalRate;
+  const double mBandwidth;
+  // loop state, on the realtime thread
+  uint64_t mFrames;
+  uint64_t mStartFrame;
+  uint64_t mLoopFrame;
+  double mTime;
+  double mPeriod;
+  // smoothed points that the sample rate is measured from, moved on every rate window
+  uint64_t mAnchorFrame;
+  double mAnchorTime;
+  uint64_t mMidFrame;
+  double mMidTime;
+  double mOffset;
+  double mErrSq;
+  uint64_t mResets;
+  bool mStarted;
+  // the published estimate
+  std::atomic<uint32_t> mSeq;
+  std::atomic<double> mPubPeriod;
+  std::atomic<double> mPubOffset;
+  std::atomic<double> mPubJitter;
+  std::atomic<bool> mPubLocked;
+  std::atomic<uint64_t> mPubResets;
+
+  void restart(uint64_t frame, double now);
+  void publish(bool locked);
+  double measuredPeriod() const;
+  double readOffset() const;
+};
+
+} // namespace streampunk
+
+#endif
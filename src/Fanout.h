@@ -0,0 +1,211 @@
+/* Copyright 2019 Streampunk Media Ltd.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#ifndef FANOUT_H
+#define FANOUT_H
+
+#include "Chunks.h"
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace streampunk {
+
+// A handle on the capture with a queue, read position and overflow policy of its
+// own. Captured blocks are shared with the stream and every other reader - each
+// queue holds a user of the block, so a block returns to the pool once all are done.
+// The pool grows by the blocks the reader's queue can hold while the reader is open.
+class CaptureReader {
+public:
+  CaptureReader(uint32_t id, uint32_t maxQueue, bool dropOldest, uint32_t bytesPerFrame,
+                std::shared_ptr<ChunkPool> pool, uint32_t poolChunks)
+    : mId(id), mChunks(std::make_shared<Chunks>(maxQueue)), mDropOldest(dropOldest),
+      mBytesPerFrame(bytesPerFrame), mPool(pool), mPoolChunks(poolChunks),
+      mClosed(false), mDetached(false), mOverflows(0), mDroppedFrames(0) {
+    if (mPool)
+      mPool->reserve(poolChunks);
+  }
+  // queued blocks go back to their pool rather than being freed
+  ~CaptureReader() {
+    while (mChunks->tryNext()) {}
+    unreserve();
+  }
+
+  uint32_t id() const { return mId; }
+  std::shared_ptr<Chunks> chunks() const { return mChunks; }
+
+  // stop reading - any pending read finishes and the reader leaves at the next callback
+  void close() { mClosed = true; mChunks->quit(); unreserve(); }
+  // the capture has finished - reads return what is queued, then finish
+  void end() { mChunks->quit(); }
+
+  uint64_t overflows() const { return mOverflows; }
+  uint64_t droppedFrames() const { return mDroppedFrames; }
+
+  // Realtime thread only - queue a block without blocking, applying the overflow policy
+  // if this reader has fallen behind. Dropped blocks release this reader's use of them.
+  void offer(const std::shared_ptr<Chunk> &block, ChunkPool &pool) {
+    std::shared_ptr<Chunk> chunk = block;
+    chunk->addUser();
+    if (mDropOldest) {
+      std::shared_ptr<Chunk> dropped;
+      bool pushed = mChunks->tryPushOverwrite(chunk, dropped);
+      if (dropped) {
+        drop(dropped->numBytes());
+        pool.putBack(std::move(dropped));
+      }
+      if (!pushed) {
+        drop(chunk->numBytes());
+        pool.putBack(std::move(chunk));
+      }
+    } else if (!mChunks->tryPush(chunk)) {
+      drop(chunk->numBytes());
+      pool.putBack(std::move(chunk));
+    }
+  }
+
+  bool closed() const { return mClosed; }
+  bool detached() const { return mDetached; }
+  void setDetached() { mDetached = true; }
+
+private:
+  const uint32_t mId;
+  std::shared_ptr<Chunks> mChunks;
+  const bool mDropOldest;
+  const uint32_t mBytesPerFrame;
+  std::shared_ptr<ChunkPool> mPool;
+  std::atomic<uint32_t> mPoolChunks;
+  std::atomic<bool> mClosed;
+  std::atomic<bool> mDetached;
+  std::atomic<uint64_t> mOverflows;
+  std::atomic<uint64_t> mDroppedFrames;
+
+  void drop(uint32_t numBytes) {
+    mOverflows++;
+    mDroppedFrames += numBytes / mBytesPerFrame;
+  }
+
+  // hand back the reader's share of the pool, once only
+  void unreserve() {
+    uint32_t poolChunks = mPoolChunks.exchange(0);
+    if (mPool && poolChunks)
+      mPool->unreserve(poolChunks);
+  }
+};
+
+// Readers are added and closed from the JS thread while the capture runs. As for
+// mix sources, the realtime thread sees each reader through a slot holding a plain
+// pointer and clears the slot when the reader has closed, so the owning reference
+// is only dropped once the callback has finished with it. While the callback is not
+// running the JS thread clears the slot itself.
+class Fanout {
+public:
+  static const uint32_t maxReaders = 32;
+
+  Fanout() : mNextId(1), mNumReaders(0), mEnded(false) {
+    for (uint32_t i = 0; i < maxReaders; ++i)
+      mSlots[i].store(nullptr);
+  }
+  ~Fanout() {}
+
+  // returns the new reader, or null if all slots are in use
+  std::shared_ptr<CaptureReader> add(uint32_t maxQueue, bool dropOldest, uint32_t bytesPerFrame,
+                                     std::shared_ptr<ChunkPool> pool, uint32_t poolChunks) {
+    std::lock_guard<std::mutex> lk(m);
+    release();
+    for (uint32_t i = 0; i < maxReaders; ++i) {
+      if (mOwned[i])
+        continue;
+      mOwned[i] = std::make_shared<CaptureReader>(mNextId++, maxQueue, dropOldest, bytesPerFrame, pool, poolChunks);
+      if (mEnded)
+        mOwned[i]->end();
+      mSlots[i].store(mOwned[i].get());
+      mNumReaders++;
+      return mOwned[i];
+    }
+    return std::shared_ptr<CaptureReader>();
+  }
+
+  std::shared_ptr<CaptureReader> find(uint32_t id) {
+    std::lock_guard<std::mutex> lk(m);
+    for (uint32_t i = 0; i < maxReaders; ++i)
+      if (mOwned[i] && (id == mOwned[i]->id()))
+        return mOwned[i];
+    return std::shared_ptr<CaptureReader>();
+  }
+
+  // With detachNow set the realtime thread is not running, so the reader is let go of here
+  // along with its queued blocks, rather than waiting for a callback that may never come
+  void close(uint32_t id, bool detachNow) {
+    std::lock_guard<std::mutex> lk(m);
+    for (uint32_t i = 0; i < maxReaders; ++i) {
+      if (!mOwned[i] || (id != mOwned[i]->id()))
+        continue;
+      mOwned[i]->close();
+      if (detachNow && !mOwned[i]->detached())
+        detach(i);
+    }
+    release();
+  }
+
+  // the capture has finished, so every reader finishes once it has read what is queued
+  void end() {
+    std::lock_guard<std::mutex> lk(m);
+    mEnded = true;
+    for (uint32_t i = 0; i < maxReaders; ++i)
+      if (mOwned[i])
+        mOwned[i]->end();
+  }
+
+  std::vector<std::shared_ptr<CaptureReader> > readers() {
+    std::lock_guard<std::mutex> lk(m);
+    release();
+    std::vector<std::shared_ptr<CaptureReader> > result;
+    for (uint32_t i = 0; i < maxReaders; ++i)
+      if (mOwned[i])
+        result.push_back(mOwned[i]);
+    return result;
+  }
+
+  // realtime thread only
+  uint32_t numReaders() const { return mNumReaders.load(std::memory_order_relaxed); }
+  CaptureReader *slot(uint32_t i) const { return mSlots[i].load(std::memory_order_acquire); }
+  void detach(uint32_t i) {
+    CaptureReader *reader = mSlots[i].load(std::memory_order_relaxed);
+    mSlots[i].store(nullptr);
+    mNumReaders--;
+    reader->setDetached();
+  }
+
+private:
+  std::atomic<CaptureReader *> mSlots[maxReaders];
+  std::shared_ptr<CaptureReader> mOwned[maxReaders];
+  uint32_t mNextId;
+  std::atomic<uint32_t> mNumReaders;
+  bool mEnded;
+  std::mutex m;
+
+  // drop readers that the realtime thread has let go of - a pending read keeps its own reference
+  void release() {
+    for (uint32_t i = 0; i < maxReaders; ++i)
+      if (mOwned[i] && mOwned[i]->detached())
+        mOwned[i].reset();
+  }
+};
+
+} // namespace streampunk
+
+#endif
@@ -0,0 +1,83 @@
+/* Copyright 2019 Streampunk Media Ltd.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#include "Gain.h"
+#include "SampleFormat.h"
+#include <algorithm>
+#include <cstring>
+
+namespace streampunk {
+
+GainRamp::GainRamp(uint32_t format, uint32_t channels, uint32_t blockFrames)
+  : mFormat(format), mChannels(channels), mBlockFrames(blockFrames), mRequest(pack(1.0f, 0)),
+    mSeen(pack(1.0f, 0)), mGain(1.0f), mTarget(1.0f), mStep(0.0f), mFramesLeft(0),
+    mScratch(1 == format ? 0 : blockFrames * channels) {}
+
+// the gain and ramp length share one word, so that a request is never seen half written
+uint64_t GainRamp::pack(float gain, uint32_t rampFrames) {
+  uint32_t gainBits;
+  memcpy(&gainBits, &gain, sizeof(gainBits));
+  return ((uint64_t)gainBits << 32) | rampFrames;
+}
+
+void GainRamp::set(float gain, uint32_t rampFrames) {
+  mRequest.store(pack(gain, rampFrames), std::memory_order_release);
+}
+
+void GainRamp::update() {
+  uint64_t request = mRequest.load(std::memory_order_acquire);
+  if (request == mSeen)
+    return;
+  mSeen = request;
+  uint32_t gainBits = (uint32_t)(request >> 32);
+  memcpy(&mTarget, &gainBits, sizeof(mTarget));
+  mFramesLeft = (uint32_t)request;
+  if (mFramesLeft)
+    mStep = (mTarget - mGain) / mFramesLeft;
+  else
+    mGain = mTarget;
+}
+
+// Ramps are applied in segments that end where the ramp does, so the gain reaches the
+// target on the right frame. Integer samples are scaled as float, a block at a time.
+void GainRamp::apply(uint8_t *buf, uint32_t numFrames) {
+  update();
+  if (!mFramesLeft && (1.0f == mGain))
+    return;
+  uint32_t frameBytes = mChannels * sampleBytes(mFormat);
+  for (uint32_t f = 0; f < numFrames;) {
+    uint32_t n = std::min<uint32_t>(mBlockFrames, numFrames - f);
+    if (mFramesLeft)
+      n = std::min<uint32_t>(n, mFramesLeft);
+    float startGain = mGain;
+    float endGain = mGain;
+    if (mFramesLeft) {
+      mFramesLeft -= n;
+      endGain = mFramesLeft ? mGain + mStep * n : mTarget;
+    }
+    uint8_t *block = buf + f * frameBytes;
+    if (1 == mFormat)
+      gainSamples((float *)block, startGain, endGain, n * mChannels);
+    else {
+      convertSamples(block, mFormat, (uint8_t *)mScratch.data(), 1, n * mChannels);
+      gainSamples(mScratch.data(), startGain, endGain, n * mChannels);
+      convertSamples((const uint8_t *)mScratch.data(), 1, block, mFormat, n * mChannels);
+    }
+    mGain = endGain;
+    f += n;
+  }
+}
+
+} // namespace streampunk
@@ -0,0 +1,57 @@
+/* Copyright 2019 Streampunk Media Ltd.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#ifndef GAIN_H
+#define GAIN_H
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+namespace streampunk {
+
+// Gain applied to the buffers of one side of the stream in the audio callback.
+// A new gain is requested from any thread with a single atomic store, and is
+// picked up at the start of the next buffer, ramping linearly to the new gain
+// over the given number of frames from the frame the request was picked up.
+class GainRamp {
+public:
+  GainRamp(uint32_t format, uint32_t channels, uint32_t blockFrames);
+  ~GainRamp() {}
+
+  void set(float gain, uint32_t rampFrames);
+
+  // realtime thread only - scale a buffer of interleaved frames in place
+  void apply(uint8_t *buf, uint32_t numFrames);
+
+private:
+  const uint32_t mFormat;
+  const uint32_t mChannels;
+  const uint32_t mBlockFrames;
+  std::atomic<uint64_t> mRequest;
+  uint64_t mSeen;
+  float mGain;
+  float mTarget;
+  float mStep;
+  uint32_t mFramesLeft;
+  std::vector<float> mScratch;
+
+  static uint64_t pack(float gain, uint32_t rampFrames);
+  void update();
+};
+
+} // namespace streampunk
+
+#endif
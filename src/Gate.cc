@@ -0,0 +1,125 @@
+/* Copyright 2019 Streampunk Media Ltd.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#include "Gate.h"
+#include "Chunks.h"
+#include "SampleFormat.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+namespace streampunk {
+
+Gate::Gate(uint32_t channels, uint32_t format, uint32_t sampleRate, double thresholdDb,
+           double hysteresisDb, uint32_t holdMs, uint32_t preRollMs, uint32_t maxZcr)
+  : mChannels(channels), mFormat(format), mSampleRate(sampleRate), mFrameBytes(channels * sampleBytes(format)),
+    mWindowFrames(std::max<uint32_t>(1, sampleRate / 100)),
+    mOpenLevel((float)std::pow(10.0, thresholdDb / 20.0)),
+    mCloseLevel((float)std::pow(10.0, (thresholdDb - hysteresisDb) / 20.0)),
+    mHoldFrames((uint32_t)((uint64_t)holdMs * sampleRate / 1000)),
+    mMaxCrossings((uint32_t)((uint64_t)maxZcr * mWindowFrames / sampleRate)),
+    mOpen(false), mFrames(0), mSumSq(0.0), mCrossings(0), mNegative(false), mHeldFrames(0),
+    mScratch(mWindowFrames * channels),
+    mPreRoll(((uint64_t)preRollMs * sampleRate / 1000 + mWindowFrames) * mFrameBytes),
+    mPreRollPos(0), mPreRollBytes(0) {}
+
+bool Gate::pass(std::shared_ptr<Chunk> &chunk) {
+  uint32_t numFrames = chunk->numBytes() / mFrameBytes;
+  if (!mOpen && chunk->discontinuity())
+    mPreRollBytes = 0; // the pre-roll would span the gap
+  analyse(chunk->buf(), numFrames);
+  if (!mOpen)
+    keep(chunk->buf(), numFrames * mFrameBytes);
+  bool wasOpen = mOpen;
+  if (mFrames == mWindowFrames && (decide() != wasOpen)) {
+    double endTs = chunk->ts() + (double)numFrames / mSampleRate;
+    if (mOpen) {
+      // pass on the pre-roll, which ends with this block
+      std::shared_ptr<Chunk> preRoll = std::make_shared<Chunk>(mPreRollBytes, endTs - (double)(mPreRollBytes / mFrameBytes) / mSampleRate);
+      uint32_t start = (mPreRollPos + mPreRoll.size() - mPreRollBytes) % mPreRoll.size();
+      uint32_t firstBytes = std::min<uint32_t>(mPreRollBytes, mPreRoll.size() - start);
+      memcpy(preRoll->buf(), mPreRoll.data() + start, firstBytes);
+      memcpy(preRoll->buf() + firstBytes, mPreRoll.data(), mPreRollBytes - firstBytes);
+      preRoll->setFrame(chunk->frame() + numFrames - mPreRollBytes / mFrameBytes);
+      preRoll->setGateEdge(/*open*/true, preRoll->ts());
+      mPreRollBytes = 0;
+      chunk = preRoll;
+      return true;
+    }
+    chunk->setGateEdge(/*open*/false, endTs);
+  }
+  return wasOpen;
+}
+
+// accumulate the energy over all channels and the zero crossings of their sum
+void Gate::analyse(const uint8_t *buf, uint32_t numFrames) {
+  const float *samples = (const float *)buf;
+  if (1 != mFormat) {
+    convertSamples(buf, mFormat, (uint8_t *)mScratch.data(), 1, numFrames * mChannels);
+    samples = mScratch.data();
+  } else if ((uintptr_t)buf % sizeof(float)) {
+    memcpy(mScratch.data(), buf, numFrames * mFrameBytes);
+    samples = mScratch.data();
+  }
+  float sumSq = 0.0f;
+  for (uint32_t f = 0; f < numFrames; ++f) {
+    float sum = 0.0f;
+    for (uint32_t c = 0; c < mChannels; ++c) {
+      float s = samples[f * mChannels + c];
+      sumSq += s * s;
+      sum += s;
+    }
+    bool negative = sum < 0.0f;
+    if (negative != mNegative)
+      mCrossings++;
+    mNegative = negative;
+  }
+  mSumSq += sumSq;
+  mFrames += numFrames;
+}
+
+// at the end of a window - returns whether the gate is open for the next
+bool Gate::decide() {
+  float level = (float)std::sqrt(mSumSq / ((double)mFrames * mChannels));
+  if (!mOpen)
+    mOpen = (level >= mOpenLevel) && (mCrossings <= mMaxCrossings);
+  else if (level >= mCloseLevel)
+    mHeldFrames = 0;
+  else {
+    mHeldFrames += mFrames;
+    mOpen = mHeldFrames < mHoldFrames;
+  }
+  if (!mOpen)
+    mHeldFrames = 0;
+  mFrames = 0;
+  mSumSq = 0.0;
+  mCrossings = 0;
+  return mOpen;
+}
+
+void Gate::keep(const uint8_t *buf, uint32_t numBytes) {
+  uint32_t size = (uint32_t)mPreRoll.size();
+  if (numBytes > size) {
+    buf += numBytes - size;
+    numBytes = size;
+  }
+  uint32_t firstBytes = std::min<uint32_t>(numBytes, size - mPreRollPos);
+  memcpy(mPreRoll.data() + mPreRollPos, buf, firstBytes);
+  memcpy(mPreRoll.data(), buf + firstBytes, numBytes - firstBytes);
+  mPreRollPos = (mPreRollPos + numBytes) % size;
+  mPreRollBytes = std::min<uint32_t>(mPreRollBytes + numBytes, size);
+}
+
+} // namespace streampunk
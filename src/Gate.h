@@ -0,0 +1,76 @@
+/* Copyright 2019 Streampunk Media Ltd.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#ifndef GATE_H
+#define GATE_H
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace streampunk {
+
+class Chunk;
+
+// Voice activity gate for captured blocks, from the energy and zero crossing rate
+// of each 10ms window of the stream. The gate opens on a window at or above the
+// threshold level with no more than maxZcr crossings per second, and closes once the
+// level has stayed below the threshold less the hysteresis for the hold time. While
+// closed the last preRoll of audio is kept, to be passed on ahead of the window that
+// opened the gate. Gate methods are for the single reading thread.
+class Gate {
+public:
+  Gate(uint32_t channels, uint32_t format, uint32_t sampleRate, double thresholdDb,
+       double hysteresisDb, uint32_t holdMs, uint32_t preRollMs, uint32_t maxZcr);
+  ~Gate() {}
+
+  // bytes to the end of the current window, so that a block never spans a decision
+  uint32_t windowBytesLeft() const { return (mWindowFrames - mFrames) * mFrameBytes; }
+  uint32_t frameBytes() const { return mFrameBytes; }
+
+  // Analyse a block and return whether it should be passed on. A block that opens the
+  // gate is replaced by the pre-roll up to and including it, marked with the opening
+  // time. A block that closes the gate is marked with the closing time after it.
+  bool pass(std::shared_ptr<Chunk> &chunk);
+
+private:
+  const uint32_t mChannels;
+  const uint32_t mFormat;
+  const uint32_t mSampleRate;
+  const uint32_t mFrameBytes;
+  const uint32_t mWindowFrames;
+  const float mOpenLevel;
+  const float mCloseLevel;
+  const uint32_t mHoldFrames;
+  const uint32_t mMaxCrossings;
+  bool mOpen;
+  uint32_t mFrames;
+  double mSumSq;
+  uint32_t mCrossings;
+  bool mNegative;
+  uint32_t mHeldFrames;
+  std::vector<float> mScratch;
+  std::vector<uint8_t> mPreRoll;
+  uint32_t mPreRollPos;
+  uint32_t mPreRollBytes;
+
+  void analyse(const uint8_t *buf, uint32_t numFrames);
+  bool decide();
+  void keep(const uint8_t *buf, uint32_t numBytes);
+};
+
+} // namespace streampunk
+
+#endif
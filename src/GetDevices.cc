@@ -15,6 +15,7 @@
 
 #include "GetDevices.h"
 #include "naudiodonUtil.h"
+#include "PaRuntime.h"
 #include <portaudio.h>
 
 namespace streampunk {
@@ -24,9 +25,9 @@ napi_value getDevices(napi_env env, napi_callback_info info) {
   napi_value result, devInfo;
   uint32_t numDevices;
 
-  PaError errCode = Pa_Initialize();
-  if (errCode != paNoError)
-    NAPI_THROW_ERROR((std::string("Could not initialize PortAudio: ") + Pa_GetErrorText(errCode)).c_str());
+  std::string errStr;
+  if (!PaRuntime::enumerate(env, errStr))
+    NAPI_THROW_ERROR(errStr.c_str());
 
   numDevices = Pa_GetDeviceCount();
   status = napi_create_array(env, &result);
@@ -59,7 +60,6 @@ napi_value getDevices(napi_env env, napi_callback_info info) {
     status = napi_set_element(env, result, i, devInfo);
   }
 
-  Pa_Terminate();
   return result;
 }
 
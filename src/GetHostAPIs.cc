@@ -15,6 +15,7 @@
 
 #include "GetHostAPIs.h"
 #include "naudiodonUtil.h"
+#include "PaRuntime.h"
 #include <portaudio.h>
 
 namespace streampunk {
@@ -23,9 +24,9 @@ napi_value getHostAPIs(napi_env env, napi_callback_info info) {
   napi_status status;
   napi_value result, hostApiArr, hostInfo;
 
-  PaError errCode = Pa_Initialize();
-  if (errCode != paNoError)
-    NAPI_THROW_ERROR((std::string("Could not initialize PortAudio: ") + Pa_GetErrorText(errCode)).c_str());
+  std::string errStr;
+  if (!PaRuntime::enumerate(env, errStr))
+    NAPI_THROW_ERROR(errStr.c_str());
 
   status = napi_create_object(env, &result);
   CHECK_STATUS;
@@ -121,7 +122,6 @@ napi_value getHostAPIs(napi_env env, napi_callback_info info) {
   status = napi_set_named_property(env, result, "HostAPIs", hostApiArr);
   CHECK_STATUS;
 
-  Pa_Terminate();
   return result;
 }
 
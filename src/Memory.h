@@ -18,32 +18,58 @@
 
 #include <memory>
 #include <cstring>
+#include <algorithm>
 
 namespace streampunk {
 
+// Memory is held by value in its chunk, so that a chunk and its header are a
+// single allocation. A view wraps memory owned elsewhere without copying - the
+// owner must keep it alive. The number of valid bytes may be less than the
+// allocated capacity, so that a partly filled block needs no second copy.
 class Memory {
 public:
-  static std::shared_ptr<Memory> makeNew(uint32_t srcBytes) {
-    return std::make_shared<Memory>(srcBytes);
-  }
-  static std::shared_ptr<Memory> makeNew(uint8_t *buf, uint32_t srcBytes) {
-    return std::make_shared<Memory>(buf, srcBytes);
-  }
-
+  Memory()
+    : mCapacity(0), mNumBytes(0), mOwned(false), mBuf(nullptr) {}
   Memory(uint32_t numBytes)
-    : mNumBytes(numBytes), mBuf(new uint8_t[mNumBytes]) {}
+    : mCapacity(numBytes), mNumBytes(numBytes), mOwned(true), mBuf(new uint8_t[mCapacity]) {}
   Memory(uint8_t *buf, uint32_t numBytes)
-    : mNumBytes(numBytes), mBuf(new uint8_t[mNumBytes]) {
+    : mCapacity(numBytes), mNumBytes(numBytes), mOwned(true), mBuf(new uint8_t[mCapacity]) {
     memcpy(mBuf, buf, mNumBytes);
   }
-  ~Memory() { delete[] mBuf; }
+  Memory(uint8_t *buf, uint32_t numBytes, bool owned)
+    : mCapacity(numBytes), mNumBytes(numBytes), mOwned(owned), mBuf(buf) {}
+  Memory(Memory &&rhs)
+    : mCapacity(rhs.mCapacity), mNumBytes(rhs.mNumBytes), mOwned(rhs.mOwned), mBuf(rhs.mBuf) {
+    rhs.mOwned = false;
+  }
+  Memory &operator=(Memory &&rhs) {
+    if (this != &rhs) {
+      if (mOwned) delete[] mBuf;
+      mCapacity = rhs.mCapacity;
+      mNumBytes = rhs.mNumBytes;
+      mOwned = rhs.mOwned;
+      mBuf = rhs.mBuf;
+      rhs.mOwned = false;
+    }
+    return *this;
+  }
+  ~Memory() { if (mOwned) delete[] mBuf; }
 
   uint32_t numBytes() const { return mNumBytes; }
+  uint32_t capacity() const { return mCapacity; }
   uint8_t *buf() const { return mBuf; }
 
+  // set the number of valid bytes, up to the allocated capacity
+  void setNumBytes(uint32_t numBytes) { mNumBytes = std::min<uint32_t>(numBytes, mCapacity); }
+
 private:
-  const uint32_t mNumBytes;
-  uint8_t *const mBuf;
+  Memory(const Memory &);
+  Memory &operator=(const Memory &);
+
+  uint32_t mCapacity;
+  uint32_t mNumBytes;
+  bool mOwned;
+  uint8_t *mBuf;
 };
 
 } // namespace streampunk
@@ -0,0 +1,82 @@
+/* Copyright 2019 Streampunk Media Ltd.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#include "Meter.h"
+#include "SampleFormat.h"
+#include <algorithm>
+#include <cmath>
+
+namespace streampunk {
+
+// integer samples clip at the largest value of their type, just short of 1.0
+static float clipLevel(uint32_t format) {
+  return (1 == format) ? 1.0f : 1.0f - 1.0f / (float)(1u << (sampleBytes(format) * 8 - 1));
+}
+
+Meter::Meter(uint32_t inChannels, uint32_t inFormat, uint32_t outChannels, uint32_t outFormat,
+             uint32_t intervalFrames, uint32_t blockFrames)
+  : mInChannels(inChannels), mInFormat(inFormat), mOutChannels(outChannels), mOutFormat(outFormat),
+    mIntervalFrames(std::max<uint32_t>(1, intervalFrames)), mBlockFrames(blockFrames), mFrames(0),
+    mPeak(inChannels + outChannels, 0.0f), mSumSq(inChannels + outChannels, 0.0),
+    mClips(inChannels + outChannels, 0), mBlockSumSq(std::max(inChannels, outChannels)),
+    mScratch(blockFrames * std::max(inChannels, outChannels)) {}
+
+void Meter::input(const void *buf, uint32_t frameCount) {
+  if (buf && mInChannels)
+    accumulate((const uint8_t *)buf, mInFormat, mInChannels, frameCount, 0);
+}
+
+void Meter::output(const void *buf, uint32_t frameCount) {
+  if (buf && mOutChannels)
+    accumulate((const uint8_t *)buf, mOutFormat, mOutChannels, frameCount, mInChannels);
+}
+
+bool Meter::addFrames(uint32_t frameCount) {
+  mFrames += frameCount;
+  return mFrames >= mIntervalFrames;
+}
+
+void Meter::read(float *dst) {
+  for (uint32_t c = 0; c < mInChannels + mOutChannels; ++c) {
+    dst[c * 3] = mPeak[c];
+    dst[c * 3 + 1] = mFrames ? (float)std::sqrt(mSumSq[c] / mFrames) : 0.0f;
+    dst[c * 3 + 2] = (float)mClips[c];
+    mPeak[c] = 0.0f;
+    mSumSq[c] = 0.0;
+    mClips[c] = 0;
+  }
+  mFrames = 0;
+}
+
+// Float samples are metered in place, others are converted a block at a time. Sums
+// of squares are kept as float within a block and added up as double.
+void Meter::accumulate(const uint8_t *buf, uint32_t format, uint32_t channels, uint32_t frameCount, uint32_t first) {
+  float level = clipLevel(format);
+  uint32_t frameBytes = channels * sampleBytes(format);
+  for (uint32_t f = 0; f < frameCount; f += mBlockFrames) {
+    uint32_t n = std::min<uint32_t>(mBlockFrames, frameCount - f);
+    const float *block = (const float *)(buf + f * frameBytes);
+    if (1 != format) {
+      convertSamples(buf + f * frameBytes, format, (uint8_t *)mScratch.data(), 1, n * channels);
+      block = mScratch.data();
+    }
+    std::fill(mBlockSumSq.begin(), mBlockSumSq.end(), 0.0f);
+    meterSamples(block, channels, n, level, &mPeak[first], mBlockSumSq.data(), &mClips[first]);
+    for (uint32_t c = 0; c < channels; ++c)
+      mSumSq[first + c] += mBlockSumSq[c];
+  }
+}
+
+} // namespace streampunk
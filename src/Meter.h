@@ -0,0 +1,62 @@
+/* Copyright 2019 Streampunk Media Ltd.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#ifndef METER_H
+#define METER_H
+
+#include <cstdint>
+#include <vector>
+
+namespace streampunk {
+
+// Levels of the device input and output channels, accumulated in the audio
+// callback over an interval. A reading holds the peak, RMS and clip count of
+// each input channel and then of each output channel, with the levels as a
+// fraction of full scale. All methods are for the realtime thread only.
+class Meter {
+public:
+  Meter(uint32_t inChannels, uint32_t inFormat, uint32_t outChannels, uint32_t outFormat,
+        uint32_t intervalFrames, uint32_t blockFrames);
+  ~Meter() {}
+
+  void input(const void *buf, uint32_t frameCount);
+  void output(const void *buf, uint32_t frameCount);
+  // count the frames of a callback - returns true when a reading is due
+  bool addFrames(uint32_t frameCount);
+
+  uint32_t readingBytes() const { return (mInChannels + mOutChannels) * 3 * sizeof(float); }
+  // write out the reading and start accumulating the next
+  void read(float *dst);
+
+private:
+  const uint32_t mInChannels;
+  const uint32_t mInFormat;
+  const uint32_t mOutChannels;
+  const uint32_t mOutFormat;
+  const uint32_t mIntervalFrames;
+  const uint32_t mBlockFrames;
+  uint32_t mFrames;
+  std::vector<float> mPeak;
+  std::vector<double> mSumSq;
+  std::vector<uint32_t> mClips;
+  std::vector<float> mBlockSumSq;
+  std::vector<float> mScratch;
+
+  void accumulate(const uint8_t *buf, uint32_t format, uint32_t channels, uint32_t frameCount, uint32_t first);
+};
+
+} // namespace streampunk
+
+#endif
@@ -0,0 +1,157 @@
+/* Copyright 2019 Streampunk Media Ltd.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#ifndef MIXER_H
+#define MIXER_H
+
+#include "node_api.h"
+#include "Chunks.h"
+#include <atomic>
+#include <memory>
+#include <mutex>
+
+namespace streampunk {
+
+class WavFile;
+
+// A stream of audio written to the output alongside the main stream, with a
+// queue and gain of its own. Gain changes are ramped across a callback buffer.
+// A source may play a mapped file in place of its queue. Played chunks wait on
+// the JS thread to be released like those of the main stream - writes to the
+// source hold back while two queues of them are unreleased, so the realtime
+// thread always has room to retire a chunk and never drops one.
+class MixSource {
+public:
+  MixSource(uint32_t id, uint32_t maxQueue, float gain, std::shared_ptr<WavFile> file)
+    : mId(id), mChunks(std::make_shared<Chunks>(maxQueue, 2 * maxQueue + 4)), mFile(file),
+      mGain(gain), mAppliedGain(gain), mRemoved(false), mDetached(false) {}
+  ~MixSource() {}
+
+  uint32_t id() const { return mId; }
+  std::shared_ptr<Chunks> chunks() const { return mChunks; }
+  WavFile *file() const { return mFile.get(); }
+  void setGain(float gain) { mGain.store(gain); }
+
+  // play out what has been written, then leave the mix
+  void end() { mChunks->quit(); }
+  // fade out and leave the mix at the next callback
+  void remove() { mRemoved = true; mChunks->quit(); }
+
+  // realtime thread only
+  bool removed() const { return mRemoved; }
+  float appliedGain() const { return mAppliedGain; }
+  float targetGain() const { return mRemoved ? 0.0f : mGain.load(); }
+  void setAppliedGain(float gain) { mAppliedGain = gain; }
+
+  bool detached() const { return mDetached; }
+  void setDetached() { mDetached = true; }
+
+private:
+  const uint32_t mId;
+  std::shared_ptr<Chunks> mChunks;
+  std::shared_ptr<WavFile> mFile;
+  std::atomic<float> mGain;
+  float mAppliedGain;
+  std::atomic<bool> mRemoved;
+  std::atomic<bool> mDetached;
+};
+
+// Sources are added and removed from the JS thread while the output runs. The
+// realtime thread sees each source through a slot holding a plain pointer and
+// clears the slot when it has finished with the source - the owning reference
+// is kept until then, so the callback never frees anything or takes a lock.
+class Mixer {
+public:
+  static const uint32_t maxSources = 32;
+
+  Mixer() : mNextId(1), mNumSources(0) {
+    for (uint32_t i = 0; i < maxSources; ++i)
+      mSlots[i].store(nullptr);
+  }
+  ~Mixer() {}
+
+  // returns the new source, or null if all slots are in use
+  std::shared_ptr<MixSource> add(uint32_t maxQueue, float gain,
+                                 std::shared_ptr<WavFile> file = std::shared_ptr<WavFile>()) {
+    std::lock_guard<std::mutex> lk(m);
+    for (uint32_t i = 0; i < maxSources; ++i) {
+      if (mOwned[i])
+        continue;
+      mOwned[i] = std::make_shared<MixSource>(mNextId++, maxQueue, gain, file);
+      mSlots[i].store(mOwned[i].get());
+      mNumSources++;
+      return mOwned[i];
+    }
+    return std::shared_ptr<MixSource>();
+  }
+
+  std::shared_ptr<MixSource> find(uint32_t id) {
+    std::lock_guard<std::mutex> lk(m);
+    for (uint32_t i = 0; i < maxSources; ++i)
+      if (mOwned[i] && (id == mOwned[i]->id()))
+        return mOwned[i];
+    return std::shared_ptr<MixSource>();
+  }
+
+  // Release played chunks on the JS thread, along with sources that have left the mix.
+  // With flush set the stream has stopped, so every source is released.
+  void release(napi_env env, bool flush) {
+    std::lock_guard<std::mutex> lk(m);
+    for (uint32_t i = 0; i < maxSources; ++i) {
+      if (!mOwned[i])
+        continue;
+      bool done = flush || mOwned[i]->detached();
+      std::shared_ptr<Chunks> chunks = mOwned[i]->chunks();
+      std::shared_ptr<Chunk> chunk;
+      bool more = true;
+      while (more) {
+        more = done && chunks->tryNext();
+        while (chunks->popDone(chunk)) {
+          chunk->release(env);
+          chunk.reset();
+        }
+      }
+      if (done) {
+        mOwned[i]->end();
+        if (!mOwned[i]->detached()) {
+          mSlots[i].store(nullptr);
+          mNumSources--;
+        }
+        mOwned[i].reset();
+      }
+    }
+  }
+
+  // realtime thread only
+  uint32_t numSources() const { return mNumSources.load(std::memory_order_relaxed); }
+  MixSource *slot(uint32_t i) const { return mSlots[i].load(std::memory_order_acquire); }
+  void detach(uint32_t i) {
+    MixSource *source = mSlots[i].load(std::memory_order_relaxed);
+    mSlots[i].store(nullptr);
+    mNumSources--;
+    source->setDetached();
+  }
+
+private:
+  std::atomic<MixSource *> mSlots[maxSources];
+  std::shared_ptr<MixSource> mOwned[maxSources];
+  uint32_t mNextId;
+  std::atomic<uint32_t> mNumSources;
+  std::mutex m;
+};
+
+} // namespace streampunk
+
+#endif
@@ -16,23 +16,116 @@
 #include "PaContext.h"
 #include "Params.h"
 #include "Chunks.h"
+#include "PaRuntime.h"
+#include "StreamStats.h"
+#include "Tracer.h"
+#include "SampleFormat.h"
+#include "Resampler.h"
+#include "ChannelRouter.h"
+#include "Mixer.h"
+#include "Fanout.h"
+#include "Meter.h"
+#include "Gate.h"
+#include "Gain.h"
+#include "WavWriter.h"
+#include "WavFile.h"
+#include "ClockEstimator.h"
+#include "RateControl.h"
 #include <portaudio.h>
 #include <thread>
+#include <chrono>
+#include <cmath>
 
 namespace streampunk {
 
+// Apply a linear gain ramp from startGain to endGain across the frames of an interleaved buffer
+static void scaleSamples(uint8_t *buf, uint32_t numBytes, uint32_t sampleFormat, uint32_t channels,
+                         float startGain, float endGain) {
+  uint32_t sampleBytes = (1 == sampleFormat) ? 4 : sampleFormat / 8;
+  uint32_t numFrames = numBytes / (sampleBytes * channels);
+  float gainInc = numFrames ? (endGain - startGain) / numFrames : 0.0f;
+  float gain = startGain;
+  for (uint32_t f = 0; f < numFrames; ++f) {
+    for (uint32_t c = 0; c < channels; ++c) {
+      switch (sampleFormat) {
+      case 1: { float *s = (float *)buf; *s *= gain; break; }
+      case 8: { int8_t *s = (int8_t *)buf; *s = (int8_t)(*s * gain); break; }
+      case 16: { int16_t *s = (int16_t *)buf; *s = (int16_t)(*s * gain); break; }
+      case 24: {
+        int32_t v = (int32_t)(((uint32_t)buf[0] << 8) | ((uint32_t)buf[1] << 16) | ((uint32_t)buf[2] << 24)) >> 8;
+        v = (int32_t)(v * gain);
+        buf[0] = (uint8_t)v; buf[1] = (uint8_t)(v >> 8); buf[2] = (uint8_t)(v >> 16);
+        break;
+      }
+      case 32: { int32_t *s = (int32_t *)buf; *s = (int32_t)(*s * (double)gain); break; }
+      default: break;
+      }
+      buf += sampleBytes;
+    }
+    gain += gainInc;
+  }
+}
+
+// capture pool block size used when the stream is opened with an unspecified framesPerBuffer
+static const uint32_t defaultPoolFrames = 2048;
+static const uint32_t meterBlockFrames = 256;
+
+// a channel map needs an entry for each stream channel, within the device channels
+static bool checkChannelMap(napi_env env, const AudioOptions &options, bool isInput) {
+  const ChannelMap &map = options.channelMap();
+  const char *err = nullptr;
+  if (!map.size()) {
+    if (options.deviceChannelCount() != options.channelCount())
+      err = "A deviceChannelCount different from the channelCount needs a channelMap";
+  } else if (map.size() != options.channelCount())
+    err = "The channelMap needs an entry for each of the channelCount channels";
+  else if (mapChannels(map) > options.deviceChannelCount())
+    err = "The channelMap refers to a channel beyond the deviceChannelCount";
+  else if (isInput && (map.end() != std::find_if(map.begin(), map.end(),
+                                                 [](const std::vector<uint32_t> &e) { return e.empty(); })))
+    err = "Each input channelMap entry needs at least one device channel";
+  if (err)
+    napi_throw_error(env, nullptr, err);
+  return !err;
+}
+
+static bool parseQuality(const std::string &quality, eResampleQuality &result) {
+  if (0 == quality.compare("low"))
+    result = eResampleQuality::LOW;
+  else if (0 == quality.compare("medium"))
+    result = eResampleQuality::MEDIUM;
+  else if (0 == quality.compare("high"))
+    result = eResampleQuality::HIGH;
+  else
+    return false;
+  return true;
+}
+
 int PaCallback(const void *input, void *output, unsigned long frameCount, 
                const PaStreamCallbackTimeInfo *timeInfo, 
                PaStreamCallbackFlags statusFlags, void *userData) {
   PaContext *paContext = (PaContext *)userData;
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  TraceScope trace(paContext->tracer(), "PaCallback", "audio callback");
+  double cbTime = paContext->clockCallback(frameCount,
+    std::chrono::duration<double>(start.time_since_epoch()).count(),
+    timeInfo->currentTime > 0.0 ? timeInfo->currentTime : paContext->getCurTime());
   double inTimestamp = timeInfo->inputBufferAdcTime > 0.0 ?
     timeInfo->inputBufferAdcTime :
-    paContext->getCurTime() - paContext->getInLatency(); // approximation for timestamp of first sample
-  double outTimestamp = timeInfo->outputBufferDacTime;
+    cbTime - paContext->getInLatency(); // approximation for timestamp of first sample
+  double outTimestamp = timeInfo->outputBufferDacTime > 0.0 ?
+    timeInfo->outputBufferDacTime :
+    cbTime + paContext->getOutLatency(); // approximation for the time the first sample plays
   paContext->checkStatus(statusFlags);
   // printf("PaCallback output %p, frameCount %d\n", output, frameCount);
   int inRetCode = paContext->hasInput() && paContext->readPaBuffer(input, frameCount, inTimestamp) ? paContinue : paComplete;
-  int outRetCode = paContext->hasOutput() && paContext->fillPaBuffer(output, frameCount) ? paContinue : paComplete;
+  int outRetCode = paContext->hasOutput() && paContext->fillPaBuffer(output, frameCount, outTimestamp) ? paContinue : paComplete;
+  if (paContext->hasMeter())
+    paContext->meterFrames(frameCount);
+  paContext->stats().callback(frameCount, statusFlags,
+    std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+  if (paContext->tracer())
+    trace.setDepth(paContext->inQueuedBytes(), paContext->outQueuedBytes());
   return ((inRetCode == paComplete) && (outRetCode == paComplete)) ? paComplete : paContinue;
 }
 
@@ -40,13 +133,19 @@ PaContext::PaContext(napi_env env, napi_value inOptions, napi_value outOptions)
   : mInOptions(checkOptions(env, inOptions) ? std::make_shared<AudioOptions>(env, inOptions) : std::shared_ptr<AudioOptions>()), 
     mOutOptions(checkOptions(env, outOptions) ? std::make_shared<AudioOptions>(env, outOptions) : std::shared_ptr<AudioOptions>()),
     mInChunks(new Chunks(mInOptions ? mInOptions->maxQueue() : 0)),
-    mOutChunks(new Chunks(mOutOptions ? mOutOptions->maxQueue() : 0)),
-    mStream(nullptr) {
+    // played chunks wait to be released on the JS thread - room for two queues of them keeps writes flowing
+    mOutChunks(new Chunks(mOutOptions ? mOutOptions->maxQueue() : 0,
+                          mOutOptions ? 2 * mOutOptions->maxQueue() + 4 : 0)),
+    mFanout(new Fanout),
+    mStream(nullptr), mStopped(false), mRunning(false), mStats(new StreamStats), mStatusFlags(0), mUnderrunPolicy(eUnderrunPolicy::SILENCE),
+    mLastOutBytes(0), mDeviceRate(0.0), mInBlockFrames(0), mOutStarted(false), mUnderrun(false), mUnderruns(0), mUnderrunFrames(0),
+    mOutReadTime(0.0), mLateFrames(0),
+    mOverflowPolicy(eOverflowPolicy::DROP_NEWEST), mInSeq(0), mInFrames(0), mOverflows(0), mDroppedFrames(0) {
 
-  PaError errCode = Pa_Initialize();
-  if (errCode != paNoError) {
-    std::string err = std::string("Could not initialize PortAudio: ") + Pa_GetErrorText(errCode);
-    napi_throw_error(env, nullptr, err.c_str());
+  std::string errStr;
+  mRuntime = PaRuntime::acquire(errStr);
+  if (!mRuntime) {
+    napi_throw_error(env, nullptr, errStr.c_str());
     return;
   }
 
@@ -55,11 +154,70 @@ PaContext::PaContext(napi_env env, napi_value inOptions, napi_value outOptions)
     return;
   }
 
-  if (mInOptions && mOutOptions &&
-      (mInOptions->sampleRate() != mOutOptions->sampleRate())) {
-    napi_throw_error(env, nullptr, "Input and Output sample rates must match");
+  // a duplex device runs at one rate - either side may set it, otherwise it is the input rate
+  if (mInOptions && mOutOptions && mInOptions->hasDeviceSampleRate() && mOutOptions->hasDeviceSampleRate() &&
+      (mInOptions->deviceSampleRate() != mOutOptions->deviceSampleRate())) {
+    napi_throw_error(env, nullptr, "Input and Output device sample rates must match");
+    return;
+  }
+  if (mInOptions && (mInOptions->hasDeviceSampleRate() || !mOutOptions || !mOutOptions->hasDeviceSampleRate()))
+    mDeviceRate = mInOptions->deviceSampleRate();
+  else
+    mDeviceRate = mOutOptions->deviceSampleRate();
+
+  if ((mInOptions && !checkChannelMap(env, *mInOptions, /*isInput*/true)) ||
+      (mOutOptions && !checkChannelMap(env, *mOutOptions, /*isInput*/false)))
+    return;
+
+  eResampleQuality inQuality = eResampleQuality::MEDIUM;
+  eResampleQuality outQuality = eResampleQuality::MEDIUM;
+  if ((mInOptions && !parseQuality(mInOptions->resampleQuality(), inQuality)) ||
+      (mOutOptions && !parseQuality(mOutOptions->resampleQuality(), outQuality))) {
+    napi_throw_error(env, nullptr, "Invalid resampleQuality - expected 'low', 'medium' or 'high'");
     return;
-  }    
+  }
+
+  if (mOutOptions) {
+    std::string underrunPolicy = mOutOptions->underrunPolicy();
+    if (0 == underrunPolicy.compare("silence"))
+      mUnderrunPolicy = eUnderrunPolicy::SILENCE;
+    else if (0 == underrunPolicy.compare("repeat"))
+      mUnderrunPolicy = eUnderrunPolicy::REPEAT;
+    else if (0 == underrunPolicy.compare("fade"))
+      mUnderrunPolicy = eUnderrunPolicy::FADE;
+    else {
+      napi_throw_error(env, nullptr, "Invalid underrunPolicy - expected 'silence', 'repeat' or 'fade'");
+      return;
+    }
+    if (mOutOptions->isAdaptive() && (mOutOptions->adaptiveMaxPpm() > Resampler::maxRatioScale * 1e6)) {
+      napi_throw_error(env, nullptr, "Invalid adaptiveMaxPpm - expected at most 10000");
+      return;
+    }
+  }
+
+  if (mInOptions) {
+    std::string overflowPolicy = mInOptions->overflowPolicy();
+    if (0 == overflowPolicy.compare("dropNewest"))
+      mOverflowPolicy = eOverflowPolicy::DROP_NEWEST;
+    else if (0 == overflowPolicy.compare("dropOldest"))
+      mOverflowPolicy = eOverflowPolicy::DROP_OLDEST;
+    else if (0 == overflowPolicy.compare("grow"))
+      mOverflowPolicy = eOverflowPolicy::GROW;
+    else {
+      napi_throw_error(env, nullptr, "Invalid overflowPolicy - expected 'dropNewest', 'dropOldest' or 'grow'");
+      return;
+    }
+
+    if (mInOptions->hasGate()) {
+      if ((mInOptions->gateThreshold() > 0.0) || (mInOptions->gateHysteresis() < 0.0)) {
+        napi_throw_error(env, nullptr, "Invalid gate options - expected a gateThreshold below 0 dBFS and a positive gateHysteresis");
+        return;
+      }
+      mGate = std::make_shared<Gate>(mInOptions->channelCount(), mInOptions->streamFormat(), mInOptions->sampleRate(),
+        mInOptions->gateThreshold(), mInOptions->gateHysteresis(), mInOptions->gateHold(),
+        mInOptions->gatePreRoll(), mInOptions->gateMaxZcr());
+    }
+  }
 
   printf("%s\n", Pa_GetVersionInfo()->versionText);
   if (mInOptions)
@@ -67,16 +225,16 @@ PaContext::PaContext(napi_env env, napi_value inOptions, napi_value outOptions)
   if (mOutOptions)
     printf("Output %s\n", mOutOptions->toString().c_str());
 
-  double sampleRate;
+  double sampleRate = mDeviceRate;
   PaStreamParameters inParams;
   memset(&inParams, 0, sizeof(PaStreamParameters));
   if (mInOptions)
-    setParams(env, /*isInput*/true, mInOptions, inParams, sampleRate);
+    setParams(env, /*isInput*/true, mInOptions, inParams);
 
   PaStreamParameters outParams;
   memset(&outParams, 0, sizeof(PaStreamParameters));
   if (mOutOptions)
-    setParams(env, /*isInput*/false, mOutOptions, outParams, sampleRate);
+    setParams(env, /*isInput*/false, mOutOptions, outParams);
 
   uint32_t framesPerBuffer = paFramesPerBufferUnspecified;
   #ifdef __arm__
@@ -87,7 +245,83 @@ PaContext::PaContext(napi_env env, napi_value inOptions, napi_value outOptions)
   if (!((0 == inFramesPerBuffer) && (0 == outFramesPerBuffer)))
     framesPerBuffer = std::max<uint32_t>(inFramesPerBuffer, outFramesPerBuffer);
 
-  errCode = Pa_IsFormatSupported(mInOptions ? &inParams : NULL, mOutOptions ? &outParams : NULL, sampleRate);
+  if (mInOptions) {
+    // capture blocks come from a pool that holds a full queue of callbacks plus
+    // the block being read and a spare, so the callback does not allocate - each reader,
+    // and the recorder with its longer queue, adds the blocks for its own queue as it is made
+    // PortAudio delivers exactly framesPerBuffer when it is set - otherwise callbacks are sized by the
+    // host, up to its buffering. A callback with more frames than a block is captured into as many as it takes.
+    uint32_t poolFrames = framesPerBuffer ? framesPerBuffer :
+      std::max<uint32_t>(defaultPoolFrames, (uint32_t)std::ceil(inParams.suggestedLatency * mDeviceRate));
+    mInBlockFrames = poolFrames;
+    if (mInOptions->sampleRate() != mDeviceRate) {
+      mInResampler = std::make_shared<Resampler>(mInOptions->channelCount(), mDeviceRate,
+                                                 mInOptions->sampleRate(), inQuality, poolFrames);
+      poolFrames = mInResampler->maxOutputFrames(poolFrames);
+    }
+    uint32_t chunkBytes = poolFrames * mInOptions->channelCount() * mInOptions->streamBits() / 8;
+    uint32_t maxReserved = Fanout::maxReaders * (mInOptions->maxQueue() + 1) + WavWriter::maxQueue;
+    uint32_t extraChunks = 0;
+    if (eOverflowPolicy::GROW == mOverflowPolicy) {
+      // the queue may grow past maxQueue, up to maxQueueBytes, with blocks reserved in the pool for it
+      uint32_t maxChunks = (mInOptions->maxQueueBytes() + chunkBytes - 1) / chunkBytes;
+      extraChunks += maxChunks;
+      mInChunks = std::make_shared<Chunks>(std::max<uint32_t>(maxChunks, mInOptions->maxQueue()));
+    }
+    mInPool = ChunkPool::makeNew(mInOptions->maxQueue() + 2, chunkBytes, extraChunks, maxReserved);
+  }
+
+  if (mOutOptions && (eUnderrunPolicy::SILENCE != mUnderrunPolicy)) {
+    // the last buffer played is kept to repeat or fade out from on underrun
+    uint32_t lastFrames = framesPerBuffer ? framesPerBuffer : defaultPoolFrames;
+    mLastOut.resize(lastFrames * mOutOptions->deviceChannelCount() * mOutOptions->deviceBits() / 8);
+  }
+
+  if (mOutOptions && ((mOutOptions->streamFormat() != mOutOptions->deviceFormat()) ||
+                       (mOutOptions->sampleRate() != mDeviceRate) || mOutOptions->isAdaptive())) {
+    // written data is gathered here in stream format before conversion into the device buffer
+    uint32_t scratchFrames = framesPerBuffer ? framesPerBuffer : defaultPoolFrames;
+    // an adaptive output is resampled even at the device rate, to follow the clock of the writer
+    if ((mOutOptions->sampleRate() != mDeviceRate) || mOutOptions->isAdaptive()) {
+      uint32_t inFrames = (uint32_t)std::ceil(scratchFrames * (double)mOutOptions->sampleRate() / mDeviceRate);
+      mOutResampler = std::make_shared<Resampler>(mOutOptions->channelCount(), mOutOptions->sampleRate(),
+                                                  mDeviceRate, outQuality, inFrames);
+      scratchFrames = mOutResampler->maxInputFrames(scratchFrames);
+      if (mOutOptions->isAdaptive())
+        mRateControl = std::make_shared<RateControl>(mOutOptions->adaptiveLatency() / 1000.0, mOutOptions->adaptiveMaxPpm());
+    }
+    mOutScratch.resize(scratchFrames * mOutOptions->channelCount() * mOutOptions->streamBits() / 8);
+  }
+
+  // routing between the device and stream channels runs in the device format, a block at a time
+  uint32_t routeFrames = framesPerBuffer ? framesPerBuffer : defaultPoolFrames;
+  if (mOutOptions) {
+    // mix sources are summed as float in the stream format, a block at a time
+    uint32_t mixBlockSamples = routeFrames * mOutOptions->channelCount();
+    mMixer = std::make_shared<Mixer>();
+    mMixAcc.resize(mixBlockSamples);
+    mMixFloat.resize(mixBlockSamples);
+    mMixBlock.resize(mixBlockSamples * mOutOptions->streamBits() / 8);
+  }
+  // gain is applied to captured blocks in the stream format, and to played buffers in the device format
+  if (mInOptions)
+    mInGain = std::make_shared<GainRamp>(mInOptions->streamFormat(), mInOptions->channelCount(), routeFrames);
+  if (mOutOptions)
+    mOutGain = std::make_shared<GainRamp>(mOutOptions->deviceFormat(), mOutOptions->deviceChannelCount(), routeFrames);
+  if (mInOptions && mInOptions->channelMap().size()) {
+    mInRouter = std::make_shared<ChannelRouter>(mInOptions->deviceChannelCount(), mInOptions->channelCount(),
+      ChannelRouter::captureGains(mInOptions->channelMap(), mInOptions->deviceChannelCount()),
+      mInOptions->deviceFormat(), routeFrames);
+    mInRouted.resize(routeFrames * mInOptions->channelCount() * mInOptions->deviceBits() / 8);
+  }
+  if (mOutOptions && mOutOptions->channelMap().size()) {
+    mOutRouter = std::make_shared<ChannelRouter>(mOutOptions->channelCount(), mOutOptions->deviceChannelCount(),
+      ChannelRouter::playbackGains(mOutOptions->channelMap(), mOutOptions->deviceChannelCount()),
+      mOutOptions->deviceFormat(), routeFrames);
+    mOutRouted.resize(routeFrames * mOutOptions->channelCount() * mOutOptions->deviceBits() / 8);
+  }
+
+  PaError errCode = Pa_IsFormatSupported(mInOptions ? &inParams : NULL, mOutOptions ? &outParams : NULL, sampleRate);
   if (errCode != paFormatIsSupported) {
     std::string err = std::string("Format not supported: ") + Pa_GetErrorText(errCode);
     napi_throw_error(env, nullptr, err.c_str());
@@ -107,51 +341,200 @@ PaContext::PaContext(napi_env env, napi_value inOptions, napi_value outOptions)
 
   const PaStreamInfo *streamInfo = Pa_GetStreamInfo(mStream);
   mInLatency = streamInfo->inputLatency;
+  mOutLatency = streamInfo->outputLatency;
+  mClock = std::make_shared<ClockEstimator>(streamInfo->sampleRate > 0.0 ? streamInfo->sampleRate : sampleRate);
 }
 
 void PaContext::start(napi_env env) {
+  mRunning = true;
+  if (mInPool)
+    mInPool->setRunning(true);
   PaError errCode = Pa_StartStream(mStream);
   if (errCode != paNoError) {
+    mRunning = false;
+    if (mInPool)
+      mInPool->setRunning(false);
     std::string err = std::string("Could not start stream: ") + Pa_GetErrorText(errCode);
     napi_throw_error(env, nullptr, err.c_str());
     return;
   }
 }
 
+// Only the first call stops the stream - quit may run again when a writable stream finishes
 void PaContext::stop(eStopFlag flag) {
+  if (mStopped.exchange(true))
+    return;
   if (eStopFlag::ABORT == flag)
     Pa_AbortStream(mStream);
   else
     Pa_StopStream(mStream);
+  mRunning = false;
+  if (mInPool)
+    mInPool->setRunning(false);
+  std::lock_guard<std::mutex> lk(mStreamMutex);
   Pa_CloseStream(mStream);
-  Pa_Terminate();
+  mStream = nullptr;
+  mRuntime.reset();
 }
 
+// Returns a view of the next captured block, or as much of it as was asked for,
+// sharing the block's memory rather than copying it
 std::shared_ptr<Chunk> PaContext::pullInChunk(uint32_t numBytes, bool &finished) {
-  std::shared_ptr<Memory> result = Memory::makeNew(numBytes);
-  finished = false;
-  double timeStamp = 0.0;
-  uint32_t bytesRead = fillBuffer(result->buf(), numBytes, timeStamp, mInChunks, finished, /*isInput*/true);
-  if (bytesRead != numBytes) {
-    if (0 == bytesRead)
-      result = std::shared_ptr<Memory>();
-    else {
-      std::shared_ptr<Memory> trimResult = Memory::makeNew(bytesRead);
-      memcpy(trimResult->buf(), result->buf(), bytesRead);
-      result = trimResult;
-    }
+  std::shared_ptr<Chunk> chunk;
+  if (!mGate)
+    chunk = pullChunk(*mInChunks, numBytes);
+  else {
+    // gated blocks are whole frames that stay within a gate window, and are held back while it is closed
+    uint32_t frameBytes = mGate->frameBytes();
+    numBytes = std::max<uint32_t>(frameBytes, numBytes - numBytes % frameBytes);
+    do
+      chunk = pullChunk(*mInChunks, std::min<uint32_t>(numBytes, mGate->windowBytesLeft()));
+    while (chunk && !mGate->pass(chunk));
+  }
+  finished = !chunk;
+  if (finished) {
+    printf("Finishing input - no more data available\n");
+    return std::make_shared<Chunk>();
+  }
+  return chunk;
+}
+
+std::shared_ptr<CaptureReader> PaContext::addReader(uint32_t maxQueue, bool dropOldest) {
+  // reader queues share the pool, which only has headroom for queues up to the stream's own length
+  maxQueue = std::min<uint32_t>(maxQueue ? maxQueue : mInOptions->maxQueue(), mInOptions->maxQueue());
+  return mFanout->add(maxQueue, dropOldest, mInOptions->channelCount() * mInOptions->streamBits() / 8,
+                      mInPool, maxQueue + 1);
+}
+
+std::shared_ptr<CaptureReader> PaContext::findReader(uint32_t id) {
+  return mFanout->find(id);
+}
+
+void PaContext::closeReader(uint32_t id) {
+  mFanout->close(id, /*detach*/!mRunning);
+}
+
+std::shared_ptr<Chunk> PaContext::pullReaderChunk(std::shared_ptr<CaptureReader> reader, uint32_t numBytes, bool &finished) {
+  std::shared_ptr<Chunk> chunk = pullChunk(*reader->chunks(), numBytes);
+  finished = !chunk;
+  return finished ? std::make_shared<Chunk>() : chunk;
+}
+
+std::shared_ptr<WavWriter> PaContext::recordTo(const std::string &path, uint64_t preallocBytes, uint32_t headerMs, std::string &errStr) {
+  // the writer's queue is longer than a reader's, to ride out slow writes - its blocks are added to the pool now
+  std::shared_ptr<CaptureReader> reader = mFanout->add(WavWriter::maxQueue, /*dropOldest*/false,
+                                                       mInOptions->channelCount() * mInOptions->streamBits() / 8,
+                                                       mInPool, WavWriter::maxQueue);
+  if (!reader) {
+    errStr = "the maximum number of readers are in use";
+    return std::shared_ptr<WavWriter>();
+  }
+  std::shared_ptr<WavWriter> writer = std::make_shared<WavWriter>(reader, mInOptions->streamFormat(),
+    mInOptions->channelCount(), mInOptions->sampleRate(), preallocBytes, headerMs);
+  if (!writer->open(path, errStr)) {
+    mFanout->close(reader->id(), /*detach*/!mRunning);
+    return std::shared_ptr<WavWriter>();
+  }
+  return writer;
+}
+
+// blocking - returns a view of the current block of a capture queue, or null once the queue has finished
+std::shared_ptr<Chunk> PaContext::pullChunk(Chunks &chunks, uint32_t numBytes) {
+  if (!chunks.curBuf() || (chunks.curBytes() == chunks.curOffset())) {
+    chunks.waitNext();
+    if (!chunks.curBuf())
+      return std::shared_ptr<Chunk>();
   }
 
-  return std::make_shared<Chunk>(result, timeStamp);
+  uint32_t offset = chunks.curOffset();
+  uint32_t bytes = std::min<uint32_t>(numBytes, chunks.curBytes() - offset);
+  // offset the chunk timestamp and frame index by the chunk offset
+  uint32_t offsetFrames = offset / (mInOptions->channelCount() * mInOptions->streamBits() / 8);
+  std::shared_ptr<Chunk> chunk = std::make_shared<Chunk>(chunks.curChunk(), offset, bytes,
+    chunks.curTs() + (double)offsetFrames / mInOptions->sampleRate(), chunks.curFrame() + offsetFrames);
+  chunks.incOffset(bytes);
+
+  if (chunks.curDiscontinuity()) {
+    chunk->setDiscontinuity(true);
+    chunks.clearDiscontinuity();
+  }
+  return chunk;
 }
 
 void PaContext::pushOutChunk(std::shared_ptr<Chunk> chunk) {
   mOutChunks->push(chunk);
+  mStats->outQueued(mOutChunks->queuedBytes(), mOutChunks->queuedChunks());
+}
+
+bool PaContext::copyWrites() const {
+  return mOutOptions ? mOutOptions->copyWrites() : true;
+}
+
+int64_t PaContext::inQueuedBytes() const {
+  return mInOptions ? std::max<int64_t>(0, mInChunks->queuedBytes()) : -1;
+}
+
+int64_t PaContext::outQueuedBytes() const {
+  return mOutOptions ? std::max<int64_t>(0, mOutChunks->queuedBytes()) : -1;
+}
+
+bool PaContext::pushMode() const {
+  return mInOptions ? mInOptions->pushMode() : false;
+}
+
+std::shared_ptr<MixSource> PaContext::addSource(float gain) {
+  return mMixer ? mMixer->add(mOutOptions->maxQueue(), gain) : std::shared_ptr<MixSource>();
+}
+
+std::shared_ptr<MixSource> PaContext::findSource(uint32_t id) {
+  return mMixer ? mMixer->find(id) : std::shared_ptr<MixSource>();
+}
+
+std::shared_ptr<MixSource> PaContext::playFile(const std::string &path, float gain, std::string &errStr) {
+  std::shared_ptr<WavFile> file = std::make_shared<WavFile>();
+  if (!file->open(path, errStr))
+    return std::shared_ptr<MixSource>();
+  // samples are converted as they are mixed, but the channels and rate are played as they are
+  if ((file->channels() != mOutOptions->channelCount()) || (file->sampleRate() != mOutOptions->sampleRate())) {
+    errStr = path + " has " + std::to_string(file->channels()) + " channels at " + std::to_string(file->sampleRate()) +
+             "Hz, the stream has " + std::to_string(mOutOptions->channelCount()) + " at " + std::to_string(mOutOptions->sampleRate()) + "Hz";
+    return std::shared_ptr<MixSource>();
+  }
+  std::shared_ptr<MixSource> source = mMixer->add(mOutOptions->maxQueue(), gain, file);
+  if (!source)
+    errStr = "the maximum number of mix sources are in use";
+  return source;
+}
+
+// Played chunks are released here on the JS thread, dropping any reference to the
+// JS buffer that was written. Flush also releases chunks not yet played and must
+// only be used once the stream has stopped.
+void PaContext::releaseOutChunks(napi_env env, bool flush) {
+  if (!mOutOptions)
+    return;
+  if (mMixer)
+    mMixer->release(env, flush);
+  std::shared_ptr<Chunk> chunk;
+  bool more = true;
+  while (more) {
+    more = flush && mOutChunks->tryNext();
+    while (mOutChunks->popDone(chunk)) {
+      chunk->release(env);
+      chunk.reset();
+    }
+  }
 }
 
 void PaContext::checkStatus(uint32_t statusFlags) {
+  if (statusFlags)
+    mStatusFlags.fetch_or(statusFlags, std::memory_order_relaxed);
+}
+
+bool PaContext::getErrStr(std::string& errStr, bool isInput) {
+  uint32_t statusFlags = mStatusFlags.exchange(0, std::memory_order_relaxed);
+  std::string err;
   if (statusFlags) {
-    std::string err = std::string("portAudio status - ");
+    err = std::string("portAudio status - ");
     if (statusFlags & paInputUnderflow)
       err += "input underflow ";
     if (statusFlags & paInputOverflow)
@@ -162,75 +545,377 @@ void PaContext::checkStatus(uint32_t statusFlags) {
       err += "output overflow ";
     if (statusFlags & paPrimingOutput)
       err += "priming output ";
-
-    std::lock_guard<std::mutex> lk(m);
-    mErrStr = err;
   }
-}
 
-bool PaContext::getErrStr(std::string& errStr, bool isInput) {
-  std::lock_guard<std::mutex> lk(m);
   std::shared_ptr<AudioOptions> options = isInput ? mInOptions : mOutOptions;
   if (options->closeOnError()) // propagate the error back to the stream handler
-    errStr = mErrStr;
-  else if (mErrStr.length())
-    printf("AudioIO: %s\n", mErrStr.c_str());
-  mErrStr.clear();
+    errStr = err;
+  else if (err.length())
+    printf("AudioIO: %s\n", err.c_str());
   return !errStr.empty();
 }
 
+static napi_status setQueueStats(napi_env env, napi_value target, const char *name,
+                                 std::shared_ptr<Chunks> chunks, uint64_t peakBytes, uint64_t peakChunks) {
+  napi_status status;
+  napi_value queue;
+  status = napi_create_object(env, &queue);
+  PASS_STATUS;
+  status = naud_set_int64(env, queue, "bytes", std::max<int64_t>(0, chunks->queuedBytes()));
+  PASS_STATUS;
+  status = naud_set_int64(env, queue, "chunks", chunks->queuedChunks());
+  PASS_STATUS;
+  status = naud_set_int64(env, queue, "peakBytes", peakBytes);
+  PASS_STATUS;
+  status = naud_set_int64(env, queue, "peakChunks", peakChunks);
+  PASS_STATUS;
+  return napi_set_named_property(env, target, name, queue);
+}
+
+// Snapshot of the stream counters - callback durations are in microseconds
+napi_status PaContext::getStats(napi_env env, napi_value *result) {
+  napi_status status;
+  napi_value xruns, callbackTime;
+  const DurationHistogram &duration = mStats->duration();
+
+  status = napi_create_object(env, result);
+  PASS_STATUS;
+  status = naud_set_int64(env, *result, "callbacks", mStats->callbacks());
+  PASS_STATUS;
+  status = naud_set_int64(env, *result, "framesProcessed", mStats->frames());
+  PASS_STATUS;
+
+  status = napi_create_object(env, &xruns);
+  PASS_STATUS;
+  status = naud_set_int64(env, xruns, "inputUnderflow", mStats->inputUnderflows());
+  PASS_STATUS;
+  status = naud_set_int64(env, xruns, "inputOverflow", mStats->inputOverflows());
+  PASS_STATUS;
+  status = naud_set_int64(env, xruns, "outputUnderflow", mStats->outputUnderflows());
+  PASS_STATUS;
+  status = naud_set_int64(env, xruns, "outputOverflow", mStats->outputOverflows());
+  PASS_STATUS;
+  status = naud_set_int64(env, xruns, "primingOutput", mStats->primingOutputs());
+  PASS_STATUS;
+  status = napi_set_named_property(env, *result, "xruns", xruns);
+  PASS_STATUS;
+
+  if (mInOptions) {
+    status = setQueueStats(env, *result, "inQueue", mInChunks, mStats->inPeakBytes(), mStats->inPeakChunks());
+    PASS_STATUS;
+    status = naud_set_int64(env, *result, "overflows", mOverflows);
+    PASS_STATUS;
+    status = naud_set_int64(env, *result, "droppedFrames", mDroppedFrames);
+    PASS_STATUS;
+
+    std::vector<std::shared_ptr<CaptureReader> > readers = mFanout->readers();
+    napi_value readerStats;
+    status = napi_create_array_with_length(env, readers.size(), &readerStats);
+    PASS_STATUS;
+    for (size_t i = 0; i < readers.size(); ++i) {
+      napi_value reader;
+      status = napi_create_object(env, &reader);
+      PASS_STATUS;
+      status = naud_set_int64(env, reader, "id", readers[i]->id());
+      PASS_STATUS;
+      status = naud_set_int64(env, reader, "bytes", std::max<int64_t>(0, readers[i]->chunks()->queuedBytes()));
+      PASS_STATUS;
+      status = naud_set_int64(env, reader, "chunks", readers[i]->chunks()->queuedChunks());
+      PASS_STATUS;
+      status = naud_set_int64(env, reader, "overflows", readers[i]->overflows());
+      PASS_STATUS;
+      status = naud_set_int64(env, reader, "droppedFrames", readers[i]->droppedFrames());
+      PASS_STATUS;
+      status = napi_set_element(env, readerStats, (uint32_t)i, reader);
+      PASS_STATUS;
+    }
+    status = napi_set_named_property(env, *result, "readers", readerStats);
+    PASS_STATUS;
+  }
+  if (mOutOptions) {
+    status = setQueueStats(env, *result, "outQueue", mOutChunks, mStats->outPeakBytes(), mStats->outPeakChunks());
+    PASS_STATUS;
+    status = naud_set_int64(env, *result, "underruns", mUnderruns);
+    PASS_STATUS;
+    status = naud_set_int64(env, *result, "underrunFrames", mUnderrunFrames);
+    PASS_STATUS;
+    status = naud_set_int64(env, *result, "lateFrames", mLateFrames);
+    PASS_STATUS;
+    if (mRateControl) {
+      napi_value adaptive;
+      status = napi_create_object(env, &adaptive);
+      PASS_STATUS;
+      status = naud_set_double(env, adaptive, "ppm", mRateControl->ppm());
+      PASS_STATUS;
+      status = naud_set_double(env, adaptive, "latency", mRateControl->depth() * 1000.0);
+      PASS_STATUS;
+      status = naud_set_double(env, adaptive, "latencyError", (mRateControl->depth() - mRateControl->target()) * 1000.0);
+      PASS_STATUS;
+      status = napi_set_named_property(env, *result, "adaptive", adaptive);
+      PASS_STATUS;
+    }
+  }
+
+  status = napi_create_object(env, &callbackTime);
+  PASS_STATUS;
+  status = naud_set_double(env, callbackTime, "min", duration.minNs() / 1000.0);
+  PASS_STATUS;
+  status = naud_set_double(env, callbackTime, "avg", duration.avgNs() / 1000.0);
+  PASS_STATUS;
+  status = naud_set_double(env, callbackTime, "max", duration.maxNs() / 1000.0);
+  PASS_STATUS;
+  status = naud_set_double(env, callbackTime, "p99", duration.percentileNs(0.99) / 1000.0);
+  PASS_STATUS;
+  status = napi_set_named_property(env, *result, "callbackTime", callbackTime);
+  PASS_STATUS;
+
+  double cpuLoad = 0.0;
+  {
+    std::lock_guard<std::mutex> lk(mStreamMutex);
+    if (mStream)
+      cpuLoad = Pa_GetStreamCpuLoad(mStream);
+  }
+  return naud_set_double(env, *result, "cpuLoad", cpuLoad);
+}
+
 void PaContext::quit() {
-  if (mInOptions)
+  if (mInOptions) {
     mInChunks->quit();
+    mFanout->end();
+  }
   if (mOutOptions) {
     mOutChunks->quit();
-    mOutChunks->waitDone();
+    bool active = false;
+    {
+      std::lock_guard<std::mutex> lk(mStreamMutex);
+      active = mStream && (1 == Pa_IsStreamActive(mStream));
+    }
+    if (active)
+      mOutChunks->waitDone();
   }
+  if (mMeterChunks)
+    mMeterChunks->quit();
   // wait for next PaCallback to run
   std::this_thread::sleep_for(std::chrono::milliseconds(20));
 }
 
 bool PaContext::readPaBuffer(const void *srcBuf, uint32_t frameCount, double inTimestamp) {
-  uint32_t bytesAvailable = frameCount * mInOptions->channelCount() * mInOptions->sampleBits() / 8;
-  std::shared_ptr<Memory> chunk = Memory::makeNew(bytesAvailable);
-  memcpy(chunk->buf(), srcBuf, bytesAvailable);
-  mInChunks->push(std::make_shared<Chunk>(chunk, inTimestamp));
+  if (mMeter)
+    mMeter->input(srcBuf, frameCount);
+  uint32_t srcFrameBytes = mInOptions->deviceChannelCount() * mInOptions->deviceBits() / 8;
+  for (uint32_t f = 0; f < frameCount; f += mInBlockFrames)
+    captureBlock((const uint8_t *)srcBuf + f * srcFrameBytes, std::min<uint32_t>(mInBlockFrames, frameCount - f),
+                 inTimestamp + f / mDeviceRate);
+  mStats->inQueued(mInChunks->queuedBytes(), mInChunks->queuedChunks());
   return true;
 }
 
-bool PaContext::fillPaBuffer(void *dstBuf, uint32_t frameCount) {
-  uint32_t bytesRemaining = frameCount * mOutOptions->channelCount() * mOutOptions->sampleBits() / 8;
+// Captures at most mInBlockFrames device frames into a block from the pool and queues it.
+// The callback never allocates - if no block is free the audio is dropped and counted.
+void PaContext::captureBlock(const uint8_t *srcBuf, uint32_t frameCount, double inTimestamp) {
+  uint32_t outFrames = mInResampler ? mInResampler->outputFrames(frameCount) : frameCount;
+  uint32_t bytesAvailable = outFrames * mInOptions->channelCount() * mInOptions->streamBits() / 8;
+  if (mInResampler) // timestamp the first frame out of the filter
+    inTimestamp += mInResampler->nextOutputOffset() / mDeviceRate;
+  uint64_t seq = ++mInSeq; // every block is numbered, so dropped blocks leave a gap
+  uint64_t frame = mInFrames; // as is every frame, so the index stays in step with the stream
+  mInFrames += outFrames;
+  bool grow = eOverflowPolicy::GROW == mOverflowPolicy;
+  // a stream queue over its limit misses the block, but readers may still take it
+  bool overLimit = grow && (mInChunks->queuedBytes() + bytesAvailable > mInOptions->maxQueueBytes());
+  if (overLimit)
+    dropInput(bytesAvailable);
+
+  std::shared_ptr<Chunk> chunk;
+  if (!overLimit || mFanout->numReaders())
+    chunk = mInPool->acquire(bytesAvailable, inTimestamp);
+  if (!chunk) {
+    // over the limit, or the pool is exhausted - the readers have fallen behind and the queues are full
+    if (!overLimit)
+      dropInput(bytesAvailable);
+    if (mInResampler) // the filter starts again after the gap
+      mInResampler->reset();
+    return;
+  }
+  chunk->setSeq(seq);
+  chunk->setFrame(frame);
+  captureFrames(srcBuf, frameCount, chunk->buf(), outFrames);
+  mInGain->apply(chunk->buf(), outFrames);
+  fanOut(chunk);
+
+  // never block the callback - if the reader has fallen behind a block is dropped
+  if (overLimit)
+    mInPool->putBack(std::move(chunk));
+  else if (eOverflowPolicy::DROP_OLDEST == mOverflowPolicy) {
+    std::shared_ptr<Chunk> dropped;
+    bool pushed = mInChunks->tryPushOverwrite(chunk, dropped);
+    if (dropped) {
+      dropInput(dropped->numBytes());
+      mInPool->putBack(std::move(dropped));
+    }
+    if (!pushed) {
+      dropInput(bytesAvailable);
+      mInPool->putBack(std::move(chunk));
+    }
+  } else if (!mInChunks->tryPush(chunk)) {
+    dropInput(bytesAvailable);
+    mInPool->putBack(std::move(chunk));
+  }
+}
+
+// Offer a captured block to each reader, letting go of readers that have closed
+void PaContext::fanOut(const std::shared_ptr<Chunk> &chunk) {
+  uint32_t numReaders = mFanout->numReaders();
+  for (uint32_t i = 0; numReaders && (i < Fanout::maxReaders); ++i) {
+    CaptureReader *reader = mFanout->slot(i);
+    if (!reader)
+      continue;
+    numReaders--;
+    if (reader->closed())
+      mFanout->detach(i);
+    else
+      reader->offer(chunk, *mInPool);
+  }
+}
+
+bool PaContext::fillPaBuffer(void *dstBuf, uint32_t frameCount, double outTimestamp) {
+  uint32_t bytesRemaining = frameCount * mOutOptions->deviceChannelCount() * mOutOptions->deviceBits() / 8;
+  uint8_t *buf = (uint8_t *)dstBuf;
   bool finished = false;
-  double timeStamp = 0.0;
-  fillBuffer((uint8_t *)dstBuf, bytesRemaining, timeStamp, mOutChunks, finished, /*isInput*/false);
-  return !finished;
+  uint32_t bytesRead;
+  // the time the next stream frame read will play - the resampler holds back the frames in its filter
+  mOutReadTime = outTimestamp;
+  if (mOutResampler)
+    mOutReadTime -= mOutResampler->nextOutputOffset() / mOutOptions->sampleRate();
+  if (mRateControl && mOutStarted)
+    steerRate(frameCount);
+  {
+    TraceScope trace(mTracer.get(), "fillBuffer", "audio callback");
+    bytesRead = mOutRouter ? fillRouted(buf, frameCount, finished) : fillStream(buf, frameCount, finished);
+  }
+  if (finished)
+    return false;
+
+  if (bytesRead) {
+    if (mUnderrun && (eUnderrunPolicy::FADE == mUnderrunPolicy)) // fade back in after an underrun
+      scaleSamples(buf, bytesRead, mOutOptions->deviceFormat(), mOutOptions->deviceChannelCount(), 0.0f, 1.0f);
+    mOutStarted = true;
+    mUnderrun = false;
+  }
+
+  if (bytesRead < bytesRemaining)
+    fillUnderrun(buf, bytesRead, bytesRemaining - bytesRead);
+  else if (mLastOut.size()) {
+    mLastOutBytes = std::min<uint32_t>(bytesRemaining, mLastOut.size());
+    memcpy(mLastOut.data(), buf, mLastOutBytes);
+  }
+  mOutGain->apply(buf, frameCount);
+  if (mMeter)
+    mMeter->output(buf, frameCount);
+  return true;
+}
+
+// Sets the resampling ratio for the next buffer from the depth of the output queue
+void PaContext::steerRate(uint32_t frameCount) {
+  uint32_t frameBytes = mOutOptions->channelCount() * mOutOptions->streamBits() / 8;
+  int64_t queuedBytes = std::max<int64_t>(0, mOutChunks->queuedBytes()) + mOutChunks->curBytes() - mOutChunks->curOffset();
+  double depth = (double)(queuedBytes / frameBytes) / mOutOptions->sampleRate();
+  mOutResampler->setRatioScale(mRateControl->update(depth, frameCount / mDeviceRate));
+}
+
+void PaContext::setGain(bool isInput, float gain, uint32_t rampMs) {
+  if (isInput && mInGain)
+    mInGain->set(gain, (uint32_t)((uint64_t)rampMs * mInOptions->sampleRate() / 1000));
+  else if (!isInput && mOutGain)
+    mOutGain->set(gain, (uint32_t)(rampMs * mDeviceRate / 1000.0));
+}
+
+void PaContext::setMeter(uint32_t intervalMs) {
+  uint32_t inChannels = mInOptions ? mInOptions->deviceChannelCount() : 0;
+  uint32_t outChannels = mOutOptions ? mOutOptions->deviceChannelCount() : 0;
+  mMeter = std::make_shared<Meter>(inChannels, mInOptions ? mInOptions->deviceFormat() : 1,
+                                   outChannels, mOutOptions ? mOutOptions->deviceFormat() : 1,
+                                   (uint32_t)(intervalMs * mDeviceRate / 1000.0), meterBlockFrames);
+  // a few readings may wait for JS - after that readings are dropped rather than delaying the callback
+  const uint32_t maxReadings = 4;
+  mMeterPool = ChunkPool::makeNew(maxReadings + 2, mMeter->readingBytes());
+  mMeterChunks = std::make_shared<Chunks>(maxReadings);
+}
+
+void PaContext::meterFrames(uint32_t frameCount) {
+  if (!mMeter->addFrames(frameCount))
+    return;
+  std::shared_ptr<Chunk> chunk = mMeterPool->acquire(mMeter->readingBytes(), 0.0);
+  if (!chunk)
+    return; // the pool is exhausted - this interval is added to the next
+  mMeter->read((float *)chunk->buf());
+  if (!mMeterChunks->tryPush(chunk))
+    mMeterPool->putBack(std::move(chunk));
+}
+
+bool PaContext::pullMeter(std::vector<float> &levels) {
+  mMeterChunks->waitNext();
+  if (!mMeterChunks->curBuf())
+    return false;
+  const float *reading = (const float *)mMeterChunks->curBuf();
+  levels.assign(reading, reading + mMeterChunks->curBytes() / sizeof(float));
+  return true;
 }
 
 double PaContext::getCurTime() const  { 
   return Pa_GetStreamTime(mStream);
 }
 
+double PaContext::clockCallback(uint32_t frameCount, double systemTime, double streamTime) {
+  return mClock ? mClock->callback(frameCount, systemTime, streamTime) : streamTime;
+}
+
+napi_status PaContext::getClock(napi_env env, napi_value *result) {
+  napi_status status;
+  ClockEstimator::Estimate estimate = mClock ? mClock->estimate() : ClockEstimator::Estimate();
+  status = napi_create_object(env, result);
+  PASS_STATUS;
+  status = naud_set_double(env, *result, "sampleRate", estimate.sampleRate);
+  PASS_STATUS;
+  status = naud_set_double(env, *result, "ppm", estimate.ppm);
+  PASS_STATUS;
+  status = naud_set_double(env, *result, "jitter", estimate.jitter * 1000.0);
+  PASS_STATUS;
+  status = naud_set_double(env, *result, "offset", estimate.offset);
+  PASS_STATUS;
+  status = naud_set_bool(env, *result, "locked", estimate.locked);
+  PASS_STATUS;
+  return naud_set_int64(env, *result, "resets", estimate.resets);
+}
+
+double PaContext::toSystemTime(double streamTime) const {
+  return mClock ? mClock->toSystemTime(streamTime) : streamTime;
+}
+
+double PaContext::fromSystemTime(double systemTime) const {
+  return mClock ? mClock->toStreamTime(systemTime) : systemTime;
+}
+
+double PaContext::getStreamTime() {
+  std::lock_guard<std::mutex> lk(mStreamMutex);
+  return mStream ? Pa_GetStreamTime(mStream) : 0.0;
+}
+
 // private
-uint32_t PaContext::fillBuffer(uint8_t *buf, uint32_t numBytes, double &timeStamp,
-                               std::shared_ptr<Chunks> chunks,
-                               bool &finished, bool isInput) {
+uint32_t PaContext::fillBuffer(uint8_t *buf, uint32_t numBytes,
+                               std::shared_ptr<Chunks> chunks, bool &finished) {
   uint32_t bufOff = 0;
-  timeStamp = 0.0;
   while (numBytes) {
     if (!chunks->curBuf() || (chunks->curBuf() && (chunks->curBytes() == chunks->curOffset()))) {
-      chunks->waitNext();
+      if (!chunks->tryNext() && chunks->isActive())
+        break; // underrun - handled by the caller
+
       if (!chunks->curBuf()) {
-        printf("Finishing %s - %d bytes not available to fill the last buffer\n", isInput ? "input" : "output", numBytes);
         memset(buf + bufOff, 0, numBytes);
         finished = true;
         break;
       }
     }
-    if ((0 == bufOff) && isInput) {
-      // offset the chunk timestamp by the chunk offset
-      double timeOffset = (double)chunks->curOffset() / mInOptions->channelCount() / (mInOptions->sampleBits() / 8) / mInOptions->sampleRate();
-      timeStamp = chunks->curTs() + timeOffset;
-    }
 
     uint32_t curBytes = std::min<uint32_t>(numBytes, chunks->curBytes() - chunks->curOffset());
     void *srcBuf = chunks->curBuf() + chunks->curOffset();
@@ -244,9 +929,258 @@ uint32_t PaContext::fillBuffer(uint8_t *buf, uint32_t numBytes, double &timeStam
   return bufOff;
 }
 
+// Reads the stream data written to the output, starting each scheduled chunk on the frame its time
+// falls on - silence fills the gap before an early chunk and the late part of a chunk is trimmed.
+// Returns the number of bytes read, including any silence.
+uint32_t PaContext::fillScheduled(uint8_t *buf, uint32_t numBytes, bool &finished) {
+  uint32_t frameBytes = mOutOptions->channelCount() * mOutOptions->streamBits() / 8;
+  double rate = mOutOptions->sampleRate();
+  uint32_t bufOff = 0;
+  while (bufOff < numBytes) {
+    if (!mOutChunks->curBuf() || (mOutChunks->curBytes() == mOutChunks->curOffset())) {
+      if (!mOutChunks->tryNext() && mOutChunks->isActive())
+        break; // underrun - handled by the caller
+
+      if (!mOutChunks->curBuf()) {
+        memset(buf + bufOff, 0, numBytes - bufOff);
+        finished = true;
+        break;
+      }
+    }
+
+    if (mOutChunks->curScheduled() && !mOutChunks->curOffset()) {
+      // frames until the chunk is due, negative when it is late
+      double dueFrames = (mOutChunks->curTs() - mOutReadTime) * rate - bufOff / frameBytes;
+      if (dueFrames >= 0.5) {
+        uint32_t gapBytes = (uint32_t)std::min<double>(dueFrames + 0.5, (numBytes - bufOff) / frameBytes) * frameBytes;
+        memset(buf + bufOff, 0, gapBytes);
+        bufOff += gapBytes;
+        continue;
+      } else if (dueFrames <= -0.5) {
+        uint32_t lateFrames = (uint32_t)std::min<double>(0.5 - dueFrames, mOutChunks->curBytes() / frameBytes);
+        mOutChunks->incOffset(lateFrames * frameBytes);
+        mLateFrames += lateFrames;
+        continue;
+      }
+    }
+
+    uint32_t curBytes = std::min<uint32_t>(numBytes - bufOff, mOutChunks->curBytes() - mOutChunks->curOffset());
+    memcpy(buf + bufOff, mOutChunks->curBuf() + mOutChunks->curOffset(), curBytes);
+    bufOff += curBytes;
+    mOutChunks->incOffset(curBytes);
+  }
+
+  mOutReadTime += (double)(bufOff / frameBytes) / rate;
+  return bufOff;
+}
+
+// Reads stream data written to the output, mixed with any sources. Returns the number of bytes read.
+uint32_t PaContext::readOut(uint8_t *buf, uint32_t numBytes, bool &finished) {
+  uint32_t bytesRead = fillScheduled(buf, numBytes, finished);
+  if (finished)
+    printf("Finishing output - %d bytes not available to fill the last buffer\n", numBytes - bytesRead);
+  else if (mMixer->numSources())
+    bytesRead = mixSources(buf, bytesRead, numBytes);
+  return bytesRead;
+}
+
+// Adds the mix sources to the first numBytes of buf, of which mainBytes came from the main stream.
+// Sources that run short are left out of the rest of the buffer. Returns the number of bytes with audio.
+uint32_t PaContext::mixSources(uint8_t *buf, uint32_t mainBytes, uint32_t numBytes) {
+  uint32_t format = mOutOptions->streamFormat();
+  uint32_t bytesPerSample = sampleBytes(format);
+  uint32_t blockBytes = (uint32_t)mMixBlock.size();
+  uint32_t mixedBytes = mainBytes;
+  uint32_t shortSources = 0;
+  for (uint32_t off = 0; off < numBytes; off += blockBytes) {
+    uint32_t bytes = std::min<uint32_t>(blockBytes, numBytes - off);
+    uint32_t samples = bytes / bytesPerSample;
+    uint32_t mainSamples = mainBytes > off ? std::min<uint32_t>(bytes, mainBytes - off) / bytesPerSample : 0;
+    convertSamples(buf + off, format, (uint8_t *)mMixAcc.data(), 1, mainSamples);
+    std::fill(mMixAcc.begin() + mainSamples, mMixAcc.begin() + samples, 0.0f);
+
+    uint32_t blockEnd = mainSamples * bytesPerSample;
+    for (uint32_t i = 0; i < Mixer::maxSources; ++i) {
+      MixSource *source = mMixer->slot(i);
+      if (!source || (shortSources & (1u << i)))
+        continue;
+      bool sourceFinished = false;
+      uint32_t samplesRead;
+      if (source->file()) // straight from the mapping
+        samplesRead = source->file()->read(mMixFloat.data(), samples, sourceFinished);
+      else {
+        uint32_t bytesRead = fillBuffer(mMixBlock.data(), bytes, source->chunks(), sourceFinished);
+        samplesRead = bytesRead / bytesPerSample;
+        convertSamples(mMixBlock.data(), format, (uint8_t *)mMixFloat.data(), 1, samplesRead);
+      }
+      float gain = source->targetGain();
+      mixSamples(mMixAcc.data(), mMixFloat.data(), source->appliedGain(), gain, samplesRead);
+      source->setAppliedGain(gain);
+      blockEnd = std::max<uint32_t>(blockEnd, samplesRead * bytesPerSample);
+
+      if (sourceFinished || source->removed())
+        mMixer->detach(i);
+      else if (samplesRead < samples)
+        shortSources |= 1u << i;
+    }
+
+    convertSamples((const uint8_t *)mMixAcc.data(), 1, buf + off, format, samples);
+    if (blockEnd)
+      mixedBytes = std::max<uint32_t>(mixedBytes, off + blockEnd);
+  }
+  return mixedBytes;
+}
+
+// Routes, resamples and converts a captured device buffer into outFrames frames of stream data
+void PaContext::captureFrames(const uint8_t *src, uint32_t frameCount, uint8_t *dst, uint32_t outFrames) {
+  uint32_t channels = mInOptions->channelCount();
+  uint32_t deviceFormat = mInOptions->deviceFormat();
+  uint32_t streamFormat = mInOptions->streamFormat();
+  uint32_t srcFrameBytes = mInOptions->deviceChannelCount() * mInOptions->deviceBits() / 8;
+  uint32_t routedFrameBytes = channels * mInOptions->deviceBits() / 8;
+  uint32_t dstFrameBytes = channels * mInOptions->streamBits() / 8;
+  uint32_t blockFrames = mInRouter ? (uint32_t)mInRouted.size() / routedFrameBytes : frameCount;
+  uint32_t produced = 0;
+  for (uint32_t f = 0; f < frameCount; f += blockFrames) {
+    uint32_t numFrames = std::min<uint32_t>(blockFrames, frameCount - f);
+    const uint8_t *block = src + f * srcFrameBytes;
+    if (mInRouter) {
+      mInRouter->route(block, mInRouted.data(), numFrames);
+      block = mInRouted.data();
+    }
+    if (mInResampler)
+      produced += mInResampler->process(block, deviceFormat, numFrames,
+                                        dst + produced * dstFrameBytes, streamFormat, outFrames - produced);
+    else
+      convertSamples(block, deviceFormat, dst + f * dstFrameBytes, streamFormat, numFrames * channels);
+  }
+}
+
+// Fills frameCount frames of the stream channels in device format. Returns the number of bytes filled.
+uint32_t PaContext::fillStream(uint8_t *buf, uint32_t frameCount, bool &finished) {
+  if (mOutResampler)
+    return fillResampled(buf, frameCount, finished);
+  else if (mOutScratch.empty())
+    return readOut(buf, frameCount * mOutOptions->channelCount() * mOutOptions->deviceBits() / 8, finished);
+  else
+    return fillConverted(buf, frameCount * mOutOptions->channelCount(), finished);
+}
+
+// Fills the device channels from the stream channels, a routing block at a time.
+// Returns the number of device bytes filled.
+uint32_t PaContext::fillRouted(uint8_t *buf, uint32_t frameCount, bool &finished) {
+  uint32_t routedFrameBytes = mOutOptions->channelCount() * mOutOptions->deviceBits() / 8;
+  uint32_t deviceFrameBytes = mOutOptions->deviceChannelCount() * mOutOptions->deviceBits() / 8;
+  uint32_t blockFrames = (uint32_t)mOutRouted.size() / routedFrameBytes;
+  uint32_t framesDone = 0;
+  while (framesDone < frameCount) {
+    uint32_t numFrames = std::min<uint32_t>(blockFrames, frameCount - framesDone);
+    uint32_t framesRead = fillStream(mOutRouted.data(), numFrames, finished) / routedFrameBytes;
+    mOutRouter->route(mOutRouted.data(), buf + framesDone * deviceFrameBytes, framesRead);
+    framesDone += framesRead;
+    if (finished) {
+      memset(buf + framesDone * deviceFrameBytes, 0, (frameCount - framesDone) * deviceFrameBytes);
+      break;
+    }
+    if (framesRead < numFrames)
+      break; // underrun - handled by the caller
+  }
+  return framesDone * deviceFrameBytes;
+}
+
+// Fills the device buffer from stream format data, a scratch buffer at a time.
+// Returns the number of device bytes filled.
+uint32_t PaContext::fillConverted(uint8_t *buf, uint32_t numSamples, bool &finished) {
+  uint32_t streamFormat = mOutOptions->streamFormat();
+  uint32_t deviceFormat = mOutOptions->deviceFormat();
+  uint32_t streamBytes = sampleBytes(streamFormat);
+  uint32_t deviceBytes = sampleBytes(deviceFormat);
+  uint32_t scratchSamples = (uint32_t)mOutScratch.size() / streamBytes;
+  uint32_t samplesDone = 0;
+  while (samplesDone < numSamples) {
+    uint32_t samples = std::min<uint32_t>(scratchSamples, numSamples - samplesDone);
+    uint32_t bytesRead = readOut(mOutScratch.data(), samples * streamBytes, finished);
+    uint32_t samplesRead = bytesRead / streamBytes;
+    convertSamples(mOutScratch.data(), streamFormat, buf + samplesDone * deviceBytes, deviceFormat, samplesRead);
+    samplesDone += samplesRead;
+    if (finished) {
+      memset(buf + samplesDone * deviceBytes, 0, (numSamples - samplesDone) * deviceBytes);
+      break;
+    }
+    if (samplesRead < samples)
+      break; // underrun - handled by the caller
+  }
+  return samplesDone * deviceBytes;
+}
+
+// Fills the device buffer from stream format data at the stream rate. Returns the number of device bytes filled.
+uint32_t PaContext::fillResampled(uint8_t *buf, uint32_t frameCount, bool &finished) {
+  uint32_t streamFrameBytes = mOutOptions->channelCount() * mOutOptions->streamBits() / 8;
+  uint32_t deviceFrameBytes = mOutOptions->channelCount() * mOutOptions->deviceBits() / 8;
+  uint32_t scratchFrames = (uint32_t)mOutScratch.size() / streamFrameBytes;
+  uint32_t framesDone = 0;
+  while (framesDone < frameCount) {
+    uint32_t outFrames = frameCount - framesDone;
+    uint32_t inFrames = std::min<uint32_t>(mOutResampler->inputFrames(outFrames), scratchFrames);
+    uint32_t framesRead = readOut(mOutScratch.data(), inFrames * streamFrameBytes, finished) / streamFrameBytes;
+    if (finished) {
+      // the end of the written data is followed by enough silence to empty the filter
+      memset(mOutScratch.data() + framesRead * streamFrameBytes, 0, (scratchFrames - framesRead) * streamFrameBytes);
+      framesRead = std::min<uint32_t>(framesRead + mOutResampler->taps(), scratchFrames);
+    }
+    framesDone += mOutResampler->process(mOutScratch.data(), mOutOptions->streamFormat(), framesRead,
+                                         buf + framesDone * deviceFrameBytes, mOutOptions->deviceFormat(), outFrames);
+    if (finished) {
+      memset(buf + framesDone * deviceFrameBytes, 0, (frameCount - framesDone) * deviceFrameBytes);
+      break;
+    }
+    if (framesRead < inFrames)
+      break; // underrun - handled by the caller
+  }
+  return framesDone * deviceFrameBytes;
+}
+
+void PaContext::dropInput(uint32_t numBytes) {
+  mOverflows++;
+  mDroppedFrames += numBytes / (mInOptions->channelCount() * mInOptions->streamBits() / 8);
+}
+
+void PaContext::fillUnderrun(uint8_t *buf, uint32_t bufOff, uint32_t numBytes) {
+  if (!mOutStarted) {
+    // nothing has been written yet so this is not an underrun
+    memset(buf + bufOff, 0, numBytes);
+    return;
+  }
+
+  uint32_t bytesPerFrame = mOutOptions->deviceChannelCount() * mOutOptions->deviceBits() / 8;
+  mUnderruns++;
+  mUnderrunFrames += numBytes / bytesPerFrame;
+
+  bool repeat = (eUnderrunPolicy::REPEAT == mUnderrunPolicy) ||
+                ((eUnderrunPolicy::FADE == mUnderrunPolicy) && !mUnderrun);
+  if (repeat && mLastOutBytes) {
+    // continue through the last buffer played from the same position, wrapping as necessary
+    uint32_t lastOff = bufOff % mLastOutBytes;
+    uint32_t dstOff = bufOff;
+    uint32_t bytesLeft = numBytes;
+    while (bytesLeft) {
+      uint32_t curBytes = std::min<uint32_t>(bytesLeft, mLastOutBytes - lastOff);
+      memcpy(buf + dstOff, mLastOut.data() + lastOff, curBytes);
+      dstOff += curBytes;
+      bytesLeft -= curBytes;
+      lastOff = 0;
+    }
+    if (eUnderrunPolicy::FADE == mUnderrunPolicy)
+      scaleSamples(buf + bufOff, numBytes, mOutOptions->deviceFormat(), mOutOptions->deviceChannelCount(), 1.0f, 0.0f);
+  } else
+    memset(buf + bufOff, 0, numBytes);
+
+  mUnderrun = true;
+}
+
 void PaContext::setParams(napi_env env, bool isInput, 
                           std::shared_ptr<AudioOptions> options, 
-                          PaStreamParameters &params, double &sampleRate) {
+                          PaStreamParameters &params) {
   int32_t deviceID = (int32_t)options->deviceID();
   if ((deviceID >= 0) && (deviceID < Pa_GetDeviceCount()))
     params.device = (PaDeviceIndex)deviceID;
@@ -259,22 +1193,27 @@ void PaContext::setParams(napi_env env, bool isInput,
 
   printf("%s device name is %s\n", isInput?"Input":"Output", Pa_GetDeviceInfo(params.device)->name);
 
-  params.channelCount = options->channelCount();
+  params.channelCount = options->deviceChannelCount();
   int maxChannels = isInput ? Pa_GetDeviceInfo(params.device)->maxInputChannels : Pa_GetDeviceInfo(params.device)->maxOutputChannels;
   if (params.channelCount > maxChannels) {
     napi_throw_error(env, nullptr, "Channel count exceeds maximum number of channels for device");
     return;
   }
 
-  uint32_t sampleFormat = options->sampleFormat();
-  switch(sampleFormat) {
+  if (!isValidSampleFormat(options->streamFormat())) {
+    napi_throw_error(env, nullptr, "Invalid streamFormat");
+    return;
+  }
+
+  uint32_t deviceFormat = options->deviceFormat();
+  switch(deviceFormat) {
   case 1: params.sampleFormat = paFloat32; break;
   case 8: params.sampleFormat = paInt8; break;
   case 16: params.sampleFormat = paInt16; break;
   case 24: params.sampleFormat = paInt24; break;
   case 32: params.sampleFormat = paInt32; break;
   default: {
-      napi_throw_error(env, nullptr, "Invalid sampleFormat");
+      napi_throw_error(env, nullptr, "Invalid deviceFormat");
       return;
     }
   }
@@ -283,8 +1222,6 @@ void PaContext::setParams(napi_env env, bool isInput,
                                       Pa_GetDeviceInfo(params.device)->defaultLowOutputLatency;
   params.hostApiSpecificStreamInfo = NULL;
 
-  sampleRate = (double)options->sampleRate();
-
   #ifdef __arm__
   params.suggestedLatency = isInput ? Pa_GetDeviceInfo(params.device)->defaultHighInputLatency : 
                                       Pa_GetDeviceInfo(params.device)->defaultHighOutputLatency;
@@ -18,6 +18,9 @@
 
 #include "node_api.h"
 #include <memory>
+#include <atomic>
+#include <string>
+#include <vector>
 #include <mutex>
 
 struct PaStreamParameters;
@@ -27,6 +30,22 @@ namespace streampunk {
 class AudioOptions;
 class Chunk;
 class Chunks;
+class ChunkPool;
+class PaRuntime;
+class StreamStats;
+class Tracer;
+class Resampler;
+class ChannelRouter;
+class Mixer;
+class MixSource;
+class Fanout;
+class CaptureReader;
+class Meter;
+class Gate;
+class GainRamp;
+class WavWriter;
+class ClockEstimator;
+class RateControl;
 
 class PaContext {
 public:
@@ -34,6 +53,8 @@ public:
   ~PaContext() {}
 
   enum class eStopFlag : uint8_t { WAIT = 0, ABORT = 1 };
+  enum class eUnderrunPolicy : uint8_t { SILENCE = 0, REPEAT = 1, FADE = 2 };
+  enum class eOverflowPolicy : uint8_t { DROP_NEWEST = 0, DROP_OLDEST = 1, GROW = 2 };
 
   bool hasInput() { return mInOptions ? true : false; }
   bool hasOutput() { return mOutOptions ? true : false; }
@@ -42,7 +63,22 @@ public:
   void stop(eStopFlag flag);
 
   std::shared_ptr<Chunk> pullInChunk(uint32_t numBytes, bool &finished);
+  // further readers of the capture, sharing its blocks with a queue and overflow policy each
+  std::shared_ptr<CaptureReader> addReader(uint32_t maxQueue, bool dropOldest);
+  std::shared_ptr<CaptureReader> findReader(uint32_t id);
+  void closeReader(uint32_t id);
+  std::shared_ptr<Chunk> pullReaderChunk(std::shared_ptr<CaptureReader> reader, uint32_t numBytes, bool &finished);
+  // write the capture to a WAV file from a thread of its own, through a reader of its own
+  std::shared_ptr<WavWriter> recordTo(const std::string &path, uint64_t preallocBytes, uint32_t headerMs, std::string &errStr);
   void pushOutChunk(std::shared_ptr<Chunk> chunk);
+  bool copyWrites() const;
+  bool pushMode() const;
+  void releaseOutChunks(napi_env env, bool flush);
+  // sources mixed into the output alongside the chunks written to the stream
+  std::shared_ptr<MixSource> addSource(float gain);
+  std::shared_ptr<MixSource> findSource(uint32_t id);
+  // a source playing a WAV file from a memory mapping
+  std::shared_ptr<MixSource> playFile(const std::string &path, float gain, std::string &errStr);
 
   void checkStatus(uint32_t statusFlags);
   bool getErrStr(std::string& errStr, bool isInput);
@@ -50,29 +86,115 @@ public:
   void quit();
 
   bool readPaBuffer(const void *srcBuf, uint32_t frameCount, double inTimestamp);
-  bool fillPaBuffer(void *dstBuf, uint32_t frameCount);
+  bool fillPaBuffer(void *dstBuf, uint32_t frameCount, double outTimestamp);
 
   double getCurTime() const;
+  // the stream clock that timestamps and scheduled writes use, safe to call from JS while the stream stops
+  double getStreamTime();
+  // smoothed stream time of a callback, from a loop locking the device clock to the system clock
+  double clockCallback(uint32_t frameCount, double systemTime, double streamTime);
+  napi_status getClock(napi_env env, napi_value *result);
+  // convert between the stream clock and the steady system clock
+  double toSystemTime(double streamTime) const;
+  double fromSystemTime(double systemTime) const;
   double getInLatency() const { return mInLatency; }
+  double getOutLatency() const { return mOutLatency; }
+
+  uint64_t getUnderruns() const { return mUnderruns; }
+  uint64_t getUnderrunFrames() const { return mUnderrunFrames; }
+  uint64_t getLateFrames() const { return mLateFrames; }
+  uint64_t getOverflows() const { return mOverflows; }
+  uint64_t getDroppedFrames() const { return mDroppedFrames; }
+
+  StreamStats &stats() { return *mStats; }
+  void setTracer(std::shared_ptr<Tracer> tracer) { mTracer = tracer; }
+  // ramp the gain of the captured or played audio from the next callback
+  void setGain(bool isInput, float gain, uint32_t rampMs);
+  // levels of the device channels, read every intervalMs
+  void setMeter(uint32_t intervalMs);
+  bool hasMeter() const { return mMeter ? true : false; }
+  void meterFrames(uint32_t frameCount);
+  // blocking - returns false once the stream has finished
+  bool pullMeter(std::vector<float> &levels);
+  Tracer *tracer() const { return mTracer.get(); }
+  int64_t inQueuedBytes() const;
+  int64_t outQueuedBytes() const;
+  napi_status getStats(napi_env env, napi_value *result);
 
 private:
   std::shared_ptr<AudioOptions> mInOptions;
   std::shared_ptr<AudioOptions> mOutOptions;
   std::shared_ptr<Chunks> mInChunks;
   std::shared_ptr<Chunks> mOutChunks;
+  std::shared_ptr<Fanout> mFanout;
+  std::shared_ptr<ChunkPool> mInPool;
+  std::shared_ptr<Gate> mGate;
+  std::shared_ptr<GainRamp> mInGain;
+  std::shared_ptr<GainRamp> mOutGain;
+  std::shared_ptr<ClockEstimator> mClock;
+  std::shared_ptr<PaRuntime> mRuntime;
   void *mStream;
+  std::atomic<bool> mStopped;
+  // set while the callback may run - the JS thread may only let go of readers itself when it is clear
+  std::atomic<bool> mRunning;
+  std::mutex mStreamMutex;
+  std::shared_ptr<StreamStats> mStats;
+  std::shared_ptr<Tracer> mTracer;
+  std::shared_ptr<Meter> mMeter;
+  std::shared_ptr<ChunkPool> mMeterPool;
+  std::shared_ptr<Chunks> mMeterChunks;
   double mInLatency;
-  std::string mErrStr;
-  std::mutex m;
-
+  double mOutLatency;
+  std::atomic<uint32_t> mStatusFlags;
+  eUnderrunPolicy mUnderrunPolicy;
+  std::vector<uint8_t> mLastOut;
+  uint32_t mLastOutBytes;
+  std::vector<uint8_t> mOutScratch;
+  double mDeviceRate;
+  uint32_t mInBlockFrames;
+  std::shared_ptr<Resampler> mInResampler;
+  std::shared_ptr<Resampler> mOutResampler;
+  std::shared_ptr<RateControl> mRateControl;
+  std::shared_ptr<ChannelRouter> mInRouter;
+  std::shared_ptr<ChannelRouter> mOutRouter;
+  std::vector<uint8_t> mInRouted;
+  std::vector<uint8_t> mOutRouted;
+  std::shared_ptr<Mixer> mMixer;
+  std::vector<float> mMixAcc;
+  std::vector<float> mMixFloat;
+  std::vector<uint8_t> mMixBlock;
+  bool mOutStarted;
+  bool mUnderrun;
+  std::atomic<uint64_t> mUnderruns;
+  std::atomic<uint64_t> mUnderrunFrames;
+  double mOutReadTime;
+  std::atomic<uint64_t> mLateFrames;
+  eOverflowPolicy mOverflowPolicy;
+  uint64_t mInSeq;
+  uint64_t mInFrames;
+  std::atomic<uint64_t> mOverflows;
+  std::atomic<uint64_t> mDroppedFrames;
+
+  std::shared_ptr<Chunk> pullChunk(Chunks &chunks, uint32_t numBytes);
+  void captureBlock(const uint8_t *srcBuf, uint32_t frameCount, double inTimestamp);
+  void fanOut(const std::shared_ptr<Chunk> &chunk);
   uint32_t fillBuffer(uint8_t *buf, uint32_t numBytes,
-                      double &timeStamp,
-                      std::shared_ptr<Chunks> chunks,
-                      bool &finished, bool isInput);
+                      std::shared_ptr<Chunks> chunks, bool &finished);
+  uint32_t fillScheduled(uint8_t *buf, uint32_t numBytes, bool &finished);
+  uint32_t readOut(uint8_t *buf, uint32_t numBytes, bool &finished);
+  uint32_t mixSources(uint8_t *buf, uint32_t mainBytes, uint32_t numBytes);
+  void captureFrames(const uint8_t *src, uint32_t frameCount, uint8_t *dst, uint32_t outFrames);
+  uint32_t fillStream(uint8_t *buf, uint32_t frameCount, bool &finished);
+  uint32_t fillRouted(uint8_t *buf, uint32_t frameCount, bool &finished);
+  uint32_t fillConverted(uint8_t *buf, uint32_t numSamples, bool &finished);
+  uint32_t fillResampled(uint8_t *buf, uint32_t frameCount, bool &finished);
+  void fillUnderrun(uint8_t *buf, uint32_t bufOff, uint32_t numBytes);
+  void steerRate(uint32_t frameCount);
+  void dropInput(uint32_t numBytes);
 
   void setParams(napi_env env, bool isInput, 
                  std::shared_ptr<AudioOptions> options, 
-                 PaStreamParameters &params, double &sampleRate);
+                 PaStreamParameters &params);
 };
 
 } // namespace streampunk
@@ -0,0 +1,99 @@
+/* Copyright 2019 Streampunk Media Ltd.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#include "PaRuntime.h"
+#include "naudiodonUtil.h"
+#include <portaudio.h>
+
+namespace streampunk {
+
+std::mutex PaRuntime::sMutex;
+uint32_t PaRuntime::sUsers = 0;
+std::map<napi_env, std::shared_ptr<PaRuntime> > PaRuntime::sEnumerators;
+
+std::shared_ptr<PaRuntime> PaRuntime::acquire(std::string &errStr) {
+  std::lock_guard<std::mutex> lk(sMutex);
+  if (0 == sUsers) {
+    PaError errCode = Pa_Initialize();
+    if (errCode != paNoError) {
+      errStr = std::string("Could not initialize PortAudio: ") + Pa_GetErrorText(errCode);
+      return std::shared_ptr<PaRuntime>();
+    }
+  }
+  ++sUsers;
+  return std::shared_ptr<PaRuntime>(new PaRuntime());
+}
+
+PaRuntime::~PaRuntime() {
+  std::lock_guard<std::mutex> lk(sMutex);
+  if (0 == --sUsers)
+    Pa_Terminate();
+}
+
+std::shared_ptr<PaRuntime> PaRuntime::enumerate(napi_env env, std::string &errStr) {
+  {
+    std::lock_guard<std::mutex> lk(sMutex);
+    auto it = sEnumerators.find(env);
+    if (it != sEnumerators.end())
+      return it->second;
+  }
+
+  std::shared_ptr<PaRuntime> runtime = acquire(errStr);
+  if (runtime) {
+    std::lock_guard<std::mutex> lk(sMutex);
+    sEnumerators[env] = runtime;
+  }
+  return runtime;
+}
+
+bool PaRuntime::refresh(napi_env env, std::string &errStr) {
+  std::map<napi_env, std::shared_ptr<PaRuntime> > enumerators;
+  {
+    std::lock_guard<std::mutex> lk(sMutex);
+    if (sUsers > sEnumerators.size()) {
+      errStr = "Cannot refresh PortAudio devices while streams are open";
+      return false;
+    }
+    enumerators.swap(sEnumerators);
+  }
+  enumerators.clear(); // the runtime terminates with the last handle
+  return enumerate(env, errStr) ? true : false;
+}
+
+// drops the enumeration handle of an environment that is shutting down
+void PaRuntime::cleanupEnv(void *arg) {
+  std::shared_ptr<PaRuntime> runtime; // released once the lock is free
+  std::lock_guard<std::mutex> lk(sMutex);
+  auto it = sEnumerators.find((napi_env)arg);
+  if (it != sEnumerators.end()) {
+    runtime = it->second;
+    sEnumerators.erase(it);
+  }
+}
+
+napi_value refresh(napi_env env, napi_callback_info info) {
+  napi_status status;
+  napi_value result;
+  std::string errStr;
+
+  if (!PaRuntime::refresh(env, errStr))
+    NAPI_THROW_ERROR(errStr.c_str());
+
+  status = napi_get_undefined(env, &result);
+  CHECK_STATUS;
+  return result;
+}
+
+} // namespace streampunk
@@ -0,0 +1,52 @@
+/* Copyright 2019 Streampunk Media Ltd.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#ifndef PARUNTIME_H
+#define PARUNTIME_H
+
+#include "node_api.h"
+#include <memory>
+#include <string>
+#include <mutex>
+#include <map>
+
+namespace streampunk {
+
+// A handle on the PortAudio runtime, which is initialised once for the process and
+// shared by every stream and enumeration. It terminates when the last handle goes.
+// Enumeration keeps a handle for each environment so that devices are not probed on
+// every call - refresh drops these to re-enumerate, once no streams are open.
+class PaRuntime {
+public:
+  static std::shared_ptr<PaRuntime> acquire(std::string &errStr);
+  static std::shared_ptr<PaRuntime> enumerate(napi_env env, std::string &errStr);
+  static bool refresh(napi_env env, std::string &errStr);
+  static void cleanupEnv(void *arg);
+
+  ~PaRuntime();
+
+private:
+  PaRuntime() {}
+
+  static std::mutex sMutex;
+  static uint32_t sUsers;
+  static std::map<napi_env, std::shared_ptr<PaRuntime> > sEnumerators;
+};
+
+napi_value refresh(napi_env env, napi_callback_info info);
+
+} // namespace streampunk
+
+#endif
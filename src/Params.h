@@ -18,7 +18,9 @@
 
 #include "node_api.h"
 #include "naudiodonUtil.h"
+#include "ChannelRouter.h"
 #include <sstream>
+#include <algorithm>
 
 namespace streampunk {
 
@@ -68,6 +70,25 @@ uint32_t unpackNum(napi_env env, napi_value tags, const std::string& key, uint32
   return result;
 } 
 
+double unpackDouble(napi_env env, napi_value tags, const std::string& key, double dflt) {
+  napi_status status;
+  bool hasKey;
+  napi_value val;
+  double result = dflt;
+
+  status = napi_has_named_property(env, tags, key.c_str(), &hasKey);
+  FLOATING_STATUS;
+
+  if (hasKey) {
+    status = napi_get_named_property(env, tags, key.c_str(), &val);
+    FLOATING_STATUS;
+
+    status = napi_get_value_double(env, val, &result);
+    FLOATING_STATUS;
+  }
+  return result;
+}
+
 std::string unpackStr(napi_env env, napi_value tags, const std::string& key, std::string dflt) {
   napi_status status;
   bool hasKey;
@@ -85,7 +106,7 @@ std::string unpackStr(napi_env env, napi_value tags, const std::string& key, std
     status = napi_get_value_string_utf8(env, val, nullptr, 0, &strLen);
     FLOATING_STATUS;
     char* resultStr = (char*) malloc(sizeof(char) * (strLen + 1));
-    status = napi_get_value_string_utf8(env, tags, resultStr, strLen + 1, &strLen);
+    status = napi_get_value_string_utf8(env, val, resultStr, strLen + 1, &strLen);
     FLOATING_STATUS;
 
     result = std::string(resultStr);
@@ -94,28 +115,133 @@ std::string unpackStr(napi_env env, napi_value tags, const std::string& key, std
   return result;
 } 
 
+// an array with an entry for each stream channel - a device channel number, or an array of them
+ChannelMap unpackChannelMap(napi_env env, napi_value tags, const std::string& key) {
+  napi_status status;
+  bool hasKey;
+  napi_value val;
+  ChannelMap result;
+
+  status = napi_has_named_property(env, tags, key.c_str(), &hasKey);
+  FLOATING_STATUS;
+
+  if (hasKey) {
+    status = napi_get_named_property(env, tags, key.c_str(), &val);
+    FLOATING_STATUS;
+
+    uint32_t numEntries = 0;
+    status = napi_get_array_length(env, val, &numEntries);
+    FLOATING_STATUS;
+    result.resize(numEntries);
+
+    for (uint32_t e = 0; e < numEntries; ++e) {
+      napi_value entry;
+      status = napi_get_element(env, val, e, &entry);
+      FLOATING_STATUS;
+
+      bool isArray = false;
+      status = napi_is_array(env, entry, &isArray);
+      FLOATING_STATUS;
+      if (!isArray) {
+        uint32_t channel;
+        status = napi_get_value_uint32(env, entry, &channel);
+        FLOATING_STATUS;
+        if (napi_ok == status)
+          result[e].push_back(channel);
+        continue;
+      }
+
+      uint32_t numChannels = 0;
+      status = napi_get_array_length(env, entry, &numChannels);
+      FLOATING_STATUS;
+      for (uint32_t c = 0; c < numChannels; ++c) {
+        napi_value chanVal;
+        uint32_t channel;
+        status = napi_get_element(env, entry, c, &chanVal);
+        FLOATING_STATUS;
+        status = napi_get_value_uint32(env, chanVal, &channel);
+        FLOATING_STATUS;
+        if (napi_ok == status)
+          result[e].push_back(channel);
+      }
+    }
+  }
+  return result;
+}
+
+uint32_t mapChannels(const ChannelMap &map) {
+  uint32_t numChannels = 0;
+  for (const auto &entry : map)
+    for (uint32_t c : entry)
+      numChannels = std::max<uint32_t>(numChannels, c + 1);
+  return numChannels;
+}
+
 class AudioOptions {
 public:
   AudioOptions(napi_env env, napi_value tags)
     : mDeviceID(unpackNum(env, tags, "deviceId", 0xffffffff)),
       mSampleRate(unpackNum(env, tags, "sampleRate", 44100)),
-      mChannelCount(unpackNum(env, tags, "channelCount", 2)),
+      mDeviceSampleRate(unpackNum(env, tags, "deviceSampleRate", 0)),
+      mResampleQuality(unpackStr(env, tags, "resampleQuality", "medium")),
+      mChannelMap(unpackChannelMap(env, tags, "channelMap")),
+      mChannelCount(unpackNum(env, tags, "channelCount", mChannelMap.size() ? (uint32_t)mChannelMap.size() : 2)),
+      mDeviceChannelCount(unpackNum(env, tags, "deviceChannelCount", mChannelMap.size() ? mapChannels(mChannelMap) : mChannelCount)),
       mSampleFormat(unpackNum(env, tags, "sampleFormat", 8)),
-      mSampleBits(1 == mSampleFormat ? 32 : mSampleFormat),
+      mDeviceFormat(unpackNum(env, tags, "deviceFormat", mSampleFormat)),
+      mStreamFormat(unpackNum(env, tags, "streamFormat", mSampleFormat)),
       mMaxQueue(unpackNum(env, tags, "maxQueue", 2)),
       mFramesPerBuffer(unpackNum(env, tags, "framesPerBuffer", 0)),
-      mCloseOnError(unpackBool(env, tags, "closeOnError", true))
+      mCloseOnError(unpackBool(env, tags, "closeOnError", true)),
+      mUnderrunPolicy(unpackStr(env, tags, "underrunPolicy", "silence")),
+      mOverflowPolicy(unpackStr(env, tags, "overflowPolicy", "dropNewest")),
+      mMaxQueueBytes(unpackNum(env, tags, "maxQueueBytes", 1048576)),
+      mCopyWrites(unpackBool(env, tags, "copyWrites", false)),
+      mPushMode(unpackBool(env, tags, "pushMode", false)),
+      mGateThreshold(unpackDouble(env, tags, "gateThreshold", 0.0)),
+      mGateHysteresis(unpackDouble(env, tags, "gateHysteresis", 6.0)),
+      mGateHold(unpackNum(env, tags, "gateHold", 300)),
+      mGatePreRoll(unpackNum(env, tags, "gatePreRoll", 100)),
+      mGateMaxZcr(unpackNum(env, tags, "gateMaxZcr", 5000)),
+      mAdaptiveLatency(unpackNum(env, tags, "adaptiveLatency", 0)),
+      mAdaptiveMaxPpm(unpackNum(env, tags, "adaptiveMaxPpm", 1000))
   {}
   ~AudioOptions() {}
 
   uint32_t deviceID() const  { return mDeviceID; }
   uint32_t sampleRate() const  { return mSampleRate; }
+  // the rate the device runs at, if set, when the stream is resampled to or from sampleRate
+  bool hasDeviceSampleRate() const  { return 0 != mDeviceSampleRate; }
+  uint32_t deviceSampleRate() const  { return mDeviceSampleRate ? mDeviceSampleRate : mSampleRate; }
+  std::string resampleQuality() const  { return mResampleQuality; }
   uint32_t channelCount() const  { return mChannelCount; }
-  uint32_t sampleFormat() const  { return mSampleFormat; }
-  uint32_t sampleBits() const  { return mSampleBits; }
+  // the channels the device is opened with, routed to and from the stream channels by the channel map
+  uint32_t deviceChannelCount() const  { return mDeviceChannelCount; }
+  const ChannelMap &channelMap() const  { return mChannelMap; }
+  // the format PortAudio opens the device with and the format of the stream buffers, if different
+  uint32_t deviceFormat() const  { return mDeviceFormat; }
+  uint32_t deviceBits() const  { return 1 == mDeviceFormat ? 32 : mDeviceFormat; }
+  uint32_t streamFormat() const  { return mStreamFormat; }
+  uint32_t streamBits() const  { return 1 == mStreamFormat ? 32 : mStreamFormat; }
   uint32_t maxQueue() const  { return mMaxQueue; }
   uint32_t framesPerBuffer() const  { return mFramesPerBuffer; }
   bool closeOnError() const  { return mCloseOnError; }
+  std::string underrunPolicy() const  { return mUnderrunPolicy; }
+  std::string overflowPolicy() const  { return mOverflowPolicy; }
+  uint32_t maxQueueBytes() const  { return mMaxQueueBytes; }
+  bool copyWrites() const  { return mCopyWrites; }
+  bool pushMode() const  { return mPushMode; }
+  // voice gate on captured blocks, off unless a threshold in dBFS below 0 is given
+  bool hasGate() const  { return 0.0 != mGateThreshold; }
+  double gateThreshold() const  { return mGateThreshold; }
+  double gateHysteresis() const  { return mGateHysteresis; }
+  uint32_t gateHold() const  { return mGateHold; }
+  uint32_t gatePreRoll() const  { return mGatePreRoll; }
+  uint32_t gateMaxZcr() const  { return mGateMaxZcr; }
+  // output resampled to hold the queue at a target latency in milliseconds, off unless one is given
+  bool isAdaptive() const  { return 0 != mAdaptiveLatency; }
+  uint32_t adaptiveLatency() const  { return mAdaptiveLatency; }
+  uint32_t adaptiveMaxPpm() const  { return mAdaptiveMaxPpm; }
 
   std::string toString() const  { 
     std::stringstream ss;
@@ -125,23 +251,51 @@ public:
     else
       ss << "device " << mDeviceID << ", ";
     ss << "sample rate " << mSampleRate << ", ";
+    if (mDeviceSampleRate)
+      ss << "device sample rate " << mDeviceSampleRate << ", ";
     ss << "channels " << mChannelCount << ", ";
-    ss << "bits per sample " << mSampleBits << ", ";
+    if (mChannelMap.size())
+      ss << "device channels " << mDeviceChannelCount << ", ";
+    ss << "device format " << mDeviceFormat << ", ";
+    ss << "stream format " << mStreamFormat << ", ";
     ss << "max queue " << mMaxQueue << ", ";
     ss << "frames per buffer " << mFramesPerBuffer << ", ";
-    ss << "close on error " << (mCloseOnError ? "true" : "false");
+    ss << "close on error " << (mCloseOnError ? "true" : "false") << ", ";
+    ss << "underrun policy " << mUnderrunPolicy << ", ";
+    ss << "overflow policy " << mOverflowPolicy;
+    if (hasGate())
+      ss << ", gate threshold " << mGateThreshold << "dB";
+    if (isAdaptive())
+      ss << ", adaptive latency " << mAdaptiveLatency << "ms";
     return ss.str();
   }
 
 private:
   uint32_t mDeviceID;
   uint32_t mSampleRate;
+  uint32_t mDeviceSampleRate;
+  std::string mResampleQuality;
+  ChannelMap mChannelMap;
   uint32_t mChannelCount;
+  uint32_t mDeviceChannelCount;
   uint32_t mSampleFormat;
-  uint32_t mSampleBits;
+  uint32_t mDeviceFormat;
+  uint32_t mStreamFormat;
   uint32_t mMaxQueue;
   uint32_t mFramesPerBuffer;
   bool mCloseOnError;
+  std::string mUnderrunPolicy;
+  std::string mOverflowPolicy;
+  uint32_t mMaxQueueBytes;
+  bool mCopyWrites;
+  bool mPushMode;
+  double mGateThreshold;
+  double mGateHysteresis;
+  uint32_t mGateHold;
+  uint32_t mGatePreRoll;
+  uint32_t mGateMaxZcr;
+  uint32_t mAdaptiveLatency;
+  uint32_t mAdaptiveMaxPpm;
 };
 
 } // namespace streampunk
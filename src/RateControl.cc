@@ -0,0 +1,53 @@
+/* Copyright 2019 Streampunk Media Ltd.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+
+#include "RateControl.h"
+#include <algorithm>
+#include <cmath>
+
+namespace streampunk {
+
+// the depth is smoothed with this time constant, shorter than the loop's response
+static const double smoothSeconds = 1.0;
+// loop gains, per second of depth error - critically damped, with a time constant of 10 seconds
+static const double propGain = 0.2;
+static const double intGain = 0.01;
+
+RateControl::RateControl(double targetSeconds, double maxPpm)
+  : mTarget(targetSeconds), mMaxAdjust(maxPpm * 1e-6), mStarted(false), mDepth(0.0), mIntegral(0.0),
+    mPpm(0.0), mPubDepth(0.0) {}
+
+double RateControl::update(double depthSeconds, double dt) {
+  if (!mStarted) {
+    mStarted = true;
+    mDepth = depthSeconds;
+  } else
+    mDepth += (1.0 - std::exp(-dt / smoothSeconds)) * (depthSeconds - mDepth);
+
+  // too deep a queue is read faster, too shallow a queue slower
+  double err = mDepth - mTarget;
+  double adjust = propGain * err + intGain * mIntegral;
+  // the integral is held while the adjustment is at its limit, unless the error would pull it back
+  if ((std::fabs(adjust) < mMaxAdjust) || ((adjust > 0.0) != (err > 0.0)))
+    mIntegral += err * dt;
+  adjust = std::min<double>(std::max<double>(adjust, -mMaxAdjust), mMaxAdjust);
+
+  mPpm.store(adjust * 1e6, std::memory_order_relaxed);
+  mPubDepth.store(mDepth, std::memory_order_relaxed);
+  return 1.0 + adjust;
+}
+
+} // namespace streampunk
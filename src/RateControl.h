@@ -0,0 +1,56 @@
+/* Copyright 2019 Streampunk Media Ltd.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+
+#ifndef RATECONTROL_H
+#define RATECONTROL_H
+
+#include <atomic>
+#include <cstdint>
+
+namespace streampunk {
+
+// Steers the rate that the output is resampled at so that the audio queued for playback
+// stays at a target depth, for a stream written to at the pace of a clock other than
+// the device's. The depth is smoothed over the bursts in which audio is written, and a
+// proportional-integral loop turns its error into a small change of rate. The integral
+// settles at the difference between the clocks, which brings the depth back to the target.
+class RateControl {
+public:
+  RateControl(double targetSeconds, double maxPpm);
+  ~RateControl() {}
+
+  // realtime thread only - given the queued depth dt seconds after the last update,
+  // returns the scale for the ratio of stream frames read to device frames played
+  double update(double depthSeconds, double dt);
+
+  // any thread
+  double ppm() const { return mPpm.load(std::memory_order_relaxed); }
+  double depth() const { return mPubDepth.load(std::memory_order_relaxed); }
+  double target() const { return mTarget; }
+
+private:
+  const double mTarget;
+  const double mMaxAdjust;
+  bool mStarted;
+  double mDepth;
+  double mIntegral;
+  std::atomic<double> mPpm;
+  std::atomic<double> mPubDepth;
+};
+
+} // namespace streampunk
+
+#endif
@@ -0,0 +1,226 @@
+/* Copyright 2019 Streampunk Media Ltd.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#include "Resampler.h"
+#include "SampleFormat.h"
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+
+namespace streampunk {
+
+struct ResampleDesign {
+  uint32_t taps;      // filter length when not reducing the rate
+  uint32_t phaseBits; // log2 of the number of tabulated phases
+  double rolloff;     // cutoff as a fraction of the lower Nyquist frequency
+  double beta;        // Kaiser window shape
+};
+
+static const ResampleDesign designs[] = {
+  { 8, 6, 0.80, 5.0 },   // LOW
+  { 32, 8, 0.90, 8.0 },  // MEDIUM
+  { 64, 9, 0.95, 10.0 }  // HIGH
+};
+
+static const double pi = 3.14159265358979323846;
+
+const double Resampler::maxRatioScale = 0.01;
+
+// zeroth order modified Bessel function of the first kind
+static double besselI0(double x) {
+  double sum = 1.0, term = 1.0;
+  for (uint32_t k = 1; k < 50; ++k) {
+    term *= (x / (2.0 * k)) * (x / (2.0 * k));
+    sum += term;
+    if (term < sum * 1e-12)
+      break;
+  }
+  return sum;
+}
+
+Resampler::Resampler(uint32_t channels, double inRate, double outRate, eResampleQuality quality, uint32_t blockFrames)
+  : mChannels(channels), mRatio(inRate / outRate), mTaps(0), mPhaseBits(0),
+    mStep((uint64_t)std::llround(mRatio * 4294967296.0)),
+    mBlockFrames(blockFrames ? blockFrames : 1), mCapFrames(0), mBufFrames(0), mPos(0) {
+  const ResampleDesign &design = designs[std::min<uint32_t>((uint32_t)quality, 2)];
+  // when reducing the rate the cutoff falls, so the filter is lengthened to keep its transition band
+  mTaps = (uint32_t)std::ceil(design.taps * std::max<double>(1.0, mRatio) / 4.0) * 4;
+  mPhaseBits = design.phaseBits;
+  uint32_t phases = 1 << mPhaseBits;
+  double cutoff = design.rolloff * std::min<double>(1.0, 1.0 / mRatio);
+  double halfTaps = mTaps / 2.0;
+  double i0Beta = besselI0(design.beta);
+
+  mTable.resize((phases + 1) * mTaps);
+  for (uint32_t p = 0; p <= phases; ++p) {
+    float *row = mTable.data() + p * mTaps;
+    double sum = 0.0;
+    for (uint32_t k = 0; k < mTaps; ++k) {
+      double x = k - (halfTaps - 1.0) - (double)p / phases;
+      double y = cutoff * x;
+      double sinc = std::fabs(y) < 1e-9 ? 1.0 : std::sin(pi * y) / (pi * y);
+      double r = x / halfTaps;
+      double window = std::fabs(r) < 1.0 ? besselI0(design.beta * std::sqrt(1.0 - r * r)) / i0Beta : 0.0;
+      row[k] = (float)(cutoff * sinc * window);
+      sum += row[k];
+    }
+    for (uint32_t k = 0; k < mTaps; ++k) // unity gain at every phase
+      row[k] = (float)(row[k] / sum);
+  }
+
+  mCoefs.resize(mTaps);
+  mCapFrames = 2 * mTaps + mBlockFrames;
+  mBuf.resize(mCapFrames * mChannels);
+  mInterleaved.resize(mBlockFrames * mChannels);
+  reset();
+}
+
+uint32_t Resampler::outputFrames(uint32_t inFrames) const {
+  uint32_t numFrames = mBufFrames + inFrames;
+  if (numFrames < mTaps)
+    return 0;
+  // output is possible while the integer part of the position is at most numFrames - taps
+  uint64_t limit = (uint64_t)(numFrames - mTaps + 1) << 32;
+  return limit > mPos ? (uint32_t)((limit - mPos - 1) / mStep + 1) : 0;
+}
+
+uint32_t Resampler::inputFrames(uint32_t outFrames) const {
+  if (!outFrames)
+    return 0;
+  uint64_t last = mPos + (outFrames - 1) * mStep;
+  uint64_t needed = (last >> 32) + mTaps;
+  return needed > mBufFrames ? (uint32_t)(needed - mBufFrames) : 0;
+}
+
+uint32_t Resampler::maxOutputFrames(uint32_t inFrames) const {
+  return (uint32_t)((inFrames + mTaps) / (mRatio * (1.0 - maxRatioScale))) + 2;
+}
+
+uint32_t Resampler::maxInputFrames(uint32_t outFrames) const {
+  return (uint32_t)(outFrames * mRatio * (1.0 + maxRatioScale)) + mTaps + 2;
+}
+
+double Resampler::nextOutputOffset() const {
+  return (double)mPos / 4294967296.0 + (mTaps / 2 - 1) - mBufFrames;
+}
+
+void Resampler::setRatioScale(double scale) {
+  scale = std::min<double>(std::max<double>(scale, 1.0 - maxRatioScale), 1.0 + maxRatioScale);
+  mStep = (uint64_t)std::llround(mRatio * scale * 4294967296.0);
+}
+
+uint32_t Resampler::process(const uint8_t *in, uint32_t inFormat, uint32_t &inFrames,
+                            uint8_t *out, uint32_t outFormat, uint32_t maxOutFrames) {
+  uint32_t inFrameBytes = sampleBytes(inFormat) * mChannels;
+  uint32_t outFrameBytes = sampleBytes(outFormat) * mChannels;
+  uint32_t consumed = 0;
+  uint32_t produced = 0;
+  while (true) {
+    uint32_t n = std::min<uint32_t>(std::min<uint32_t>(mCapFrames - mBufFrames, mBlockFrames), inFrames - consumed);
+    if (n) {
+      append(in ? in + consumed * inFrameBytes : nullptr, inFormat, n);
+      consumed += n;
+    }
+    uint32_t m = std::min<uint32_t>(available(), maxOutFrames - produced);
+    if (m) {
+      generate(out + produced * outFrameBytes, outFormat, m);
+      produced += m;
+    }
+    compact();
+    if ((consumed == inFrames) || (!n && !m))
+      break;
+  }
+  inFrames = consumed;
+  return produced;
+}
+
+void Resampler::reset() {
+  std::fill(mBuf.begin(), mBuf.end(), 0.0f);
+  // a half filter of silence leads the input, so that the first output is centred on the first input
+  mBufFrames = mTaps / 2 - 1;
+  mPos = 0;
+}
+
+// private
+uint32_t Resampler::available() const {
+  return outputFrames(0);
+}
+
+void Resampler::append(const uint8_t *in, uint32_t inFormat, uint32_t numFrames) {
+  if (in)
+    convertSamples(in, inFormat, (uint8_t *)mInterleaved.data(), 1, numFrames * mChannels);
+  for (uint32_t c = 0; c < mChannels; ++c) {
+    float *dst = mBuf.data() + c * mCapFrames + mBufFrames;
+    if (in) {
+      const float *src = mInterleaved.data() + c;
+      for (uint32_t f = 0; f < numFrames; ++f)
+        dst[f] = src[f * mChannels];
+    } else
+      memset(dst, 0, numFrames * sizeof(float));
+  }
+  mBufFrames += numFrames;
+}
+
+void Resampler::generate(uint8_t *out, uint32_t outFormat, uint32_t numFrames) {
+  const uint32_t fracShift = 32 - mPhaseBits;
+  const float fracScale = 1.0f / (float)(1u << fracShift);
+  const uint32_t fracMask = (1u << fracShift) - 1;
+  uint32_t outFrameBytes = sampleBytes(outFormat) * mChannels;
+  float *coefs = mCoefs.data();
+
+  uint32_t done = 0;
+  while (done < numFrames) {
+    uint32_t block = std::min<uint32_t>(numFrames - done, mBlockFrames);
+    for (uint32_t f = 0; f < block; ++f) {
+      uint32_t i = (uint32_t)(mPos >> 32);
+      uint32_t frac = (uint32_t)mPos;
+      const float *row = mTable.data() + (frac >> fracShift) * mTaps;
+      const float *next = row + mTaps;
+      float a = (frac & fracMask) * fracScale;
+      for (uint32_t k = 0; k < mTaps; ++k)
+        coefs[k] = row[k] + a * (next[k] - row[k]);
+
+      for (uint32_t c = 0; c < mChannels; ++c) {
+        const float *x = mBuf.data() + c * mCapFrames + i;
+        float acc0 = 0.0f, acc1 = 0.0f, acc2 = 0.0f, acc3 = 0.0f;
+        for (uint32_t k = 0; k < mTaps; k += 4) {
+          acc0 += coefs[k] * x[k];
+          acc1 += coefs[k + 1] * x[k + 1];
+          acc2 += coefs[k + 2] * x[k + 2];
+          acc3 += coefs[k + 3] * x[k + 3];
+        }
+        mInterleaved[f * mChannels + c] = (acc0 + acc1) + (acc2 + acc3);
+      }
+      mPos += mStep;
+    }
+    convertSamples((const uint8_t *)mInterleaved.data(), 1, out + done * outFrameBytes, outFormat, block * mChannels);
+    done += block;
+  }
+}
+
+// drop the frames that are behind the filter
+void Resampler::compact() {
+  uint32_t drop = std::min<uint32_t>((uint32_t)(mPos >> 32), mBufFrames);
+  if (!drop)
+    return;
+  for (uint32_t c = 0; c < mChannels; ++c) {
+    float *plane = mBuf.data() + c * mCapFrames;
+    memmove(plane, plane + drop, (mBufFrames - drop) * sizeof(float));
+  }
+  mBufFrames -= drop;
+  mPos -= (uint64_t)drop << 32;
+}
+
+} // namespace streampunk
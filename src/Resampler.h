@@ -0,0 +1,89 @@
+/* Copyright 2019 Streampunk Media Ltd.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#ifndef RESAMPLER_H
+#define RESAMPLER_H
+
+#include <cstdint>
+#include <vector>
+
+namespace streampunk {
+
+enum class eResampleQuality : uint8_t { LOW = 0, MEDIUM = 1, HIGH = 2 };
+
+// Polyphase windowed-sinc sample rate converter for interleaved audio. The
+// filter is tabulated at a fixed number of phases and interpolated between
+// them, so any ratio of rates is supported. The position in the input is held
+// in 32.32 fixed point so that the number of frames produced is exact and can
+// be predicted. Audio is filtered as planar float, converting from and to the
+// sample formats of SampleFormat.h on the way in and out. Once constructed,
+// nothing allocates, so it may be used from the PortAudio callback.
+class Resampler {
+public:
+  // blockFrames is the most input that is buffered in one go - larger inputs are taken in pieces
+  Resampler(uint32_t channels, double inRate, double outRate, eResampleQuality quality, uint32_t blockFrames);
+  ~Resampler() {}
+
+  uint32_t taps() const { return mTaps; }
+
+  // frames that inFrames more frames of input will produce
+  uint32_t outputFrames(uint32_t inFrames) const;
+  // frames of input needed to produce outFrames more frames of output
+  uint32_t inputFrames(uint32_t outFrames) const;
+  // upper bounds, whatever the state, for sizing buffers
+  uint32_t maxOutputFrames(uint32_t inFrames) const;
+  uint32_t maxInputFrames(uint32_t outFrames) const;
+
+  // offset of the next frame of output from the start of the next input, in input frames
+  double nextOutputOffset() const;
+
+  // Scale the ratio of input to output frames from the next frame, to follow a clock other than the
+  // one the rates were given for. The scale is held within maxRatioScale of 1, which the buffer bounds allow for.
+  void setRatioScale(double scale);
+  static const double maxRatioScale;
+
+  // Resample inFrames frames of interleaved input, or silence if in is null, writing at most
+  // maxOutFrames. Input that does not fit without more room for output is left unconsumed -
+  // inFrames is updated to the frames consumed. Returns the number of frames written.
+  uint32_t process(const uint8_t *in, uint32_t inFormat, uint32_t &inFrames,
+                   uint8_t *out, uint32_t outFormat, uint32_t maxOutFrames);
+
+  // forget the input history, as after a gap
+  void reset();
+
+private:
+  const uint32_t mChannels;
+  const double mRatio; // input frames per output frame
+  uint32_t mTaps;
+  uint32_t mPhaseBits;
+  uint64_t mStep;
+  std::vector<float> mTable; // (phases + 1) rows of taps coefficients
+  std::vector<float> mCoefs;
+  const uint32_t mBlockFrames;
+  uint32_t mCapFrames;
+  std::vector<float> mBuf; // planar history, mCapFrames per channel
+  uint32_t mBufFrames;
+  uint64_t mPos;
+  std::vector<float> mInterleaved;
+
+  uint32_t available() const;
+  void append(const uint8_t *in, uint32_t inFormat, uint32_t numFrames);
+  void generate(uint8_t *out, uint32_t outFormat, uint32_t numFrames);
+  void compact();
+};
+
+} // namespace streampunk
+
+#endif
@@ -0,0 +1,677 @@
+/* Copyright 2019 Streampunk Media Ltd.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#include "SampleFormat.h"
+#include <cstring>
+#include <cmath>
+#include <atomic>
+#include <algorithm>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+#define NAUD_SSE2 1
+#endif
+#if defined(__GNUC__) || defined(_MSC_VER)
+#define NAUD_AVX2 1
+#endif
+#endif
+
+#if defined(__GNUC__)
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define TARGET_AVX2
+#endif
+
+namespace streampunk {
+
+bool isValidSampleFormat(uint32_t format) {
+  return (1 == format) || (8 == format) || (16 == format) || (24 == format) || (32 == format);
+}
+
+uint32_t sampleBytes(uint32_t format) {
+  return 1 == format ? 4 : format / 8;
+}
+
+static eSimdLevel cpuSimdLevel() {
+#if defined(NAUD_AVX2) && defined(__GNUC__)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2"))
+    return eSimdLevel::AVX2;
+#elif defined(NAUD_AVX2) && defined(_MSC_VER)
+  int info[4];
+  __cpuid(info, 1);
+  bool osAvx = (info[2] & (1 << 27)) && (info[2] & (1 << 28)) && ((_xgetbv(0) & 6) == 6);
+  __cpuidex(info, 7, 0);
+  if (osAvx && (info[1] & (1 << 5)))
+    return eSimdLevel::AVX2;
+#endif
+#if defined(NAUD_SSE2)
+  return eSimdLevel::SSE2;
+#else
+  return eSimdLevel::SCALAR;
+#endif
+}
+
+static const eSimdLevel sCpuLevel = cpuSimdLevel();
+static std::atomic<uint8_t> sLevel((uint8_t)sCpuLevel);
+
+eSimdLevel simdLevel() { return (eSimdLevel)sLevel.load(std::memory_order_relaxed); }
+
+void setSimdLevel(eSimdLevel level) {
+  sLevel.store((uint8_t)std::min<uint8_t>((uint8_t)level, (uint8_t)sCpuLevel), std::memory_order_relaxed);
+}
+
+// Integer samples are handled as int32 scaled to the full range, so that
+// widening is a shift and narrowing rounds from the bits shifted out
+static const float fromInt8 = 1.0f / 128.0f;
+static const float fromInt16 = 1.0f / 32768.0f;
+static const float fromInt24 = 1.0f / 8388608.0f;
+static const float fromInt32 = 1.0f / 2147483648.0f;
+// the largest float below 2^31, as 2^31 - 1 is not representable
+static const float maxInt32 = 2147483520.0f;
+
+static inline int32_t readInt24(const uint8_t *src) {
+  return (int32_t)(((uint32_t)src[0] << 8) | ((uint32_t)src[1] << 16) | ((uint32_t)src[2] << 24)) >> 8;
+}
+
+static inline void writeInt24(uint8_t *dst, int32_t v) {
+  dst[0] = (uint8_t)v; dst[1] = (uint8_t)(v >> 8); dst[2] = (uint8_t)(v >> 16);
+}
+
+static inline int32_t floatToInt(float f, float scale, float min, float max) {
+  return (int32_t)std::lrintf(std::min<float>(max, std::max<float>(min, f * scale)));
+}
+
+// round away the low bits of a full range int32 and saturate
+static inline int32_t narrowInt(int32_t v, uint32_t shift) {
+  int32_t r = ((v >> (shift - 1)) + 1) >> 1;
+  int32_t max = (int32_t)((1u << (31 - shift)) - 1);
+  return std::min<int32_t>(r, max);
+}
+
+// scalar kernels
+static void decodeFloatScalar(const uint8_t *src, uint32_t format, float *dst, uint32_t n) {
+  switch (format) {
+  case 1: memcpy(dst, src, n * 4); break;
+  case 8:
+    for (uint32_t i = 0; i < n; ++i)
+      dst[i] = (int8_t)src[i] * fromInt8;
+    break;
+  case 16:
+    for (uint32_t i = 0; i < n; ++i) {
+      int16_t v; memcpy(&v, src + i * 2, 2);
+      dst[i] = v * fromInt16;
+    }
+    break;
+  case 24:
+    for (uint32_t i = 0; i < n; ++i)
+      dst[i] = readInt24(src + i * 3) * fromInt24;
+    break;
+  case 32:
+    for (uint32_t i = 0; i < n; ++i) {
+      int32_t v; memcpy(&v, src + i * 4, 4);
+      dst[i] = v * fromInt32;
+    }
+    break;
+  default: break;
+  }
+}
+
+static void encodeFloatScalar(const float *src, uint32_t format, uint8_t *dst, uint32_t n) {
+  switch (format) {
+  case 1: memcpy(dst, src, n * 4); break;
+  case 8:
+    for (uint32_t i = 0; i < n; ++i)
+      dst[i] = (uint8_t)(int8_t)floatToInt(src[i], 128.0f, -128.0f, 127.0f);
+    break;
+  case 16:
+    for (uint32_t i = 0; i < n; ++i) {
+      int16_t v = (int16_t)floatToInt(src[i], 32768.0f, -32768.0f, 32767.0f);
+      memcpy(dst + i * 2, &v, 2);
+    }
+    break;
+  case 24:
+    for (uint32_t i = 0; i < n; ++i)
+      writeInt24(dst + i * 3, floatToInt(src[i], 8388608.0f, -8388608.0f, 8388607.0f));
+    break;
+  case 32:
+    for (uint32_t i = 0; i < n; ++i) {
+      int32_t v = floatToInt(src[i], 2147483648.0f, -2147483648.0f, maxInt32);
+      memcpy(dst + i * 4, &v, 4);
+    }
+    break;
+  default: break;
+  }
+}
+
+static void decodeIntScalar(const uint8_t *src, uint32_t format, int32_t *dst, uint32_t n) {
+  switch (format) {
+  case 8:
+    for (uint32_t i = 0; i < n; ++i)
+      dst[i] = (int32_t)((uint32_t)src[i] << 24);
+    break;
+  case 16:
+    for (uint32_t i = 0; i < n; ++i) {
+      int16_t v; memcpy(&v, src + i * 2, 2);
+      dst[i] = (int32_t)((uint32_t)(uint16_t)v << 16);
+    }
+    break;
+  case 24:
+    for (uint32_t i = 0; i < n; ++i)
+      dst[i] = (int32_t)((uint32_t)readInt24(src + i * 3) << 8);
+    break;
+  case 32: memcpy(dst, src, n * 4); break;
+  default: break;
+  }
+}
+
+static void encodeIntScalar(const int32_t *src, uint32_t format, uint8_t *dst, uint32_t n) {
+  switch (format) {
+  case 8:
+    for (uint32_t i = 0; i < n; ++i)
+      dst[i] = (uint8_t)(int8_t)narrowInt(src[i], 24);
+    break;
+  case 16:
+    for (uint32_t i = 0; i < n; ++i) {
+      int16_t v = (int16_t)narrowInt(src[i], 16);
+      memcpy(dst + i * 2, &v, 2);
+    }
+    break;
+  case 24:
+    for (uint32_t i = 0; i < n; ++i)
+      writeInt24(dst + i * 3, narrowInt(src[i], 8));
+    break;
+  case 32: memcpy(dst, src, n * 4); break;
+  default: break;
+  }
+}
+
+// Vector kernels convert a whole number of vectors and return the number of
+// samples done, leaving the rest to the scalar kernels. Formats without a
+// vector kernel return zero.
+#if defined(NAUD_SSE2)
+static uint32_t decodeFloatSse2(const uint8_t *src, uint32_t format, float *dst, uint32_t n) {
+  uint32_t i = 0;
+  switch (format) {
+  case 8: {
+    const __m128 scale = _mm_set1_ps(fromInt8);
+    for (; i + 16 <= n; i += 16) {
+      __m128i v = _mm_loadu_si128((const __m128i *)(src + i));
+      __m128i lo = _mm_unpacklo_epi8(v, v); // each byte in the top of a 16 bit lane
+      __m128i hi = _mm_unpackhi_epi8(v, v);
+      _mm_storeu_ps(dst + i, _mm_mul_ps(_mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(lo, lo), 24)), scale));
+      _mm_storeu_ps(dst + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(lo, lo), 24)), scale));
+      _mm_storeu_ps(dst + i + 8, _mm_mul_ps(_mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(hi, hi), 24)), scale));
+      _mm_storeu_ps(dst + i + 12, _mm_mul_ps(_mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(hi, hi), 24)), scale));
+    }
+    break;
+  }
+  case 16: {
+    const __m128 scale = _mm_set1_ps(fromInt16);
+    for (; i + 8 <= n; i += 8) {
+      __m128i v = _mm_loadu_si128((const __m128i *)(src + i * 2));
+      _mm_storeu_ps(dst + i, _mm_mul_ps(_mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16)), scale));
+      _mm_storeu_ps(dst + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16)), scale));
+    }
+    break;
+  }
+  case 32: {
+    const __m128 scale = _mm_set1_ps(fromInt32);
+    for (; i + 4 <= n; i += 4) {
+      __m128i v = _mm_loadu_si128((const __m128i *)(src + i * 4));
+      _mm_storeu_ps(dst + i, _mm_mul_ps(_mm_cvtepi32_ps(v), scale));
+    }
+    break;
+  }
+  default: break;
+  }
+  return i;
+}
+
+static inline __m128i floatToIntSse2(const float *src, __m128 scale, __m128 min, __m128 max) {
+  return _mm_cvtps_epi32(_mm_min_ps(max, _mm_max_ps(min, _mm_mul_ps(_mm_loadu_ps(src), scale))));
+}
+
+static uint32_t encodeFloatSse2(const float *src, uint32_t format, uint8_t *dst, uint32_t n) {
+  uint32_t i = 0;
+  switch (format) {
+  case 8: {
+    const __m128 scale = _mm_set1_ps(128.0f), min = _mm_set1_ps(-128.0f), max = _mm_set1_ps(127.0f);
+    for (; i + 16 <= n; i += 16) {
+      __m128i a = _mm_packs_epi32(floatToIntSse2(src + i, scale, min, max), floatToIntSse2(src + i + 4, scale, min, max));
+      __m128i b = _mm_packs_epi32(floatToIntSse2(src + i + 8, scale, min, max), floatToIntSse2(src + i + 12, scale, min, max));
+      _mm_storeu_si128((__m128i *)(dst + i), _mm_packs_epi16(a, b));
+    }
+    break;
+  }
+  case 16: {
+    const __m128 scale = _mm_set1_ps(32768.0f), min = _mm_set1_ps(-32768.0f), max = _mm_set1_ps(32767.0f);
+    for (; i + 8 <= n; i += 8)
+      _mm_storeu_si128((__m128i *)(dst + i * 2),
+        _mm_packs_epi32(floatToIntSse2(src + i, scale, min, max), floatToIntSse2(src + i + 4, scale, min, max)));
+    break;
+  }
+  case 32: {
+    const __m128 scale = _mm_set1_ps(2147483648.0f), min = _mm_set1_ps(-2147483648.0f), max = _mm_set1_ps(maxInt32);
+    for (; i + 4 <= n; i += 4)
+      _mm_storeu_si128((__m128i *)(dst + i * 4), floatToIntSse2(src + i, scale, min, max));
+    break;
+  }
+  default: break;
+  }
+  return i;
+}
+
+static uint32_t decodeIntSse2(const uint8_t *src, uint32_t format, int32_t *dst, uint32_t n) {
+  uint32_t i = 0;
+  if (16 == format) {
+    const __m128i zero = _mm_setzero_si128();
+    for (; i + 8 <= n; i += 8) {
+      __m128i v = _mm_loadu_si128((const __m128i *)(src + i * 2));
+      _mm_storeu_si128((__m128i *)(dst + i), _mm_unpacklo_epi16(zero, v));
+      _mm_storeu_si128((__m128i *)(dst + i + 4), _mm_unpackhi_epi16(zero, v));
+    }
+  }
+  return i;
+}
+
+static uint32_t encodeIntSse2(const int32_t *src, uint32_t format, uint8_t *dst, uint32_t n) {
+  uint32_t i = 0;
+  if (16 == format) {
+    const __m128i one = _mm_set1_epi32(1);
+    for (; i + 8 <= n; i += 8) {
+      __m128i a = _mm_srai_epi32(_mm_add_epi32(_mm_srai_epi32(_mm_loadu_si128((const __m128i *)(src + i)), 15), one), 1);
+      __m128i b = _mm_srai_epi32(_mm_add_epi32(_mm_srai_epi32(_mm_loadu_si128((const __m128i *)(src + i + 4)), 15), one), 1);
+      _mm_storeu_si128((__m128i *)(dst + i * 2), _mm_packs_epi32(a, b));
+    }
+  }
+  return i;
+}
+#endif
+
+#if defined(NAUD_AVX2)
+TARGET_AVX2 static uint32_t decodeFloatAvx2(const uint8_t *src, uint32_t format, float *dst, uint32_t n) {
+  uint32_t i = 0;
+  switch (format) {
+  case 8: {
+    const __m256 scale = _mm256_set1_ps(fromInt8);
+    for (; i + 8 <= n; i += 8) {
+      __m256i v = _mm256_cvtepi8_epi32(_mm_loadl_epi64((const __m128i *)(src + i)));
+      _mm256_storeu_ps(dst + i, _mm256_mul_ps(_mm256_cvtepi32_ps(v), scale));
+    }
+    break;
+  }
+  case 16: {
+    const __m256 scale = _mm256_set1_ps(fromInt16);
+    for (; i + 8 <= n; i += 8) {
+      __m256i v = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *)(src + i * 2)));
+      _mm256_storeu_ps(dst + i, _mm256_mul_ps(_mm256_cvtepi32_ps(v), scale));
+    }
+    break;
+  }
+  case 32: {
+    const __m256 scale = _mm256_set1_ps(fromInt32);
+    for (; i + 8 <= n; i += 8) {
+      __m256i v = _mm256_loadu_si256((const __m256i *)(src + i * 4));
+      _mm256_storeu_ps(dst + i, _mm256_mul_ps(_mm256_cvtepi32_ps(v), scale));
+    }
+    break;
+  }
+  default: break;
+  }
+  return i;
+}
+
+TARGET_AVX2 static inline __m256i floatToIntAvx2(const float *src, __m256 scale, __m256 min, __m256 max) {
+  return _mm256_cvtps_epi32(_mm256_min_ps(max, _mm256_max_ps(min, _mm256_mul_ps(_mm256_loadu_ps(src), scale))));
+}
+
+TARGET_AVX2 static uint32_t encodeFloatAvx2(const float *src, uint32_t format, uint8_t *dst, uint32_t n) {
+  uint32_t i = 0;
+  switch (format) {
+  case 16: {
+    const __m256 scale = _mm256_set1_ps(32768.0f), min = _mm256_set1_ps(-32768.0f), max = _mm256_set1_ps(32767.0f);
+    for (; i + 16 <= n; i += 16) {
+      // packing works within 128 bit lanes, so the 64 bit quarters are put back in order
+      __m256i v = _mm256_packs_epi32(floatToIntAvx2(src + i, scale, min, max), floatToIntAvx2(src + i + 8, scale, min, max));
+      _mm256_storeu_si256((__m256i *)(dst + i * 2), _mm256_permute4x64_epi64(v, 0xd8));
+    }
+    break;
+  }
+  case 32: {
+    const __m256 scale = _mm256_set1_ps(2147483648.0f), min = _mm256_set1_ps(-2147483648.0f), max = _mm256_set1_ps(maxInt32);
+    for (; i + 8 <= n; i += 8)
+      _mm256_storeu_si256((__m256i *)(dst + i * 4), floatToIntAvx2(src + i, scale, min, max));
+    break;
+  }
+  default: break;
+  }
+  return i;
+}
+#endif
+
+static void decodeFloat(const uint8_t *src, uint32_t format, float *dst, uint32_t n, eSimdLevel level) {
+  uint32_t done = 0;
+#if defined(NAUD_AVX2)
+  if (level >= eSimdLevel::AVX2)
+    done = decodeFloatAvx2(src, format, dst, n);
+#endif
+#if defined(NAUD_SSE2)
+  if (level >= eSimdLevel::SSE2)
+    done += decodeFloatSse2(src + done * sampleBytes(format), format, dst + done, n - done);
+#endif
+  decodeFloatScalar(src + done * sampleBytes(format), format, dst + done, n - done);
+}
+
+static void encodeFloat(const float *src, uint32_t format, uint8_t *dst, uint32_t n, eSimdLevel level) {
+  uint32_t done = 0;
+#if defined(NAUD_AVX2)
+  if (level >= eSimdLevel::AVX2)
+    done = encodeFloatAvx2(src, format, dst, n);
+#endif
+#if defined(NAUD_SSE2)
+  if (level >= eSimdLevel::SSE2)
+    done += encodeFloatSse2(src + done, format, dst + done * sampleBytes(format), n - done);
+#endif
+  encodeFloatScalar(src + done, format, dst + done * sampleBytes(format), n - done);
+}
+
+static void decodeInt(const uint8_t *src, uint32_t format, int32_t *dst, uint32_t n, eSimdLevel level) {
+  uint32_t done = 0;
+#if defined(NAUD_SSE2)
+  if (level >= eSimdLevel::SSE2)
+    done = decodeIntSse2(src, format, dst, n);
+#endif
+  decodeIntScalar(src + done * sampleBytes(format), format, dst + done, n - done);
+}
+
+static void encodeInt(const int32_t *src, uint32_t format, uint8_t *dst, uint32_t n, eSimdLevel level) {
+  uint32_t done = 0;
+#if defined(NAUD_SSE2)
+  if (level >= eSimdLevel::SSE2)
+    done = encodeIntSse2(src, format, dst, n);
+#endif
+  encodeIntScalar(src + done, format, dst + done * sampleBytes(format), n - done);
+}
+
+// Mixing kernels start at sample i with gain + i * gainInc and return the samples done
+static uint32_t mixScalar(float *dst, const float *src, float gain, float gainInc, uint32_t i, uint32_t n) {
+  for (; i < n; ++i)
+    dst[i] += src[i] * (gain + i * gainInc);
+  return i;
+}
+
+#if defined(NAUD_SSE2)
+static uint32_t mixSse2(float *dst, const float *src, float gain, float gainInc, uint32_t i, uint32_t n) {
+  __m128 g = _mm_add_ps(_mm_set1_ps(gain + i * gainInc), _mm_mul_ps(_mm_set_ps(3.0f, 2.0f, 1.0f, 0.0f), _mm_set1_ps(gainInc)));
+  const __m128 step = _mm_set1_ps(4.0f * gainInc);
+  for (; i + 4 <= n; i += 4) {
+    _mm_storeu_ps(dst + i, _mm_add_ps(_mm_loadu_ps(dst + i), _mm_mul_ps(_mm_loadu_ps(src + i), g)));
+    g = _mm_add_ps(g, step);
+  }
+  return i;
+}
+#endif
+
+#if defined(NAUD_AVX2)
+TARGET_AVX2 static uint32_t mixAvx2(float *dst, const float *src, float gain, float gainInc, uint32_t i, uint32_t n) {
+  __m256 g = _mm256_add_ps(_mm256_set1_ps(gain + i * gainInc),
+    _mm256_mul_ps(_mm256_set_ps(7.0f, 6.0f, 5.0f, 4.0f, 3.0f, 2.0f, 1.0f, 0.0f), _mm256_set1_ps(gainInc)));
+  const __m256 step = _mm256_set1_ps(8.0f * gainInc);
+  for (; i + 8 <= n; i += 8) {
+    _mm256_storeu_ps(dst + i, _mm256_add_ps(_mm256_loadu_ps(dst + i), _mm256_mul_ps(_mm256_loadu_ps(src + i), g)));
+    g = _mm256_add_ps(g, step);
+  }
+  return i;
+}
+#endif
+
+void mixSamples(float *dst, const float *src, float startGain, float endGain, uint32_t numSamples) {
+  float gainInc = numSamples ? (endGain - startGain) / numSamples : 0.0f;
+  eSimdLevel level = simdLevel();
+  uint32_t done = 0;
+#if defined(NAUD_AVX2)
+  if (level >= eSimdLevel::AVX2)
+    done = mixAvx2(dst, src, startGain, gainInc, done, numSamples);
+#endif
+#if defined(NAUD_SSE2)
+  if (level >= eSimdLevel::SSE2)
+    done = mixSse2(dst, src, startGain, gainInc, done, numSamples);
+#endif
+  mixScalar(dst, src, startGain, gainInc, done, numSamples);
+}
+
+// Gain kernels start at sample i with gain + i * gainInc and return the samples done
+static uint32_t gainScalar(float *buf, float gain, float gainInc, uint32_t i, uint32_t n) {
+  for (; i < n; ++i)
+    buf[i] *= gain + i * gainInc;
+  return i;
+}
+
+#if defined(NAUD_SSE2)
+static uint32_t gainSse2(float *buf, float gain, float gainInc, uint32_t i, uint32_t n) {
+  __m128 g = _mm_add_ps(_mm_set1_ps(gain + i * gainInc), _mm_mul_ps(_mm_set_ps(3.0f, 2.0f, 1.0f, 0.0f), _mm_set1_ps(gainInc)));
+  const __m128 step = _mm_set1_ps(4.0f * gainInc);
+  for (; i + 4 <= n; i += 4) {
+    _mm_storeu_ps(buf + i, _mm_mul_ps(_mm_loadu_ps(buf + i), g));
+    g = _mm_add_ps(g, step);
+  }
+  return i;
+}
+#endif
+
+#if defined(NAUD_AVX2)
+TARGET_AVX2 static uint32_t gainAvx2(float *buf, float gain, float gainInc, uint32_t i, uint32_t n) {
+  __m256 g = _mm256_add_ps(_mm256_set1_ps(gain + i * gainInc),
+    _mm256_mul_ps(_mm256_set_ps(7.0f, 6.0f, 5.0f, 4.0f, 3.0f, 2.0f, 1.0f, 0.0f), _mm256_set1_ps(gainInc)));
+  const __m256 step = _mm256_set1_ps(8.0f * gainInc);
+  for (; i + 8 <= n; i += 8) {
+    _mm256_storeu_ps(buf + i, _mm256_mul_ps(_mm256_loadu_ps(buf + i), g));
+    g = _mm256_add_ps(g, step);
+  }
+  return i;
+}
+#endif
+
+void gainSamples(float *buf, float startGain, float endGain, uint32_t numSamples) {
+  float gainInc = numSamples ? (endGain - startGain) / numSamples : 0.0f;
+  eSimdLevel level = simdLevel();
+  uint32_t done = 0;
+#if defined(NAUD_AVX2)
+  if (level >= eSimdLevel::AVX2)
+    done = gainAvx2(buf, startGain, gainInc, done, numSamples);
+#endif
+#if defined(NAUD_SSE2)
+  if (level >= eSimdLevel::SSE2)
+    done = gainSse2(buf, startGain, gainInc, done, numSamples);
+#endif
+  gainScalar(buf, startGain, gainInc, done, numSamples);
+}
+
+// Metering kernels start at sample i, on a frame boundary. The vector kernels keep a lane
+// per sample of a vector when whole frames fit a vector - lane l then always holds channel
+// l % channels, and the lanes are folded into the channels at the end. When the channels
+// fill whole vectors instead, each column of channels is metered down the frames in turn.
+static uint32_t meterScalar(const float *src, uint32_t channels, float clipLevel,
+                            float *peak, float *sumSq, uint32_t *clips, uint32_t i, uint32_t n) {
+  uint32_t c = i % channels;
+  for (; i < n; ++i) {
+    float a = std::fabs(src[i]);
+    peak[c] = std::max(peak[c], a);
+    sumSq[c] += src[i] * src[i];
+    clips[c] += a >= clipLevel ? 1 : 0;
+    if (++c == channels)
+      c = 0;
+  }
+  return i;
+}
+
+#if defined(NAUD_SSE2)
+static uint32_t meterColumnsSse2(const float *src, uint32_t channels, float clipLevel,
+                                 float *peak, float *sumSq, uint32_t *clips, uint32_t i, uint32_t n) {
+  const __m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+  const __m128 clip = _mm_set1_ps(clipLevel);
+  for (uint32_t c = 0; c < channels; c += 4) {
+    __m128 vPeak = _mm_loadu_ps(peak + c);
+    __m128 vSum = _mm_loadu_ps(sumSq + c);
+    __m128i vClips = _mm_loadu_si128((const __m128i *)(clips + c));
+    for (uint32_t s = i + c; s < n; s += channels) {
+      __m128 x = _mm_loadu_ps(src + s);
+      __m128 a = _mm_and_ps(x, absMask);
+      vPeak = _mm_max_ps(vPeak, a);
+      vSum = _mm_add_ps(vSum, _mm_mul_ps(x, x));
+      vClips = _mm_sub_epi32(vClips, _mm_castps_si128(_mm_cmpge_ps(a, clip)));
+    }
+    _mm_storeu_ps(peak + c, vPeak);
+    _mm_storeu_ps(sumSq + c, vSum);
+    _mm_storeu_si128((__m128i *)(clips + c), vClips);
+  }
+  return n;
+}
+
+static uint32_t meterSse2(const float *src, uint32_t channels, float clipLevel,
+                          float *peak, float *sumSq, uint32_t *clips, uint32_t i, uint32_t n) {
+  if (0 == channels % 4)
+    return meterColumnsSse2(src, channels, clipLevel, peak, sumSq, clips, i, n);
+  if (4 % channels)
+    return i;
+  const __m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+  const __m128 clip = _mm_set1_ps(clipLevel);
+  __m128 vPeak = _mm_setzero_ps();
+  __m128 vSum = _mm_setzero_ps();
+  __m128i vClips = _mm_setzero_si128();
+  for (; i + 4 <= n; i += 4) {
+    __m128 x = _mm_loadu_ps(src + i);
+    __m128 a = _mm_and_ps(x, absMask);
+    vPeak = _mm_max_ps(vPeak, a);
+    vSum = _mm_add_ps(vSum, _mm_mul_ps(x, x));
+    vClips = _mm_sub_epi32(vClips, _mm_castps_si128(_mm_cmpge_ps(a, clip)));
+  }
+  float lPeak[4], lSum[4];
+  int32_t lClips[4];
+  _mm_storeu_ps(lPeak, vPeak);
+  _mm_storeu_ps(lSum, vSum);
+  _mm_storeu_si128((__m128i *)lClips, vClips);
+  for (uint32_t l = 0; l < 4; ++l) {
+    peak[l % channels] = std::max(peak[l % channels], lPeak[l]);
+    sumSq[l % channels] += lSum[l];
+    clips[l % channels] += lClips[l];
+  }
+  return i;
+}
+#endif
+
+#if defined(NAUD_AVX2)
+TARGET_AVX2 static uint32_t meterColumnsAvx2(const float *src, uint32_t channels, float clipLevel,
+                                             float *peak, float *sumSq, uint32_t *clips, uint32_t i, uint32_t n) {
+  const __m256 absMask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff));
+  const __m256 clip = _mm256_set1_ps(clipLevel);
+  for (uint32_t c = 0; c < channels; c += 8) {
+    __m256 vPeak = _mm256_loadu_ps(peak + c);
+    __m256 vSum = _mm256_loadu_ps(sumSq + c);
+    __m256i vClips = _mm256_loadu_si256((const __m256i *)(clips + c));
+    for (uint32_t s = i + c; s < n; s += channels) {
+      __m256 x = _mm256_loadu_ps(src + s);
+      __m256 a = _mm256_and_ps(x, absMask);
+      vPeak = _mm256_max_ps(vPeak, a);
+      vSum = _mm256_add_ps(vSum, _mm256_mul_ps(x, x));
+      vClips = _mm256_sub_epi32(vClips, _mm256_castps_si256(_mm256_cmp_ps(a, clip, _CMP_GE_OQ)));
+    }
+    _mm256_storeu_ps(peak + c, vPeak);
+    _mm256_storeu_ps(sumSq + c, vSum);
+    _mm256_storeu_si256((__m256i *)(clips + c), vClips);
+  }
+  return n;
+}
+
+TARGET_AVX2 static uint32_t meterAvx2(const float *src, uint32_t channels, float clipLevel,
+                                      float *peak, float *sumSq, uint32_t *clips, uint32_t i, uint32_t n) {
+  if (0 == channels % 8)
+    return meterColumnsAvx2(src, channels, clipLevel, peak, sumSq, clips, i, n);
+  if (8 % channels)
+    return i;
+  const __m256 absMask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff));
+  const __m256 clip = _mm256_set1_ps(clipLevel);
+  __m256 vPeak = _mm256_setzero_ps();
+  __m256 vSum = _mm256_setzero_ps();
+  __m256i vClips = _mm256_setzero_si256();
+  for (; i + 8 <= n; i += 8) {
+    __m256 x = _mm256_loadu_ps(src + i);
+    __m256 a = _mm256_and_ps(x, absMask);
+    vPeak = _mm256_max_ps(vPeak, a);
+    vSum = _mm256_add_ps(vSum, _mm256_mul_ps(x, x));
+    vClips = _mm256_sub_epi32(vClips, _mm256_castps_si256(_mm256_cmp_ps(a, clip, _CMP_GE_OQ)));
+  }
+  float lPeak[8], lSum[8];
+  int32_t lClips[8];
+  _mm256_storeu_ps(lPeak, vPeak);
+  _mm256_storeu_ps(lSum, vSum);
+  _mm256_storeu_si256((__m256i *)lClips, vClips);
+  for (uint32_t l = 0; l < 8; ++l) {
+    peak[l % channels] = std::max(peak[l % channels], lPeak[l]);
+    sumSq[l % channels] += lSum[l];
+    clips[l % channels] += lClips[l];
+  }
+  return i;
+}
+#endif
+
+void meterSamples(const float *src, uint32_t channels, uint32_t numFrames, float clipLevel,
+                  float *peak, float *sumSq, uint32_t *clips) {
+  uint32_t numSamples = numFrames * channels;
+  eSimdLevel level = simdLevel();
+  uint32_t done = 0;
+#if defined(NAUD_AVX2)
+  if (level >= eSimdLevel::AVX2)
+    done = meterAvx2(src, channels, clipLevel, peak, sumSq, clips, done, numSamples);
+#endif
+#if defined(NAUD_SSE2)
+  if (level >= eSimdLevel::SSE2)
+    done = meterSse2(src, channels, clipLevel, peak, sumSq, clips, done, numSamples);
+#endif
+  meterScalar(src, channels, clipLevel, peak, sumSq, clips, done, numSamples);
+}
+
+void convertSamples(const uint8_t *src, uint32_t srcFormat,
+                    uint8_t *dst, uint32_t dstFormat, uint32_t numSamples) {
+  if (srcFormat == dstFormat) {
+    memcpy(dst, src, numSamples * sampleBytes(srcFormat));
+    return;
+  }
+
+  eSimdLevel level = simdLevel();
+  if (1 == srcFormat)
+    encodeFloat((const float *)src, dstFormat, dst, numSamples, level);
+  else if (1 == dstFormat)
+    decodeFloat(src, srcFormat, (float *)dst, numSamples, level);
+  else {
+    // between integer formats in blocks that stay in the L1 cache
+    const uint32_t blockSamples = 256;
+    int32_t block[blockSamples];
+    uint32_t srcBytes = sampleBytes(srcFormat);
+    uint32_t dstBytes = sampleBytes(dstFormat);
+    for (uint32_t i = 0; i < numSamples; i += blockSamples) {
+      uint32_t n = std::min<uint32_t>(blockSamples, numSamples - i);
+      decodeInt(src + i * srcBytes, srcFormat, block, n, level);
+      encodeInt(block, dstFormat, dst + i * dstBytes, n, level);
+    }
+  }
+}
+
+} // namespace streampunk
@@ -0,0 +1,56 @@
+/* Copyright 2019 Streampunk Media Ltd.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#ifndef SAMPLEFORMAT_H
+#define SAMPLEFORMAT_H
+
+#include <cstdint>
+
+namespace streampunk {
+
+// Sample formats are given as in the stream options - 1 for float32, otherwise
+// the number of bits in a signed integer sample: 8, 16, 24 (packed) or 32.
+bool isValidSampleFormat(uint32_t format);
+uint32_t sampleBytes(uint32_t format);
+
+// Convert numSamples samples from one format to another. Integer samples are
+// scaled by the full range of their type, so that +/-1.0 is full scale as float.
+// Conversion to a narrower format rounds and saturates. The buffers must not overlap.
+void convertSamples(const uint8_t *src, uint32_t srcFormat,
+                    uint8_t *dst, uint32_t dstFormat, uint32_t numSamples);
+
+// Add numSamples float samples from src into dst, scaled by a gain that moves
+// linearly from startGain towards endGain across the samples.
+void mixSamples(float *dst, const float *src, float startGain, float endGain, uint32_t numSamples);
+
+// Scale numSamples float samples in place by a gain that moves linearly from
+// startGain towards endGain across the samples.
+void gainSamples(float *buf, float startGain, float endGain, uint32_t numSamples);
+
+// Accumulate the levels of each channel of numFrames interleaved float frames:
+// the peak magnitude into peak, the sum of squares into sumSq and the number of
+// samples at or beyond clipLevel into clips.
+void meterSamples(const float *src, uint32_t channels, uint32_t numFrames, float clipLevel,
+                  float *peak, float *sumSq, uint32_t *clips);
+
+// Vector instructions are used where the CPU has them. The level may be
+// lowered, for example to compare kernels, but not raised beyond the CPU.
+enum class eSimdLevel : uint8_t { SCALAR = 0, SSE2 = 1, AVX2 = 2 };
+eSimdLevel simdLevel();
+void setSimdLevel(eSimdLevel level);
+
+} // namespace streampunk
+
+#endif
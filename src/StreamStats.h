@@ -0,0 +1,176 @@
+/* Copyright 2019 Streampunk Media Ltd.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#ifndef STREAMSTATS_H
+#define STREAMSTATS_H
+
+#include <portaudio.h>
+#include <atomic>
+#include <cstdint>
+#include <algorithm>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+namespace streampunk {
+
+// number of zero bits above the highest set bit of a non-zero value
+inline uint32_t countLeadingZeros(uint64_t value) {
+#if defined(__GNUC__)
+  return (uint32_t)__builtin_clzll(value);
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_ARM64))
+  unsigned long index;
+  _BitScanReverse64(&index, value);
+  return 63 - (uint32_t)index;
+#else
+  uint32_t zeros = 0;
+  while (!(value & (1ULL << 63))) {
+    value <<= 1;
+    ++zeros;
+  }
+  return zeros;
+#endif
+}
+
+// Keeps track of the peak of a value that is updated from more than one thread
+class PeakValue {
+public:
+  PeakValue() : mValue(0) {}
+  void update(uint64_t value) {
+    uint64_t peak = mValue.load(std::memory_order_relaxed);
+    while ((value > peak) && !mValue.compare_exchange_weak(peak, value, std::memory_order_relaxed)) {}
+  }
+  uint64_t get() const { return mValue.load(std::memory_order_relaxed); }
+
+private:
+  std::atomic<uint64_t> mValue;
+};
+
+// Histogram of durations in nanoseconds, with four buckets to each power of two,
+// from which percentiles may be estimated to within 25%
+class DurationHistogram {
+public:
+  DurationHistogram() : mCount(0), mTotalNs(0), mMinNs(UINT64_MAX) {
+    for (uint32_t i = 0; i < numBuckets; ++i)
+      mBuckets[i] = 0;
+  }
+
+  void add(uint64_t ns) {
+    mBuckets[bucket(ns)].fetch_add(1, std::memory_order_relaxed);
+    mCount.fetch_add(1, std::memory_order_relaxed);
+    mTotalNs.fetch_add(ns, std::memory_order_relaxed);
+    uint64_t min = mMinNs.load(std::memory_order_relaxed);
+    while ((ns < min) && !mMinNs.compare_exchange_weak(min, ns, std::memory_order_relaxed)) {}
+    mMaxNs.update(ns);
+  }
+
+  uint64_t count() const { return mCount.load(std::memory_order_relaxed); }
+  uint64_t minNs() const { return count() ? mMinNs.load(std::memory_order_relaxed) : 0; }
+  uint64_t maxNs() const { return mMaxNs.get(); }
+  double avgNs() const { return count() ? (double)mTotalNs.load(std::memory_order_relaxed) / count() : 0.0; }
+
+  // upper bound of the bucket holding the given fraction of durations
+  uint64_t percentileNs(double fraction) const {
+    uint64_t total = 0;
+    uint64_t counts[numBuckets];
+    for (uint32_t i = 0; i < numBuckets; ++i)
+      total += counts[i] = mBuckets[i].load(std::memory_order_relaxed);
+    uint64_t target = std::max<uint64_t>(1, (uint64_t)(fraction * total + 0.5));
+    uint64_t seen = 0;
+    for (uint32_t i = 0; i < numBuckets; ++i) {
+      seen += counts[i];
+      if (total && (seen >= target))
+        return std::min<uint64_t>(bucketLimit(i), maxNs());
+    }
+    return maxNs();
+  }
+
+private:
+  static const uint32_t numBuckets = 256;
+  std::atomic<uint64_t> mBuckets[numBuckets];
+  std::atomic<uint64_t> mCount;
+  std::atomic<uint64_t> mTotalNs;
+  std::atomic<uint64_t> mMinNs;
+  PeakValue mMaxNs;
+
+  static uint32_t bucket(uint64_t ns) {
+    if (ns < 4)
+      return (uint32_t)ns;
+    uint32_t log2 = 63 - countLeadingZeros(ns);
+    return std::min<uint32_t>(numBuckets - 1, log2 * 4 + (uint32_t)((ns >> (log2 - 2)) & 3));
+  }
+  static uint64_t bucketLimit(uint32_t b) {
+    if (b < 8)
+      return b;
+    uint32_t log2 = b / 4;
+    return ((uint64_t)(4 + (b & 3) + 1) << (log2 - 2)) - 1;
+  }
+};
+
+// Counters for a stream, updated without locking from the PortAudio callback
+// and read from the JS thread
+class StreamStats {
+public:
+  StreamStats()
+    : mCallbacks(0), mFrames(0), mInputUnderflows(0), mInputOverflows(0),
+      mOutputUnderflows(0), mOutputOverflows(0), mPrimingOutputs(0) {}
+
+  void callback(uint32_t frameCount, uint32_t statusFlags, uint64_t durationNs) {
+    mCallbacks.fetch_add(1, std::memory_order_relaxed);
+    mFrames.fetch_add(frameCount, std::memory_order_relaxed);
+    if (statusFlags) {
+      if (statusFlags & paInputUnderflow) mInputUnderflows.fetch_add(1, std::memory_order_relaxed);
+      if (statusFlags & paInputOverflow) mInputOverflows.fetch_add(1, std::memory_order_relaxed);
+      if (statusFlags & paOutputUnderflow) mOutputUnderflows.fetch_add(1, std::memory_order_relaxed);
+      if (statusFlags & paOutputOverflow) mOutputOverflows.fetch_add(1, std::memory_order_relaxed);
+      if (statusFlags & paPrimingOutput) mPrimingOutputs.fetch_add(1, std::memory_order_relaxed);
+    }
+    mDuration.add(durationNs);
+  }
+
+  void inQueued(uint64_t bytes, uint64_t chunks) { mInPeakBytes.update(bytes); mInPeakChunks.update(chunks); }
+  void outQueued(uint64_t bytes, uint64_t chunks) { mOutPeakBytes.update(bytes); mOutPeakChunks.update(chunks); }
+
+  uint64_t callbacks() const { return mCallbacks.load(std::memory_order_relaxed); }
+  uint64_t frames() const { return mFrames.load(std::memory_order_relaxed); }
+  uint64_t inputUnderflows() const { return mInputUnderflows.load(std::memory_order_relaxed); }
+  uint64_t inputOverflows() const { return mInputOverflows.load(std::memory_order_relaxed); }
+  uint64_t outputUnderflows() const { return mOutputUnderflows.load(std::memory_order_relaxed); }
+  uint64_t outputOverflows() const { return mOutputOverflows.load(std::memory_order_relaxed); }
+  uint64_t primingOutputs() const { return mPrimingOutputs.load(std::memory_order_relaxed); }
+  uint64_t inPeakBytes() const { return mInPeakBytes.get(); }
+  uint64_t inPeakChunks() const { return mInPeakChunks.get(); }
+  uint64_t outPeakBytes() const { return mOutPeakBytes.get(); }
+  uint64_t outPeakChunks() const { return mOutPeakChunks.get(); }
+  const DurationHistogram &duration() const { return mDuration; }
+
+private:
+  std::atomic<uint64_t> mCallbacks;
+  std::atomic<uint64_t> mFrames;
+  std::atomic<uint64_t> mInputUnderflows;
+  std::atomic<uint64_t> mInputOverflows;
+  std::atomic<uint64_t> mOutputUnderflows;
+  std::atomic<uint64_t> mOutputOverflows;
+  std::atomic<uint64_t> mPrimingOutputs;
+  PeakValue mInPeakBytes;
+  PeakValue mInPeakChunks;
+  PeakValue mOutPeakBytes;
+  PeakValue mOutPeakChunks;
+  DurationHistogram mDuration;
+};
+
+} // namespace streampunk
+
+#endif
@@ -0,0 +1,126 @@
+/* Copyright 2019 Streampunk Media Ltd.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#include "Tracer.h"
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <map>
+#include <thread>
+#include <functional>
+
+namespace streampunk {
+
+static uint32_t ringSize(uint32_t numEvents) {
+  uint32_t size = 1;
+  while (size < numEvents)
+    size <<= 1;
+  return size;
+}
+
+Tracer::Tracer(uint32_t numEvents)
+  : mStart(std::chrono::steady_clock::now()), mMask(ringSize(numEvents) - 1),
+    mEvents(new Event[mMask + 1]), mNext(0) {
+  for (uint32_t i = 0; i <= mMask; ++i)
+    mEvents[i].seq.store(0, std::memory_order_relaxed);
+}
+
+uint32_t Tracer::threadId() {
+  return (uint32_t)(std::hash<std::thread::id>()(std::this_thread::get_id()) & 0x7fffffff);
+}
+
+void Tracer::add(const char *name, const char *thread, uint64_t beginNs, uint64_t endNs,
+                 int64_t inDepth, int64_t outDepth) {
+  uint64_t index = mNext.fetch_add(1, std::memory_order_relaxed);
+  Event &e = mEvents[index & mMask];
+  e.seq.store(0, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  e.name.store(name, std::memory_order_relaxed);
+  e.thread.store(thread, std::memory_order_relaxed);
+  e.tid.store(threadId(), std::memory_order_relaxed);
+  e.begin.store(beginNs, std::memory_order_relaxed);
+  e.end.store(endNs, std::memory_order_relaxed);
+  e.inDepth.store(inDepth, std::memory_order_relaxed);
+  e.outDepth.store(outDepth, std::memory_order_relaxed);
+  e.seq.store(index + 1, std::memory_order_release);
+}
+
+bool Tracer::dump(const std::string &path, std::string &errStr) const {
+  FILE *f = fopen(path.c_str(), "w");
+  if (!f) {
+    errStr = std::string("Failed to open trace file ") + path + ": " + strerror(errno);
+    return false;
+  }
+
+  uint64_t next = mNext.load(std::memory_order_acquire);
+  uint64_t first = next > (mMask + 1) ? next - (mMask + 1) : 0;
+  std::map<uint32_t, const char *> threads;
+  const char *sep = "";
+  fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+  for (uint64_t i = first; i < next; ++i) {
+    const Event &e = mEvents[i & mMask];
+    if (e.seq.load(std::memory_order_acquire) != i + 1)
+      continue; // still being written, or already overwritten
+    const char *name = e.name.load(std::memory_order_relaxed);
+    const char *thread = e.thread.load(std::memory_order_relaxed);
+    uint32_t tid = e.tid.load(std::memory_order_relaxed);
+    uint64_t begin = e.begin.load(std::memory_order_relaxed);
+    uint64_t end = e.end.load(std::memory_order_relaxed);
+    int64_t inDepth = e.inDepth.load(std::memory_order_relaxed);
+    int64_t outDepth = e.outDepth.load(std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (e.seq.load(std::memory_order_relaxed) != i + 1)
+      continue;
+
+    threads.insert(std::make_pair(tid, thread));
+    fprintf(f, "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f,\"args\":{",
+      sep, name, tid, begin / 1000.0, (end - begin) / 1000.0);
+    sep = ",\n";
+    const char *argSep = "";
+    if (inDepth >= 0) {
+      fprintf(f, "\"inQueueBytes\":%lld", (long long)inDepth);
+      argSep = ",";
+    }
+    if (outDepth >= 0)
+      fprintf(f, "%s\"outQueueBytes\":%lld", argSep, (long long)outDepth);
+    fprintf(f, "}}");
+
+    // queue depths are also shown as counters, which are drawn as a graph
+    if ((inDepth >= 0) || (outDepth >= 0)) {
+      fprintf(f, "%s{\"name\":\"queue bytes\",\"ph\":\"C\",\"pid\":1,\"ts\":%.3f,\"args\":{", sep, end / 1000.0);
+      argSep = "";
+      if (inDepth >= 0) {
+        fprintf(f, "\"in\":%lld", (long long)inDepth);
+        argSep = ",";
+      }
+      if (outDepth >= 0)
+        fprintf(f, "%s\"out\":%lld", argSep, (long long)outDepth);
+      fprintf(f, "}}");
+    }
+  }
+
+  for (auto t : threads)
+    fprintf(f, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"%s\"}}",
+      sep, t.first, t.second);
+  fprintf(f, "\n]}\n");
+
+  if (0 != fclose(f)) {
+    errStr = std::string("Failed to write trace file ") + path + ": " + strerror(errno);
+    return false;
+  }
+  return true;
+}
+
+} // namespace streampunk
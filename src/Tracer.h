@@ -0,0 +1,89 @@
+/* Copyright 2019 Streampunk Media Ltd.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#ifndef TRACER_H
+#define TRACER_H
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <string>
+
+namespace streampunk {
+
+// Ring of timed events written without locking from any thread - the audio
+// callback, libuv workers and the JS thread - so that they can be viewed side by
+// side. Once full the oldest events are overwritten. Queue depths of -1 are unset.
+class Tracer {
+public:
+  Tracer(uint32_t numEvents);
+  ~Tracer() {}
+
+  // nanoseconds since the tracer was created
+  uint64_t now() const {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - mStart).count();
+  }
+
+  void add(const char *name, const char *thread, uint64_t beginNs, uint64_t endNs,
+           int64_t inDepth, int64_t outDepth);
+
+  // write the events held in Chrome Trace Event format
+  bool dump(const std::string &path, std::string &errStr) const;
+
+private:
+  struct Event {
+    std::atomic<uint64_t> seq; // one more than the event index once written, zero while writing
+    std::atomic<const char *> name;
+    std::atomic<const char *> thread;
+    std::atomic<uint32_t> tid;
+    std::atomic<uint64_t> begin;
+    std::atomic<uint64_t> end;
+    std::atomic<int64_t> inDepth;
+    std::atomic<int64_t> outDepth;
+  };
+
+  const std::chrono::steady_clock::time_point mStart;
+  const uint32_t mMask;
+  std::unique_ptr<Event[]> mEvents;
+  std::atomic<uint64_t> mNext;
+
+  static uint32_t threadId();
+};
+
+// Times a block of code as an event, if tracing is enabled
+class TraceScope {
+public:
+  TraceScope(Tracer *tracer, const char *name, const char *thread)
+    : mTracer(tracer), mName(name), mThread(thread), mBegin(tracer ? tracer->now() : 0),
+      mInDepth(-1), mOutDepth(-1) {}
+  ~TraceScope() {
+    if (mTracer)
+      mTracer->add(mName, mThread, mBegin, mTracer->now(), mInDepth, mOutDepth);
+  }
+
+  void setDepth(int64_t inDepth, int64_t outDepth) { mInDepth = inDepth; mOutDepth = outDepth; }
+
+private:
+  Tracer *const mTracer;
+  const char *const mName;
+  const char *const mThread;
+  const uint64_t mBegin;
+  int64_t mInDepth;
+  int64_t mOutDepth;
+};
+
+} // namespace streampunk
+
+#endif
@@ -0,0 +1,226 @@
+/* Copyright 2019 Streampunk Media Ltd.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+
+#include "WavFile.h"
+#include "SampleFormat.h"
+#include <cstring>
+#include <cerrno>
+#include <chrono>
+#include <algorithm>
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace streampunk {
+
+// the read-ahead publishes its progress a step at a time, so playback can start early
+static const uint64_t readAheadStep = 256 * 1024;
+
+static uint32_t get16(const uint8_t *p) { return p[0] | (p[1] << 8); }
+static uint32_t get32(const uint8_t *p) { return get16(p) | (get16(p + 2) << 16); }
+static uint64_t get64(const uint8_t *p) { return get32(p) | ((uint64_t)get32(p + 4) << 32); }
+
+WavFile::WavFile()
+  : mMap(nullptr), mMapBytes(0), mDataOffset(0), mDataBytes(0), mFormat(0), mSampleBytes(0),
+    mChannels(0), mSampleRate(0), mPos(0), mLoaded(0), mQuit(false) {}
+
+WavFile::~WavFile() {
+  {
+    std::lock_guard<std::mutex> lk(m);
+    mQuit = true;
+  }
+  cv.notify_all();
+  if (mThread.joinable())
+    mThread.join();
+  unmap();
+}
+
+bool WavFile::open(const std::string &path, std::string &errStr) {
+  if (!map(path, errStr))
+    return false;
+  if (!parse(errStr)) {
+    errStr = path + " " + errStr;
+    return false;
+  }
+  mThread = std::thread(&WavFile::run, this);
+  return true;
+}
+
+uint32_t WavFile::read(float *dst, uint32_t numSamples, bool &finished) {
+  uint64_t pos = mPos.load(std::memory_order_relaxed);
+  uint64_t available = mLoaded.load(std::memory_order_acquire) - pos;
+  uint32_t samples = (uint32_t)std::min<uint64_t>(numSamples, available / mSampleBytes);
+  const uint8_t *src = mMap + mDataOffset + pos;
+  if (8 == mFormat) { // 8 bit WAV samples are unsigned
+    for (uint32_t i = 0; i < samples; ++i)
+      dst[i] = ((int32_t)src[i] - 128) / 128.0f;
+  } else
+    convertSamples(src, mFormat, (uint8_t *)dst, 1, samples);
+  pos += samples * mSampleBytes;
+  mPos.store(pos, std::memory_order_relaxed);
+  finished = pos == mDataBytes;
+  return samples;
+}
+
+#ifdef _WIN32
+bool WavFile::map(const std::string &path, std::string &errStr) {
+  HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                            FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+  if (INVALID_HANDLE_VALUE == file) {
+    errStr = std::string("Failed to open ") + path;
+    return false;
+  }
+  LARGE_INTEGER size;
+  HANDLE mapping = nullptr;
+  if (GetFileSizeEx(file, &size) && size.QuadPart)
+    mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+  CloseHandle(file);
+  if (mapping) {
+    // the view keeps the mapping open
+    mMap = (const uint8_t *)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    CloseHandle(mapping);
+  }
+  if (!mMap) {
+    errStr = std::string("Failed to map ") + path;
+    return false;
+  }
+  mMapBytes = (uint64_t)size.QuadPart;
+  return true;
+}
+
+void WavFile::unmap() {
+  if (mMap)
+    UnmapViewOfFile(mMap);
+  mMap = nullptr;
+}
+#else
+bool WavFile::map(const std::string &path, std::string &errStr) {
+  int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    errStr = std::string("Failed to open ") + path + ": " + strerror(errno);
+    return false;
+  }
+  struct stat st;
+  void *map = MAP_FAILED;
+  if ((0 == fstat(fd, &st)) && (st.st_size > 0))
+    map = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  int mapErr = errno;
+  close(fd);
+  if (MAP_FAILED == map) {
+    errStr = std::string("Failed to map ") + path + ": " + strerror(mapErr);
+    return false;
+  }
+  mMap = (const uint8_t *)map;
+  mMapBytes = (uint64_t)st.st_size;
+  madvise(map, mMapBytes, MADV_SEQUENTIAL);
+  return true;
+}
+
+void WavFile::unmap() {
+  if (mMap)
+    munmap((void *)mMap, mMapBytes);
+  mMap = nullptr;
+}
+#endif
+
+// finds the format and data chunks, taking the sizes from the ds64 chunk of an RF64 file
+bool WavFile::parse(std::string &errStr) {
+  if ((mMapBytes < 12) || (memcmp(mMap, "RIFF", 4) && memcmp(mMap, "RF64", 4)) || memcmp(mMap + 8, "WAVE", 4)) {
+    errStr = "is not a WAV file";
+    return false;
+  }
+  uint64_t ds64DataBytes = 0;
+  uint32_t formatTag = 0;
+  uint32_t bits = 0;
+  bool haveData = false;
+  for (uint64_t off = 12; !haveData && (off + 8 <= mMapBytes); ) {
+    const uint8_t *chunk = mMap + off;
+    uint32_t size = get32(chunk + 4);
+    if (!memcmp(chunk, "ds64", 4) && (size >= 16) && (off + 24 <= mMapBytes))
+      ds64DataBytes = get64(chunk + 16);
+    else if (!memcmp(chunk, "fmt ", 4) && (size >= 16) && (off + 24 <= mMapBytes)) {
+      formatTag = get16(chunk + 8);
+      mChannels = get16(chunk + 10);
+      mSampleRate = get32(chunk + 12);
+      bits = get16(chunk + 22);
+      if ((0xfffe == formatTag) && (size >= 40) && (off + 34 <= mMapBytes))
+        formatTag = get16(chunk + 32); // WAVE_FORMAT_EXTENSIBLE - the sub-format starts with the tag
+    } else if (!memcmp(chunk, "data", 4)) {
+      mDataOffset = off + 8;
+      mDataBytes = ((0xffffffff == size) && ds64DataBytes) ? ds64DataBytes : size;
+      haveData = true;
+    }
+    off += 8 + (uint64_t)size + (size & 1);
+  }
+
+  if (1 == formatTag && ((16 == bits) || (24 == bits) || (32 == bits) || (8 == bits)))
+    mFormat = bits;
+  else if ((3 == formatTag) && (32 == bits))
+    mFormat = 1;
+  if (!mFormat || !mChannels || !mSampleRate) {
+    errStr = "is not 8, 16, 24 or 32 bit PCM or 32 bit float";
+    return false;
+  }
+  if (!haveData) {
+    errStr = "has no data";
+    return false;
+  }
+  // a file cut short plays as far as it goes, in whole frames
+  mSampleBytes = sampleBytes(mFormat);
+  uint32_t frameBytes = mChannels * mSampleBytes;
+  mDataBytes = std::min<uint64_t>(mDataBytes, mMapBytes - mDataOffset);
+  mDataBytes -= mDataBytes % frameBytes;
+  return true;
+}
+
+// Brings the file into memory ahead of playback, touching each page so that
+// any fault is taken on this thread rather than in the callback
+void WavFile::run() {
+#ifdef _WIN32
+  const uint64_t pageBytes = 4096;
+#else
+  const uint64_t pageBytes = (uint64_t)sysconf(_SC_PAGESIZE);
+#endif
+  uint64_t aheadBytes = (uint64_t)mSampleRate * mChannels * mSampleBytes * readAheadMs / 1000;
+  uint64_t loaded = 0;
+  volatile uint8_t touched = 0;
+  while (!mQuit && (loaded < mDataBytes)) {
+    uint64_t target = std::min<uint64_t>(mDataBytes, mPos.load(std::memory_order_relaxed) + aheadBytes);
+    if (loaded >= target) {
+      std::unique_lock<std::mutex> lk(m);
+      cv.wait_for(lk, std::chrono::milliseconds(20), [this]{ return mQuit.load(); });
+      continue;
+    }
+    uint64_t end = std::min<uint64_t>(target, loaded + readAheadStep);
+    uint64_t start = (mDataOffset + loaded) / pageBytes * pageBytes;
+#ifndef _WIN32
+    madvise((void *)(mMap + start), mDataOffset + end - start, MADV_WILLNEED);
+#endif
+    for (uint64_t p = start; p < mDataOffset + end; p += pageBytes)
+      touched = touched + mMap[p];
+    touched = touched + mMap[mDataOffset + end - 1];
+    loaded = end;
+    mLoaded.store(loaded, std::memory_order_release);
+  }
+}
+
+} // namespace streampunk
@@ -0,0 +1,75 @@
+/* Copyright 2019 Streampunk Media Ltd.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+
+#ifndef WAVFILE_H
+#define WAVFILE_H
+
+#include <atomic>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+namespace streampunk {
+
+// A WAV or RF64 file mapped into memory for playback. The callback reads samples
+// straight from the mapping, but only as far as a read-ahead thread has already
+// brought the file into memory, so the audio thread never waits on the disk - a
+// read-ahead that falls behind plays short rather than stalling the callback.
+class WavFile {
+public:
+  // how far the read-ahead keeps ahead of playback
+  static const uint32_t readAheadMs = 3000;
+
+  WavFile();
+  ~WavFile();
+
+  // maps and parses the file, then starts the read-ahead
+  bool open(const std::string &path, std::string &errStr);
+
+  uint32_t channels() const { return mChannels; }
+  uint32_t sampleRate() const { return mSampleRate; }
+  uint64_t frames() const { return mDataBytes / (mChannels * mSampleBytes); }
+
+  // Realtime thread only - reads up to numSamples samples as float, returning the number
+  // read. Sets finished once the end of the file has been read.
+  uint32_t read(float *dst, uint32_t numSamples, bool &finished);
+
+private:
+  const uint8_t *mMap;
+  uint64_t mMapBytes;
+  uint64_t mDataOffset;
+  uint64_t mDataBytes;
+  uint32_t mFormat;
+  uint32_t mSampleBytes;
+  uint32_t mChannels;
+  uint32_t mSampleRate;
+  std::atomic<uint64_t> mPos;
+  std::atomic<uint64_t> mLoaded;
+  std::atomic<bool> mQuit;
+  std::thread mThread;
+  std::mutex m;
+  std::condition_variable cv;
+
+  bool map(const std::string &path, std::string &errStr);
+  void unmap();
+  bool parse(std::string &errStr);
+  void run();
+};
+
+} // namespace streampunk
+
+#endif
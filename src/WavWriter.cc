@@ -0,0 +1,264 @@
+/* Copyright 2019 Streampunk Media Ltd.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+
+#include "WavWriter.h"
+#include "Fanout.h"
+#include "SampleFormat.h"
+#include <cstring>
+#include <cerrno>
+#include <chrono>
+#include <algorithm>
+#ifdef __linux__
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace streampunk {
+
+// the header fills the first page, so that the data starts on an aligned boundary
+static const uint32_t headerBytes = 4096;
+static const uint32_t writeBytes = 1 << 20;
+static const uint32_t ds64Bytes = 28;
+// longest gap filled with silence, as a bound on a single discontinuity
+static const uint32_t maxGapSeconds = 10;
+
+static void putTag(uint8_t *p, const char *tag) { memcpy(p, tag, 4); }
+static void put16(uint8_t *p, uint32_t v) { p[0] = v & 0xff; p[1] = (v >> 8) & 0xff; }
+static void put32(uint8_t *p, uint32_t v) { put16(p, v); put16(p + 2, v >> 16); }
+static void put64(uint8_t *p, uint64_t v) { put32(p, (uint32_t)v); put32(p + 4, (uint32_t)(v >> 32)); }
+
+static bool seekTo(FILE *f, uint64_t offset) {
+#ifdef _WIN32
+  return 0 == _fseeki64(f, (int64_t)offset, SEEK_SET);
+#else
+  return 0 == fseeko(f, (off_t)offset, SEEK_SET);
+#endif
+}
+
+WavWriter::WavWriter(std::shared_ptr<CaptureReader> reader, uint32_t format, uint32_t channels,
+                     uint32_t sampleRate, uint64_t preallocBytes, uint32_t headerMs)
+  : mReader(reader), mFormat(format), mChannels(channels), mSampleRate(sampleRate),
+    mFrameBytes(channels * sampleBytes(format)), mPreallocBytes(preallocBytes), mHeaderMs(headerMs),
+    mFile(nullptr), mBufMem(writeBytes + headerBytes), mBuf(nullptr), mBufBytes(0), mFileBytes(0),
+    mAllocated(0), mReserve(preallocBytes > 0), mDataBytes(0), mSilentFrames(0), mRf64(false) {
+  // the gathering buffer starts on a page boundary too
+  uintptr_t addr = (uintptr_t)mBufMem.data();
+  mBuf = mBufMem.data() + (headerBytes - addr % headerBytes) % headerBytes;
+}
+
+WavWriter::~WavWriter() {
+  std::string errStr;
+  finish(errStr);
+}
+
+uint64_t WavWriter::droppedFrames() const {
+  return mReader->droppedFrames();
+}
+
+bool WavWriter::open(const std::string &path, std::string &errStr) {
+  mPath = path;
+  mFile = fopen(path.c_str(), "wb");
+  if (!mFile) {
+    errStr = std::string("Failed to open recording file ") + path + ": " + strerror(errno);
+    return false;
+  }
+  // writes go straight from the aligned buffer to the file
+  setvbuf(mFile, nullptr, _IONBF, 0);
+  preallocate();
+  if (!writeHeader()) {
+    errStr = mErrStr;
+    fclose(mFile);
+    mFile = nullptr;
+    return false;
+  }
+  mThread = std::thread(&WavWriter::run, this);
+  return true;
+}
+
+bool WavWriter::finish(std::string &errStr) {
+  if (mThread.joinable()) {
+    mReader->close();
+    mThread.join();
+  }
+  errStr = mErrStr;
+  return mErrStr.empty();
+}
+
+void WavWriter::run() {
+  std::shared_ptr<Chunks> chunks = mReader->chunks();
+  std::chrono::steady_clock::time_point headerTime = std::chrono::steady_clock::now();
+  uint64_t nextFrame = 0;
+  bool ok = true;
+  while (ok) {
+    chunks->waitNext();
+    std::shared_ptr<Chunk> chunk = chunks->curChunk();
+    if (!chunk)
+      break;
+    if (chunks->curDiscontinuity()) {
+      // keep the file in time across blocks the capture dropped
+      int64_t gapFrames = std::min<int64_t>((int64_t)(chunk->frame() - nextFrame),
+                                            (int64_t)maxGapSeconds * mSampleRate);
+      if (gapFrames > 0) {
+        ok = writeData(nullptr, gapFrames * mFrameBytes);
+        mSilentFrames += gapFrames;
+      }
+      chunks->clearDiscontinuity();
+    }
+    ok = ok && writeData(chunk->buf(), chunk->numBytes());
+    nextFrame = chunk->frame() + chunk->numBytes() / mFrameBytes;
+
+    if (ok && mHeaderMs) {
+      std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+      if (now - headerTime >= std::chrono::milliseconds(mHeaderMs)) {
+        ok = flush(/*all*/false) && writeHeader();
+        headerTime = now;
+      }
+    }
+  }
+
+  if (ok)
+    ok = flush(/*all*/true);
+  if (ok && (mFileBytes & 1)) { // chunks are padded to an even length
+    uint8_t pad = 0;
+    ok = (1 == fwrite(&pad, 1, 1, mFile)) || fail("write");
+  }
+  ok = ok && writeHeader();
+  if (!ok) {
+    // stop the capture offering blocks and hand back those queued
+    mReader->close();
+    while (chunks->tryNext()) {}
+  }
+  releaseAllocation();
+  if ((0 != fclose(mFile)) && ok)
+    fail("close");
+  mFile = nullptr;
+}
+
+bool WavWriter::writeData(const uint8_t *src, uint64_t numBytes) {
+  while (numBytes) {
+    uint32_t bytes = (uint32_t)std::min<uint64_t>(numBytes, writeBytes - mBufBytes);
+    uint8_t *dst = mBuf + mBufBytes;
+    if (src) {
+      memcpy(dst, src, bytes);
+      src += bytes;
+    } else
+      memset(dst, 0, bytes);
+    if (8 == mFormat) // 8 bit WAV samples are unsigned
+      for (uint32_t i = 0; i < bytes; ++i)
+        dst[i] ^= 0x80;
+    mBufBytes += bytes;
+    mDataBytes += bytes;
+    numBytes -= bytes;
+    if ((writeBytes == mBufBytes) && !flush(/*all*/true))
+      return false;
+  }
+  return true;
+}
+
+bool WavWriter::flush(bool all) {
+  uint32_t bytes = all ? mBufBytes : mBufBytes - mBufBytes % headerBytes;
+  if (!bytes)
+    return true;
+  if (mReserve && (headerBytes + mFileBytes + bytes > mAllocated))
+    preallocate();
+  if (fwrite(mBuf, 1, bytes, mFile) != bytes)
+    return fail("write");
+  mFileBytes += bytes;
+  mBufBytes -= bytes;
+  if (mBufBytes)
+    memmove(mBuf, mBuf + bytes, mBufBytes);
+  return true;
+}
+
+bool WavWriter::writeHeader() {
+  uint8_t header[headerBytes];
+  mRf64 = makeHeader(header);
+  if (!seekTo(mFile, 0) || (fwrite(header, 1, headerBytes, mFile) != headerBytes))
+    return fail("write header of");
+  if (!seekTo(mFile, headerBytes + mFileBytes))
+    return fail("seek in");
+  return true;
+}
+
+// RIFF size fields are 32 bit - RF64 moves the sizes into a ds64 chunk in place of
+// the first JUNK chunk and sets the RIFF and data sizes to all ones
+bool WavWriter::makeHeader(uint8_t *header) const {
+  uint64_t riffBytes = headerBytes - 8 + mFileBytes + (mFileBytes & 1);
+  bool rf64 = riffBytes > 0xffffffff;
+  memset(header, 0, headerBytes);
+  putTag(header, rf64 ? "RF64" : "RIFF");
+  put32(header + 4, rf64 ? 0xffffffff : (uint32_t)riffBytes);
+  putTag(header + 8, "WAVE");
+  putTag(header + 12, rf64 ? "ds64" : "JUNK");
+  put32(header + 16, ds64Bytes);
+  if (rf64) {
+    put64(header + 20, riffBytes);
+    put64(header + 28, mFileBytes);
+    put64(header + 36, mFileBytes / mFrameBytes);
+  }
+
+  bool isFloat = 1 == mFormat;
+  uint32_t fmtBytes = isFloat ? 18 : 16; // float carries a zero extension size
+  uint8_t *fmt = header + 20 + ds64Bytes;
+  putTag(fmt, "fmt ");
+  put32(fmt + 4, fmtBytes);
+  put16(fmt + 8, isFloat ? 3 : 1); // WAVE_FORMAT_IEEE_FLOAT or WAVE_FORMAT_PCM
+  put16(fmt + 10, mChannels);
+  put32(fmt + 12, mSampleRate);
+  put32(fmt + 16, mSampleRate * mFrameBytes);
+  put16(fmt + 20, mFrameBytes);
+  put16(fmt + 22, mFrameBytes / mChannels * 8);
+
+  // pad to the end of the page with a second JUNK chunk
+  uint8_t *junk = fmt + 8 + fmtBytes;
+  uint8_t *data = header + headerBytes - 8;
+  putTag(junk, "JUNK");
+  put32(junk + 4, (uint32_t)(data - junk - 8));
+  putTag(data, "data");
+  put32(data + 4, rf64 ? 0xffffffff : (uint32_t)mFileBytes);
+  return rf64;
+}
+
+// reserve the next stretch of the file ahead of the writes, leaving its size alone
+void WavWriter::preallocate() {
+#ifdef __linux__
+  if (mReserve && (0 == fallocate(fileno(mFile), FALLOC_FL_KEEP_SIZE, (off_t)mAllocated, (off_t)mPreallocBytes)))
+    mAllocated += mPreallocBytes;
+  else
+    mReserve = false; // not supported by the file system, or the disk is full
+#else
+  mReserve = false;
+#endif
+}
+
+// hand back the space reserved past the end of the recording
+void WavWriter::releaseAllocation() {
+#ifdef __linux__
+  uint64_t end = headerBytes + mFileBytes + (mFileBytes & 1);
+  if (mAllocated > end) { // truncating to the same length frees the blocks past it
+    int res = ftruncate(fileno(mFile), (off_t)end);
+    (void)res;
+  }
+#endif
+}
+
+bool WavWriter::fail(const char *what) {
+  if (mErrStr.empty())
+    mErrStr = std::string("Failed to ") + what + " recording file " + mPath + ": " + strerror(errno);
+  return false;
+}
+
+} // namespace streampunk
@@ -0,0 +1,93 @@
+/* Copyright 2019 Streampunk Media Ltd.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+
+#ifndef WAVWRITER_H
+#define WAVWRITER_H
+
+#include <cstdio>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace streampunk {
+
+class CaptureReader;
+
+// Writes the blocks of a capture reader to a WAV file from a thread of its own, so
+// that long recordings never pass through the JS heap. Blocks are gathered into
+// large writes that stay aligned to the start of the data, disk space is reserved
+// ahead of the writes where the platform allows, and the header is rewritten
+// periodically so that a recording cut short still opens. Past 4GB of data the
+// header becomes RF64, using the space reserved for it in a JUNK chunk.
+class WavWriter {
+public:
+  // blocks the writer may fall behind by before the capture drops them
+  static const uint32_t maxQueue = 64;
+
+  WavWriter(std::shared_ptr<CaptureReader> reader, uint32_t format, uint32_t channels,
+            uint32_t sampleRate, uint64_t preallocBytes, uint32_t headerMs);
+  ~WavWriter();
+
+  // creates the file and starts the writer thread
+  bool open(const std::string &path, std::string &errStr);
+  // blocking - stops taking blocks, writes what is queued and closes the file
+  bool finish(std::string &errStr);
+
+  uint64_t frames() const { return mDataBytes / mFrameBytes; }
+  // frames of silence written in place of blocks the capture dropped
+  uint64_t silentFrames() const { return mSilentFrames; }
+  uint64_t droppedFrames() const;
+  bool rf64() const { return mRf64; }
+
+private:
+  std::shared_ptr<CaptureReader> mReader;
+  const uint32_t mFormat;
+  const uint32_t mChannels;
+  const uint32_t mSampleRate;
+  const uint32_t mFrameBytes;
+  const uint64_t mPreallocBytes;
+  const uint32_t mHeaderMs;
+  std::string mPath;
+  FILE *mFile;
+  std::thread mThread;
+  std::vector<uint8_t> mBufMem;
+  uint8_t *mBuf;
+  uint32_t mBufBytes;
+  uint64_t mFileBytes;
+  uint64_t mAllocated;
+  bool mReserve;
+  std::atomic<uint64_t> mDataBytes;
+  std::atomic<uint64_t> mSilentFrames;
+  std::atomic<bool> mRf64;
+  std::string mErrStr;
+
+  void run();
+  // buffers data for writing - a null source writes silence
+  bool writeData(const uint8_t *src, uint64_t numBytes);
+  // writes the gathered data - all of it, or just whole pages to keep the writes aligned
+  bool flush(bool all);
+  bool writeHeader();
+  bool makeHeader(uint8_t *header) const;
+  void preallocate();
+  void releaseAllocation();
+  bool fail(const char *what);
+};
+
+} // namespace streampunk
+
+#endif
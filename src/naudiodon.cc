@@ -17,6 +17,7 @@
 #include "naudiodonUtil.h"
 #include "GetDevices.h"
 #include "GetHostAPIs.h"
+#include "PaRuntime.h"
 #include "AudioIO.h"
 
 napi_value Create(napi_env env, napi_callback_info info) {
@@ -43,9 +44,13 @@ napi_value Init(napi_env env, napi_value exports) {
   napi_property_descriptor desc[] = {
     DECLARE_NAPI_METHOD("getDevices", streampunk::getDevices),
     DECLARE_NAPI_METHOD("getHostAPIs", streampunk::getHostAPIs),
+    DECLARE_NAPI_METHOD("refresh", streampunk::refresh),
     DECLARE_NAPI_METHOD("create", Create)
   };
-  status = napi_define_properties(env, exports, 3, desc);
+  status = napi_define_properties(env, exports, 4, desc);
+  CHECK_STATUS;
+
+  status = napi_add_env_cleanup_hook(env, streampunk::PaRuntime::cleanupEnv, env);
   CHECK_STATUS;
 
   return exports;
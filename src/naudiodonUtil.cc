@@ -156,7 +156,7 @@ napi_status naud_set_uint32(napi_env env, napi_value target, const char* name, u
   return napi_set_named_property(env, target, name, prop);
 }
 
-napi_status naud_get_uint32(napi_env env, napi_value target, char* name, uint32_t* value) {
+napi_status naud_get_uint32(napi_env env, napi_value target, const char* name, uint32_t* value) {
   napi_status status;
   napi_value prop;
   status = napi_get_named_property(env, target, name, &prop);